@@ -31,6 +31,7 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <assert.h>
@@ -88,8 +89,8 @@ static void write_bmp(unsigned char * image, FILE * outFile, SKR_Dimensions dim)
 
 int main(int argc, char const *argv[])
 {
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s <string>\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: %s <string> [wrap width]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -118,11 +119,33 @@ int main(int argc, char const *argv[])
 		return EXIT_FAILURE;
 	}
 
-	float const size = 64.0f;
+	SKR_ParagraphStyle style = {
+		.size = 64.0f,
+		.width = argc == 3 ? atof(argv[2]) : 0.0f,
+		.alignment = SKR_ALIGN_CENTER };
 
-	int count;
-	SKR_Assembly assembly[100];
-	s = skrAssembleStringUTF8(&font, argv[1], size, assembly, &count);
+	unsigned long length = strlen(argv[1]);
+	/* there can't be more lines than bytes, plus the empty last one */
+	SKR_Line * lines = malloc((length + 1) * sizeof(SKR_Line));
+	SKR_Assembly * assembly = malloc(length * sizeof(SKR_Assembly));
+	if (lines == NULL || assembly == NULL) return EXIT_FAILURE;
+
+	int lineCount;
+	s = skrBreakLines(&font, argv[1], length, &style, lines, length + 1, &lineCount);
+	if (s != SKR_SUCCESS) {
+		fprintf(stderr, "The string is not valid UTF-8.\n");
+		return EXIT_FAILURE;
+	}
+
+	int count = 0;
+	for (int i = 0; i < lineCount; ++i) {
+		int added;
+		s = skrAssembleLine(&font, argv[1], &style, lines, i,
+			assembly + count, length - count, &added);
+		if (s != SKR_SUCCESS) return EXIT_FAILURE;
+		count += added;
+	}
+	free(lines);
 
 	SKR_Bounds bounds;
 	s = skrGetAssemblyBounds(&font, assembly, count, &bounds);
@@ -147,6 +170,7 @@ int main(int argc, char const *argv[])
 	skrExportImage(raster, image, dims);
 
 	free(raster);
+	free(assembly);
 
 	write_bmp(image, outFile, dims);
 
@@ -19,6 +19,19 @@ typedef struct {
 	unsigned long length;
 } SKR_TTF_Table;
 
+/*
+The table directory gets hashed into a fixed number of slots by tag.
+Fonts with more tables than fit comfortably into the index are still
+supported; lookups for them simply fall back to a binary search
+of the (sorted) directory in the font file itself.
+*/
+#define SKR_TABLE_SLOTS 64
+
+typedef struct {
+	uint32_t tag;
+	SKR_TTF_Table table;
+} SKR_TableSlot;
+
 typedef struct {
 	unsigned long endCodes, startCodes, idDeltas, idRangeOffsets;
 	int segCount;
@@ -30,11 +43,80 @@ typedef struct {
 	unsigned long glyphIndexArray;
 } SKR_cmap_format6;
 
+typedef struct {
+	float advanceWidth;
+	float leftSideBearing;
+} SKR_HorMetrics;
+
+#define SKR_MAX_PAIR_SUBTABLES 32
+
+/*
+Where the kerning data of a font lives. This is filled in lazily,
+the first time kerning is needed. For the kern table there is just one
+(format 0) subtable, for GPOS these are all PairPos subtables
+used by the 'kern' feature, in lookup order.
+*/
+typedef struct {
+	short source;
+	short numSubtables;
+	unsigned long sourceOffset;
+	unsigned long subtables[SKR_MAX_PAIR_SUBTABLES];
+} SKR_Kerning;
+
+/*
+Where the embedded bitmaps of a font live, in EBLC and EBDT,
+or CBLC and CBDT for color fonts. Filled in lazily, just like kerning.
+*/
+typedef struct {
+	SKR_TTF_Table location, data;
+	unsigned long numSizes;
+} SKR_Strikes;
+
+/*
+Where the outlines of a font with CFF (version 1) or CFF2 outlines are,
+instead of glyf and loca. The offsets are from the start of the font data,
+and 0 where a font doesn't have the structure. version is 0 for fonts
+with glyf outlines.
+*/
+typedef struct {
+	int version;
+	SKR_TTF_Table table;
+	unsigned long charStrings, globalSubrs, localSubrs;
+	unsigned long fdArray, fdSelect, varStore;
+} SKR_CFF;
+
+/*
+Trades outline accuracy for drawing speed. The tolerances are in pixels,
+so they adapt to the size glyphs are drawn at: the smaller the glyph,
+the more of its tiny features fall below them.
+SKR_QUALITY_NORMAL flattens curves to within half a pixel and only merges
+segments too short to show up at all.
+SKR_QUALITY_HIGH flattens curves to within an eighth of a pixel and
+merges nothing.
+SKR_QUALITY_FAST flattens curves to within a pixel, and merges
+runs of segments shorter than an eighth of a pixel into one.
+Glyphs already in a glyph cache stay the way they were drawn.
+*/
+typedef enum {
+	SKR_QUALITY_NORMAL,
+	SKR_QUALITY_HIGH,
+	SKR_QUALITY_FAST
+} SKR_Quality;
+
 typedef struct {
 	void const * data;
 	unsigned long length;
+	/* set by the user, and left alone by skrInitializeFont() and skrLoadFontCache() */
+	SKR_Quality quality;
+	struct SKR_CharstringCache * charstringCache;
+
+	int faceIndex;
+	unsigned long directory;
+	int numTables, indexOverflow;
+	SKR_TableSlot tableIndex[SKR_TABLE_SLOTS];
 
 	SKR_TTF_Table cmap, glyf, head, hhea, hmtx, loca, maxp;
+	SKR_CFF cff;
 
 	short unitsPerEm, indexToLocFormat, numGlyphs;
 
@@ -44,25 +126,210 @@ typedef struct {
 		SKR_cmap_format6 format6;
 	} mapping;
 
-	short lineGap;
+	short ascender, descender, lineGap;
 	unsigned short numberOfHMetrics;
+
+	/* optional tables that have been parsed on first use */
+	unsigned int parsedTables;
+	SKR_Kerning kerning;
+	SKR_Strikes strikes;
+
+	/* decoded caches, see skrAttachFontCache() */
+	uint16_t const * cachedGlyphs;
+	unsigned long numCachedCodes;
+	SKR_HorMetrics const * cachedMetrics;
+	int16_t const * cachedBoxes;
+	void const * cachedOutlines;
+	void const * cachedKerning;
+
+	/* the instance this is the font of, see skrInitInstance() */
+	struct SKR_Instance * instance;
 } SKR_Font;
 
+#define SKR_MAX_AXES 16
+
+/* An axis of a variable font, in user units (like 100 to 900 for 'wght'). */
+typedef struct {
+	uint32_t tag;
+	float minValue, defaultValue, maxValue;
+} SKR_Axis;
+
+/*
+A variable font pinned to one value on each of its axes. Apart from
+the font, don't touch the fields; they are only public so that
+instances can live wherever you want them to.
+*/
+typedef struct SKR_Instance {
+	SKR_Font font;
+	int numAxes;
+	int16_t coords[SKR_MAX_AXES];
+	SKR_TTF_Table gvar, hvar;
+	unsigned long numRegions;
+	void * glyphs;
+	double * regionScalars;
+	void * scratch;
+	unsigned long maxPoints, maxContours;
+	unsigned char * arena;
+	unsigned long arenaSize, arenaUsed;
+	int lock;
+} SKR_Instance;
+
+/* font is the index of the glyph's font in a font chain, and 0 otherwise. */
 typedef struct {
 	int glyph;
 	float size;
 	float x, y;
+	int font;
 } SKR_Assembly;
 
+/*
+Where a bounded assembly left off: the number of input bytes consumed
+so far, the pen position, and the last glyph placed and its font
+(for kerning).
+*/
 typedef struct {
-	float advanceWidth;
-	float leftSideBearing;
-} SKR_HorMetrics;
+	unsigned long position;
+	float x;
+	Glyph prevGlyph;
+	int prevFont;
+} SKR_AssemblyState;
+
+#define SKR_MAX_CHAIN_FONTS 8
+
+typedef struct {
+	SKR_Font * fonts[SKR_MAX_CHAIN_FONTS];
+	int numFonts;
+	uint16_t const * pages;
+	uint32_t const * entries;
+} SKR_FontChain;
+
+typedef enum {
+	SKR_ALIGN_LEFT,
+	SKR_ALIGN_CENTER,
+	SKR_ALIGN_RIGHT
+} SKR_Alignment;
+
+/*
+A width of 0 turns off wrapping, so lines only end at newlines.
+Alignment is relative to the width, which makes it a no-op without one.
+*/
+typedef struct {
+	float size;
+	float width;
+	SKR_Alignment alignment;
+} SKR_ParagraphStyle;
+
+/*
+A line covers the bytes from start up to next. Only the bytes up to end
+are visible; the rest are the spaces or the newline it was broken at.
+The width is that of the visible part.
+*/
+typedef struct {
+	unsigned long start, end, next;
+	float width;
+} SKR_Line;
+
+/*
+Describes an edit to text that has already been broken into lines:
+at byte position, removed bytes were replaced by inserted new ones.
+*/
+typedef struct {
+	unsigned long position, removed, inserted;
+} SKR_TextEdit;
+
+/*
+The measurements of a run of text, in pixels. Ascent and descent are the
+line bounds of the font (descent is negative, as in hhea); the ink box
+bounds the glyph outlines, and is inverted (xMin > xMax) if there are none.
+*/
+typedef struct {
+	float advance;
+	float ascent, descent;
+	float xMin, yMin, xMax, yMax;
+} SKR_TextMetrics;
+
+/* A place a caret can go: its pen position, and its byte offset into the text. */
+typedef struct {
+	float x;
+	unsigned long offset;
+} SKR_Caret;
 
 typedef struct {
 	uint32_t width, height;
 } SKR_Dimensions;
 
+/*
+The run cache and the glyph cache keep their contents in caller-provided
+memory, and share this bookkeeping. Don't touch the fields; they are
+only public so the caches can live wherever you want them to.
+hits and misses count the lookups, to help choose a memory budget.
+*/
+typedef struct {
+	void * slots;
+	unsigned long numSlots;
+	unsigned char * arena;
+	unsigned long arenaSize;
+	unsigned long head, tail, wrapAt;
+	int wrapped;
+	unsigned long numRecords;
+	unsigned long hits, misses;
+} SKR_CacheRing;
+
+typedef struct {
+	SKR_CacheRing ring;
+} SKR_RunCache;
+
+typedef struct {
+	SKR_CacheRing ring;
+} SKR_GlyphCache;
+
+#define SKR_CACHE_SHARDS 16
+
+typedef struct {
+	SKR_GlyphCache shards[SKR_CACHE_SHARDS];
+	int locks[SKR_CACHE_SHARDS];
+} SKR_SharedGlyphCache;
+
+typedef struct {
+	SKR_SharedGlyphCache * shared;
+	SKR_GlyphCache local;
+} SKR_RenderContext;
+
+typedef struct SKR_CharstringCache {
+	SKR_CacheRing shards[SKR_CACHE_SHARDS];
+	int locks[SKR_CACHE_SHARDS];
+} SKR_CharstringCache;
+
+#define SKR_MAX_WORKERS 64
+#define SKR_CACHE_LINE 64
+
+/* All code points from first to last, inclusive. */
+typedef struct {
+	int first, last;
+} SKR_CodeRange;
+
+/*
+The items of one worker, and how many of them it has done so far.
+Each sits on a cache line of its own, so that workers taking items
+don't make the line bounce between cores.
+*/
+typedef struct {
+	uint64_t range;
+	unsigned long done, failed;
+} __attribute__((aligned(SKR_CACHE_LINE))) SKR_WarmUpShare;
+
+typedef struct {
+	SKR_Font const * font;
+	SKR_SharedGlyphCache * cache;
+	SKR_CodeRange const * ranges;
+	int numRanges;
+	float const * sizes;
+	int numSizes;
+	int numWorkers;
+	unsigned long numItems;
+	SKR_WarmUpShare shares[SKR_MAX_WORKERS];
+} SKR_WarmUp;
+
 /*
 The transformation order goes: first scale, then move.
 */
@@ -70,12 +337,52 @@ typedef struct {
 	float xScale, yScale, xMove, yMove;
 } SKR_Transform;
 
+/*
+A general affine transformation, mapping (x, y) to
+(xx * x + xy * y + dx, yx * x + yy * y + dy).
+An SKR_Transform is the same as { xScale, 0, 0, yScale, xMove, yMove }.
+*/
+typedef struct {
+	float xx, xy, yx, yy;
+	float dx, dy;
+} SKR_Affine;
+
 typedef struct {
 	long xMin, yMin, xMax, yMax;
 } SKR_Bounds;
 
 typedef uint32_t RasterCell;
 
+/*
+The values in the planes of a planar raster are either int16_t,
+like in RasterCells, or int32_t.
+*/
+typedef enum {
+	SKR_CELLS_16,
+	SKR_CELLS_32
+} SKR_CellFormat;
+
+/*
+A raster in planar layout: the edge values of all cells in one plane,
+and their tails in another, instead of packed together in RasterCells.
+tiles is a map of which parts of the planes have been drawn into.
+*/
+typedef struct {
+	void * edges;
+	void * tails;
+	uint8_t * tiles;
+	SKR_Dimensions dims;
+	SKR_CellFormat format;
+} SKR_Raster;
+
+/* A run of pixels in one row that all have the same coverage. */
+typedef struct {
+	uint32_t row;
+	uint32_t x;
+	uint32_t length;
+	uint8_t alpha;
+} SKR_Span;
+
 #define SKR_USUAL_GAMMA_VALUE 2.2f
 #define SKR_GAMMA_TABLE_LENGTH 1025
 
@@ -91,29 +398,511 @@ typedef struct {
 
 SKR_Status skrInitializeFont(SKR_Font * restrict font);
 
+/*
+Font collections (.ttc) hold several faces in one file. skrCountFaces()
+works on any font data, returning 1 for plain fonts. skrInitializeFont()
+is the same as initializing face 0. All table offsets stay relative
+to the start of the collection, so faces of one collection that share
+tables also point at the same bytes.
+*/
+SKR_Status skrCountFaces(SKR_Font const * restrict font, int * restrict count);
+SKR_Status skrInitializeFace(SKR_Font * restrict font, int faceIndex);
+
+/*
+Looks up any table of an initialized font by its tag, e.g. "kern" or "OS/2".
+Only the core tables needed for rendering are parsed by skrInitializeFont();
+everything else is located through this index and parsed on first use.
+*/
+SKR_Status skrFindTable(SKR_Font const * restrict font,
+	char const tag[4], SKR_TTF_Table * restrict table);
+
+/*
+The font cache holds decoded lookup structures (a direct character map,
+pre-scaled metrics, glyph bounding boxes, decoded glyf outlines and a
+kerning pair index) in a single block of caller-provided memory, which
+should be aligned to at least 8 bytes. Glyphs drawn from decoded outlines
+come out exactly as they do from the glyf table, just without parsing;
+compound glyphs and CFF outlines are not decoded ahead of time.
+Each section in the block remembers which tables it was built from.
+skrAttachFontCache() attaches all sections that match the tables of the
+given face and leaves the others alone, so one block built from a face
+of a collection can be shared by every face that uses the same glyf,
+hmtx or cmap data. The metrics, boxes, outlines and kerning are indexed
+by glyph, so they only attach to faces with the same number of glyphs;
+the character map attaches regardless. skrAttachFontCache() fails if no
+section could be attached at all. Only attach a cache to faces of the
+font file it was built from. The memory has to outlive every font it
+is attached to.
+
+The block is also a file format: it contains no pointers, carries a
+version number and a snapshot of the initialized SKR_Font, and is keyed
+by the checksum of the font it was built from. Write it out next to the
+font, and later mmap() it and hand it to skrLoadFontCache() together with
+the original font data. That restores the font without parsing anything,
+or fails if the cache is stale, from another version of Skribist,
+or from another platform, in which case just call skrInitializeFace()
+and rebuild the cache.
+*/
+#define SKR_FONT_CACHE_VERSION 8
+
+unsigned long skrCalcFontCacheSize(SKR_Font const * restrict font);
+SKR_Status skrBuildFontCache(SKR_Font const * restrict font,
+	void * restrict memory, unsigned long size);
+SKR_Status skrAttachFontCache(SKR_Font * restrict font,
+	void const * restrict memory, unsigned long size);
+SKR_Status skrLoadFontCache(SKR_Font * restrict font,
+	void const * restrict memory, unsigned long size);
+
+/*
+The font checksum combines the per-table checksums from the table
+directory of a face, so it is cheap to compute and doesn't touch the
+tables themselves.
+*/
+SKR_Status skrGetFontChecksum(SKR_Font const * restrict font,
+	uint32_t * restrict checksum);
+
+/*
+Variable fonts. skrCountAxes() counts 0 axes for static fonts, and
+skrGetAxis() describes the others in the order of the fvar table.
+skrInitInstance() pins a variable font with TrueType outlines to one
+value per axis, in that same order and in user units, or to the
+defaults if values is 0. The font of the instance then works with every
+function that takes a font, and draws the glyphs at those values.
+Moving the points of a glyph takes longer than drawing it, so each glyph
+only gets instanced the first time it is needed: its outline is written
+into the memory of the instance as a plain glyf outline, along with its
+metrics (from HVAR, or else from the phantom points in gvar) and its box.
+From then on it draws just as fast as a glyph of a static font.
+The memory has to be skrCalcInstanceSize() bytes, aligned to at least
+8 bytes, which is enough to hold every glyph of the font; the size is 0
+for fonts that can't be instanced. The instance must not be moved, and
+font caches can't be built from it or attached to it. Instances may be
+shared between threads like fonts; glyphs get instanced under a lock.
+Only the advances of compound glyphs vary, and kerning doesn't at all.
+*/
+SKR_Status skrCountAxes(SKR_Font const * restrict font, int * restrict count);
+SKR_Status skrGetAxis(SKR_Font const * restrict font,
+	int index, SKR_Axis * restrict axis);
+unsigned long skrCalcInstanceSize(SKR_Font const * restrict font);
+SKR_Status skrInitInstance(SKR_Instance * restrict instance,
+	SKR_Font const * restrict font, float const * restrict values,
+	void * restrict memory, unsigned long size);
+
 void skrBuildScreenInfo(SKR_ScreenInfo * restrict screenInfo);
 
 SKR_Status skrAssembleStringUTF8(SKR_Font * restrict font,
 	char const * restrict line, float size,
 	SKR_Assembly * restrict assembly, int * restrict count);
+
+/*
+Bounded, resumable assembly. skrAssembleUTF8() continues at byte
+state->position of text, writes at most capacity glyphs and updates the
+state, so long text can be assembled a chunk at a time without rescanning.
+All of the input has been processed once state->position == length.
+If the text itself arrives in pieces, reset position to 0 for each new
+piece (prepending whatever bytes of the last piece weren't consumed)
+and keep the rest of the state, so the pen and kerning carry over.
+Malformed UTF-8 fails with state->position at the offending byte.
+Any other failure leaves the state at the start of the block of glyphs
+it happened in, with *count covering only the glyphs before that block.
+skrAssembleStringUTF8() fails if the string ends in the middle of a
+sequence.
+*/
+void skrBeginAssembly(SKR_AssemblyState * restrict state);
+SKR_Status skrAssembleUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_AssemblyState * restrict state,
+	SKR_Assembly * restrict assembly, int capacity, int * restrict count);
 SKR_Status skrGetAssemblyBounds(SKR_Font * restrict font,
 	SKR_Assembly * restrict assembly, int count, SKR_Bounds * restrict bounds);
 SKR_Status skrDrawAssembly(SKR_Font * restrict font,
 	SKR_Assembly * restrict assembly, int count,
 	uint32_t * restrict raster, SKR_Bounds bounds);
 
+/*
+These apply an affine transformation to a whole assembly,
+e.g. to rotate a label around its origin.
+*/
+SKR_Status skrGetAssemblyBoundsAffine(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Bounds * restrict bounds);
+SKR_Status skrDrawAssemblyAffine(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	RasterCell * restrict raster, SKR_Bounds bounds);
+
+/*
+Font fallback. A font chain takes up to SKR_MAX_CHAIN_FONTS fonts, most
+preferred first, and maps every character to the first of them that has
+a glyph for it, which skrResolveCode() then looks up in one step.
+Characters none of them have get the missing glyph of the first font.
+skrInitFontChain() goes through the character maps of all the fonts
+once, so attach font caches first to speed it up; the fonts have to
+stay where they are for as long as the chain is in use. The memory
+(aligned to at least 8 bytes) has to be skrCalcFontChainSize() bytes,
+which depends on how many blocks of 64 characters the fonts cover
+between them, at a quarter of a kilobyte each. The chain only ever
+reads it, so it may be shared between threads.
+
+Assembling from a chain records the font of every glyph in the
+assembly, so chain assemblies have to be measured and drawn through the
+chain as well. Kerning only applies between glyphs of the same font.
+*/
+unsigned long skrCalcFontChainSize(SKR_Font * const * restrict fonts, int count);
+SKR_Status skrInitFontChain(SKR_FontChain * restrict chain,
+	SKR_Font * const * restrict fonts, int count,
+	void * restrict memory, unsigned long size);
+void skrResolveCode(SKR_FontChain const * restrict chain, int32_t code,
+	int * restrict font, Glyph * restrict glyph);
+SKR_Status skrAssembleChainStringUTF8(SKR_FontChain const * restrict chain,
+	char const * restrict line, float size,
+	SKR_Assembly * restrict assembly, int * restrict count);
+SKR_Status skrAssembleChainUTF8(SKR_FontChain const * restrict chain,
+	char const * restrict text, unsigned long length, float size,
+	SKR_AssemblyState * restrict state,
+	SKR_Assembly * restrict assembly, int capacity, int * restrict count);
+SKR_Status skrGetChainAssemblyBoundsAffine(SKR_FontChain const * restrict chain,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Bounds * restrict bounds);
+SKR_Status skrDrawChainAssemblyAffine(SKR_FontChain const * restrict chain,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	RasterCell * restrict raster, SKR_Bounds bounds);
+
+/*
+Paragraph layout. skrBreakLines() breaks text into lines greedily,
+at spaces where possible and in the middle of a word where a word
+is too long for a line of its own. It fails if the text is not valid
+UTF-8 or needs more than capacity lines.
+
+After an edit, skrRebreakLines() takes the lines of the old text and
+brings them up to date with the new one. It only breaks lines from just
+before the edit up to the first line that starts at the same place
+as before; all lines after that are merely moved. On return,
+*first and *rebuilt tell which lines are new, so that only those have
+to be assembled again (plus the ones after them if the line count
+changed, since they moved up or down). If it fails, the lines are
+garbage and have to be broken from scratch.
+
+skrAssembleLine() assembles one line with its alignment applied and its
+baseline placed at y = -index * skrGetLineHeight(). It needs room for at
+most end - start glyphs, and fails if there is less than it takes.
+*/
+float skrGetLineHeight(SKR_Font const * restrict font, float size);
+SKR_Status skrBreakLines(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length,
+	SKR_ParagraphStyle const * restrict style,
+	SKR_Line * restrict lines, int capacity, int * restrict count);
+SKR_Status skrRebreakLines(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length,
+	SKR_ParagraphStyle const * restrict style, SKR_TextEdit edit,
+	SKR_Line * restrict lines, int capacity, int * restrict count,
+	int * restrict first, int * restrict rebuilt);
+SKR_Status skrAssembleLine(SKR_Font * restrict font, char const * restrict text,
+	SKR_ParagraphStyle const * restrict style, SKR_Line const * restrict lines,
+	int index, SKR_Assembly * restrict assembly, int capacity, int * restrict count);
+
+/*
+Measuring without assembling. Everything is computed straight from
+the metrics, applying kerning just like assembly does. The ink box also
+needs the bounds of every glyph: with a font cache attached those are
+a table lookup, but without one skrMeasureUTF8() reads the header of
+each glyph from glyf, which is most of what it costs. Where only the
+advance is needed, the last caret from skrMeasureCaretsUTF8() is it,
+and no glyph headers are read.
+
+skrMeasureCaretsUTF8() puts out every place a caret can go, from
+offset 0 to offset length, in order: one in front of each glyph
+(where it starts, after kerning) and one at the end of the text. That
+is never more than length + 1 carets. It fails if they don't fit into
+capacity, in which case *count is the number it would have taken.
+skrHitTestCarets() then finds the caret nearest to pen position x by
+binary search, so that hit-testing the same text over and over, as
+while dragging a selection, doesn't walk it from the start each time.
+skrHitTestUTF8() does the same in one go, for when x is only tested
+once; it stops at the caret it finds.
+*/
+SKR_Status skrMeasureUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_TextMetrics * restrict metrics);
+SKR_Status skrMeasureCaretsUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_Caret * restrict carets, unsigned long capacity, unsigned long * restrict count);
+unsigned long skrHitTestCarets(SKR_Caret const * restrict carets,
+	unsigned long count, float x);
+SKR_Status skrHitTestUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	float x, unsigned long * restrict offset);
+
+/*
+Run cache. skrInitRunCache() sets up a cache in a block of memory
+(aligned to at least 8 bytes), which is all it will ever use.
+A label of ten characters takes up about 250 bytes of it.
+Runs are keyed by their text, font and size, and looking one up that
+has been assembled before is a single hash lookup. When the memory runs
+out, the runs that were added first get evicted first.
+
+skrAssembleCachedUTF8() hands out a pointer to the cached assembly and
+its bounds (all 0 for runs without any ink). The pointer stays valid
+until the next call that has to add a run to the cache. Fonts are told
+apart by their address, so reinitialize the cache before reusing an
+SKR_Font for another face. Fails on malformed UTF-8, and on runs that
+are too large for the cache to hold at all.
+*/
+void skrInitRunCache(SKR_RunCache * restrict cache,
+	void * restrict memory, unsigned long size);
+SKR_Status skrAssembleCachedUTF8(SKR_RunCache * restrict cache,
+	SKR_Font * restrict font, char const * restrict text,
+	unsigned long length, float size,
+	SKR_Assembly const ** restrict assembly, int * restrict count,
+	SKR_Bounds * restrict bounds);
+
+/*
+Glyph cache. skrDrawAssemblyCached() is an alternative to rasterizing
+with skrDrawAssembly() and exporting the raster: it renders every glyph
+of an assembly only once per size and quarter-pixel horizontal offset,
+keeps it in the cache as 8-bit coverage, and adds it straight onto an
+image in the format skrExportImage() writes. Baselines get rounded to
+whole pixels. The image, covering the given bounds, has to be cleared
+to 0 beforehand. Like the run cache, the glyph cache tells fonts apart
+by their address, and fails on glyphs too large for it to hold.
+*/
+void skrInitGlyphCache(SKR_GlyphCache * restrict cache,
+	void * restrict memory, unsigned long size);
+SKR_Status skrDrawAssemblyCached(SKR_GlyphCache * restrict cache,
+	SKR_Font const * restrict font, SKR_Assembly const * restrict assembly, int count,
+	unsigned char * restrict image, SKR_Bounds bounds);
+
+/*
+Threads. Once it has been set up, a font may be used by any number
+of threads at once; only skrInitializeFace(), skrLoadFontCache() and
+skrAttachFontCache() must not run while anything else uses it.
+Optional tables like kerning are still parsed on first use,
+but under an atomic guard, so whichever thread gets there first
+parses them, and any others wait for it.
+Rasters, images, assemblies, run caches and glyph caches all belong
+to a single thread at a time.
+
+To share rendered glyphs between threads anyway, give each thread an
+SKR_RenderContext of its own, all pointing to one SKR_SharedGlyphCache.
+skrDrawAssemblyInContext() works just like skrDrawAssemblyCached(), but
+glyphs that are new to the context are looked up in the shared cache
+(and rendered there, if nobody has yet) and then copied into the memory
+of the context. The shared cache is split into SKR_CACHE_SHARDS shards
+by glyph, each with a lock of its own, and the contexts only take a lock
+on their own misses. A shared cache of 0 makes the context a plain glyph
+cache. The memory of the shared cache gets split evenly between the shards.
+*/
+void skrInitSharedGlyphCache(SKR_SharedGlyphCache * restrict cache,
+	void * restrict memory, unsigned long size);
+void skrInitRenderContext(SKR_RenderContext * restrict context,
+	SKR_SharedGlyphCache * restrict shared, void * restrict memory, unsigned long size);
+SKR_Status skrDrawAssemblyInContext(SKR_RenderContext * restrict context,
+	SKR_Font const * restrict font, SKR_Assembly const * restrict assembly, int count,
+	unsigned char * restrict image, SKR_Bounds bounds);
+
+/*
+Fonts with CFF or CFF2 outlines (most .otf files) store their glyphs as
+Type 2 charstrings, which call into subroutines shared between glyphs and
+have to be interpreted from the start on every draw. A charstring cache
+keeps the outlines that come out of that, so every glyph only gets
+interpreted once; point font->charstringCache at one to use it.
+Just like the shared glyph cache, it is split into SKR_CACHE_SHARDS
+shards with a lock each, so one cache can serve several threads and
+fonts, which it tells apart by their address. Glyphs too large for a
+shard get interpreted on every draw instead.
+*/
+void skrInitCharstringCache(SKR_CharstringCache * restrict cache,
+	void * restrict memory, unsigned long size);
+
+/*
+Warm-up. Renders every code point of the given ranges at every one of
+the sizes into a shared glyph cache ahead of time, at all the subpixel
+offsets the cache uses, so that the first frames find them all there.
+skrBeginWarmUp() sets up a job for numWorkers threads (at most
+SKR_MAX_WORKERS), which each call skrRunWarmUp() with their own index
+from 0 to numWorkers - 1. Work is split evenly at first, and workers
+that run out steal from the others, so all of them finish at about the
+same time. Each call returns when there is no work left to take, but
+workers that are still busy may be finishing their last glyphs then.
+Any thread may poll skrGetWarmUpProgress() in the meantime; the job is
+complete once done reaches total. Glyphs that could not be rendered
+count as done, and as failed. The ranges, sizes and the job itself have
+to stay around until every worker has returned. Jobs on the heap should
+be aligned to SKR_CACHE_LINE, like the compiler aligns them elsewhere.
+*/
+SKR_Status skrBeginWarmUp(SKR_WarmUp * restrict job, SKR_Font const * restrict font,
+	SKR_SharedGlyphCache * restrict cache, SKR_CodeRange const * restrict ranges,
+	int numRanges, float const * restrict sizes, int numSizes, int numWorkers);
+void skrRunWarmUp(SKR_WarmUp * restrict job, int worker);
+void skrGetWarmUpProgress(SKR_WarmUp const * restrict job,
+	unsigned long * restrict done, unsigned long * restrict failed,
+	unsigned long * restrict total);
+
 Glyph skrGlyphFromCode(SKR_Font const * restrict font, int charCode);
 
+/*
+Converts UTF-8 text into glyphs and their advance widths (in ems)
+in a single pass. Conversion stops when the output is full, at the end
+of the input, or at the first malformed sequence. In the latter case
+SKR_FAILURE is returned and *consumed is the offset of the bad sequence.
+A sequence that is cut off by the end of the input is left unconsumed,
+so that text arriving in chunks can be continued where it stopped.
+*/
+SKR_Status skrGlyphsFromUTF8(SKR_Font const * restrict font,
+	char const * restrict text, unsigned long length,
+	Glyph * restrict glyphs, float * restrict advances, unsigned long capacity,
+	unsigned long * restrict count, unsigned long * restrict consumed);
+
 SKR_Status skrGetHorMetrics(SKR_Font const * restrict font,
 	Glyph glyph, SKR_HorMetrics * restrict metrics);
 
+/*
+Returns the horizontal adjustment between two glyphs in ems, taken from
+the GPOS 'kern' feature or, if there is none, the kern table.
+Fonts without kerning just return 0.
+*/
+SKR_Status skrGetKerning(SKR_Font * restrict font,
+	Glyph left, Glyph right, float * restrict kerning);
+
 SKR_Status skrGetOutlineBounds(SKR_Font const * restrict font, Glyph glyph,
 	SKR_Transform transform, SKR_Bounds * restrict bounds);
 SKR_Status skrDrawOutline(SKR_Font const * restrict font, Glyph glyph,
 	SKR_Transform transform, RasterCell * restrict raster, SKR_Dimensions dims);
 
+/*
+The affine variants of the above, for rotated and slanted glyphs.
+The bounds are those of the transformed glyph box.
+*/
+SKR_Status skrGetOutlineBoundsAffine(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, SKR_Bounds * restrict bounds);
+SKR_Status skrDrawOutlineAffine(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, RasterCell * restrict raster, SKR_Dimensions dims);
+
+/*
+A strike is a set of embedded bitmaps, drawn by hand for one size.
+sizeRecord is the offset of its entry in the font data.
+*/
+typedef struct {
+	SKR_TTF_Table location, data;
+	unsigned long sizeRecord;
+	int ppem, bitDepth;
+} SKR_Strike;
+
+/*
+Where the bitmap sits relative to the pen position, with y going up,
+just like SKR_Bounds.
+*/
+typedef struct {
+	long xMin, yMin;
+	uint32_t width, height;
+	int advance;
+} SKR_BitmapMetrics;
+
+/*
+Looks for a strike of exactly the given size, in pixels per em.
+Bitmaps with 1, 2, 4 or 8 bits per pixel are supported, stored in any
+of the image formats 1, 2, 5, 6 or 7. Glyphs that are missing from
+the strike, or only available as PNG or composite bitmaps, make the two
+functions after this one fail, so that they can be drawn from their
+outlines instead. The assembly functions and the glyph cache do just that
+on their own, as long as the assembly is not scaled, rotated or slanted.
+*/
+SKR_Status skrFindStrike(SKR_Font * restrict font,
+	float size, SKR_Strike * restrict strike);
+SKR_Status skrGetStrikeMetrics(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph,
+	SKR_BitmapMetrics * restrict metrics);
+/* Adds the bitmap onto the raster, with the pen at (x, y). */
+SKR_Status skrDrawStrikeGlyph(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph, long x, long y,
+	RasterCell * restrict raster, SKR_Dimensions dims);
+
 unsigned long skrCalcCellCount(SKR_Dimensions dims);
 void skrExportImage(RasterCell * restrict raster,
 	unsigned char * restrict image, SKR_Dimensions dims);
 
+/*
+Paths. These draw arbitrary shapes into the same rasters as glyphs,
+with the same rasterizer, so text and shapes can share one raster and
+one export. The affine maps path coordinates to pixels, and the quality
+sets how finely curves get flattened, as it does for fonts. Parts of the
+path outside of the raster are clipped away.
+Every subpath is closed with a straight line, by skrClosePath() or by
+the next skrMoveTo(), and the last one has to be closed before the
+raster is exported. The path itself holds nothing but the pen, so
+any number of them may draw into the same raster one after another.
+
+skrExportImage() only fills where the winding is positive, which is all
+glyphs need. skrExportFilled() exports the same way, but fills by a
+proper fill rule, regardless of which way the contours go.
+*/
+typedef struct {
+	RasterCell * raster;
+	SKR_Dimensions dims;
+	SKR_Affine affine;
+	SKR_Quality quality;
+	float startX, startY;
+	float x, y;
+} SKR_Path;
+
+typedef enum {
+	SKR_FILL_NONZERO,
+	SKR_FILL_EVEN_ODD
+} SKR_FillRule;
+
+/* Fails for an invalid quality. */
+SKR_Status skrBeginPath(SKR_Path * restrict path, SKR_Affine affine, SKR_Quality quality,
+	RasterCell * restrict raster, SKR_Dimensions dims);
+void skrMoveTo(SKR_Path * restrict path, float x, float y);
+void skrLineTo(SKR_Path * restrict path, float x, float y);
+void skrQuadTo(SKR_Path * restrict path, float cx, float cy, float x, float y);
+void skrCubicTo(SKR_Path * restrict path, float c1x, float c1y,
+	float c2x, float c2y, float x, float y);
+void skrClosePath(SKR_Path * restrict path);
+void skrExportFilled(RasterCell * restrict raster,
+	unsigned char * restrict image, SKR_Dimensions dims, SKR_FillRule rule);
+
+/*
+Planar rasters. Keeping edges and tails apart means drawing only ever
+touches the values it changes, and exporting can load them straight
+into vector registers, without splitting cells apart first.
+skrInitRaster() lays the planes out in a block of memory of
+skrCalcRasterSize() bytes, aligned to at least 32 bytes. The memory
+doesn't need to be cleared: the planes are split into tiles, and each
+one only gets cleared once something is drawn into it, so blank parts
+of the raster are neither cleared nor read again when exporting.
+To reuse a raster, just call skrInitRaster() on it again.
+The planar functions draw and export just like their packed
+counterparts, with the dimensions taken from the raster. For assemblies,
+the raster has to have the dimensions of the bounds.
+
+16-bit cells saturate at 128 pixels worth of winding, i.e. where more
+than 127 layers of ink overlap, which no single glyph of any size comes
+close to, but which heaps of glyphs drawn on top of each other into one
+raster can reach. SKR_CELLS_32 takes twice the memory and is a bit
+slower to export, but has room for millions of layers.
+*/
+unsigned long skrCalcRasterSize(SKR_Dimensions dims, SKR_CellFormat format);
+void skrInitRaster(SKR_Raster * restrict raster, void * restrict memory,
+	SKR_Dimensions dims, SKR_CellFormat format);
+SKR_Status skrDrawOutlinePlanar(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, SKR_Raster const * restrict raster);
+SKR_Status skrDrawAssemblyPlanar(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Raster const * restrict raster, SKR_Bounds bounds);
+void skrExportPlanar(SKR_Raster const * restrict raster, unsigned char * restrict image);
+
+/*
+Instead of an image, skrExportSpans() puts out the coverage of a planar
+raster as spans: runs of pixels in a row that share the same alpha,
+which is the value the image from skrExportPlanar() would have there.
+They are ordered by row and then by x, and parts of rows without
+any coverage at all get no spans. It fails if the spans don't fit into
+capacity, in which case *count is the number of spans it would have
+taken; that is never more than one per pixel. The raster can still be
+exported again afterwards, but not by more than one thread at a time,
+as the running sums are kept in the raster's memory.
+*/
+SKR_Status skrExportSpans(SKR_Raster const * restrict raster,
+	SKR_Span * restrict spans, unsigned long capacity, unsigned long * restrict count);
+
 #endif
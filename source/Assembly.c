@@ -1,51 +1,374 @@
 #include "Internals.h"
 
-static int GetCharCodeFromUTF8(char const * restrict * restrict ptr)
-{
-	int bytes = 0;
-	for (int c = **ptr; c & 0x80; c <<= 1) ++bytes;
-	if (bytes == 1 || bytes > 4) return '?';
-	int code = *(*ptr)++ & (0x7F >> bytes);
-	for (int i = 1; i < bytes; ++i, ++*ptr) {
-		if ((**ptr & 0xC0) != 0x80) return '?';
-		code = (code << 6) | (**ptr & 0x3F);
+#include <immintrin.h> // TODO MSVC
+#include <limits.h>
+
+/* How many characters get decoded before they are mapped to glyphs. */
+#define DECODE_BLOCK 64
+
+/*
+Strict decoding as per RFC 3629: no overlong forms, no surrogates,
+nothing above U+10FFFF. Returns the length of the sequence,
+0 if it is malformed, or -1 if it is cut off by the end of the input.
+*/
+int DecodeSequenceUTF8(BYTES1 * restrict bytes,
+	unsigned long available, int32_t * restrict code)
+{
+	int lead = bytes[0];
+	int length;
+	int32_t value;
+	uint8_t lower = 0x80, upper = 0xBF;
+	if (lead < 0x80) {
+		*code = lead;
+		return 1;
+	} else if (lead < 0xC2) {
+		return 0;
+	} else if (lead < 0xE0) {
+		length = 2, value = lead & 0x1F;
+	} else if (lead < 0xF0) {
+		length = 3, value = lead & 0x0F;
+		if (lead == 0xE0) lower = 0xA0;
+		if (lead == 0xED) upper = 0x9F;
+	} else if (lead < 0xF5) {
+		length = 4, value = lead & 0x07;
+		if (lead == 0xF0) lower = 0x90;
+		if (lead == 0xF4) upper = 0x8F;
+	} else {
+		return 0;
+	}
+
+	for (int i = 1; i < length; ++i) {
+		if ((unsigned long) i >= available) return -1;
+		int next = bytes[i];
+		if (i == 1 ? (next < lower || next > upper) : (next & 0xC0) != 0x80) return 0;
+		value = value << 6 | (next & 0x3F);
+	}
+	*code = value;
+	return length;
+}
+
+/*
+Runs of plain ASCII are by far the most common case,
+so they get widened to code points a whole vector at a time.
+*/
+static unsigned long DecodeASCII(BYTES1 * restrict bytes,
+	unsigned long available, int32_t * restrict codes, unsigned long capacity)
+{
+	unsigned long n = 0;
+#ifdef __AVX2__
+	while (n + 32 <= capacity && n + 32 <= available) {
+		__m256i chunk = _mm256_loadu_si256((__m256i const *) (bytes + n));
+		if (_mm256_movemask_epi8(chunk)) break;
+		for (int i = 0; i < 4; ++i) {
+			__m128i eight = _mm_loadl_epi64((__m128i const *) (bytes + n + 8 * i));
+			_mm256_storeu_si256((__m256i *) (codes + n + 8 * i), _mm256_cvtepu8_epi32(eight));
+		}
+		n += 32;
+	}
+#endif
+	__m128i const zero = _mm_setzero_si128();
+	while (n + 16 <= capacity && n + 16 <= available) {
+		__m128i chunk = _mm_loadu_si128((__m128i const *) (bytes + n));
+		if (_mm_movemask_epi8(chunk)) break;
+		__m128i lower = _mm_unpacklo_epi8(chunk, zero);
+		__m128i upper = _mm_unpackhi_epi8(chunk, zero);
+		__m128i * restrict out = (__m128i *) (codes + n);
+		_mm_storeu_si128(out + 0, _mm_unpacklo_epi16(lower, zero));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lower, zero));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(upper, zero));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(upper, zero));
+		n += 16;
+	}
+	return n;
+}
+
+static SKR_Status DecodeBlockUTF8(BYTES1 * restrict text, unsigned long length,
+	unsigned long * restrict position, int32_t * restrict codes,
+	unsigned long capacity, unsigned long * restrict count)
+{
+	unsigned long pos = *position, n = 0;
+	SKR_Status s = SKR_SUCCESS;
+	while (n < capacity && pos < length) {
+		unsigned long run = DecodeASCII(text + pos, length - pos, codes + n, capacity - n);
+		n += run, pos += run;
+		if (!(n < capacity && pos < length)) break;
+		int sequence = DecodeSequenceUTF8(text + pos, length - pos, &codes[n]);
+		if (sequence == 0) s = SKR_FAILURE;
+		if (sequence <= 0) break;
+		++n, pos += sequence;
 	}
-	return code;
+	*position = pos;
+	*count = n;
+	return s;
+}
+
+static SKR_Status AdvancesFromGlyphs(SKR_Font const * restrict font,
+	Glyph const * restrict glyphs, float * restrict advances, unsigned long count)
+{
+	if (font->cachedMetrics != 0) {
+		for (unsigned long i = 0; i < count; ++i) {
+			if (!(glyphs[i] < font->numGlyphs)) return SKR_FAILURE;
+			advances[i] = font->cachedMetrics[glyphs[i]].advanceWidth;
+		}
+		return SKR_SUCCESS;
+	}
+	for (unsigned long i = 0; i < count; ++i) {
+		SKR_HorMetrics metrics;
+		SKR_Status s = skrGetHorMetrics(font, glyphs[i], &metrics);
+		if (s) return s;
+		advances[i] = metrics.advanceWidth;
+	}
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrGlyphsFromUTF8(SKR_Font const * restrict font,
+	char const * restrict text, unsigned long length,
+	Glyph * restrict glyphs, float * restrict advances, unsigned long capacity,
+	unsigned long * restrict count, unsigned long * restrict consumed)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	int32_t codes[DECODE_BLOCK];
+	unsigned long pos = 0, n = 0;
+	SKR_Status s = SKR_SUCCESS;
+	while (n < capacity && pos < length) {
+		unsigned long wanted = min(DECODE_BLOCK, capacity - n);
+		unsigned long got, blockStart = pos;
+		s = DecodeBlockUTF8(bytes, length, &pos, codes, wanted, &got);
+
+		GlyphsFromCodes(font, codes, glyphs + n, got);
+		SKR_Status ms = AdvancesFromGlyphs(font, glyphs + n, advances + n, got);
+		if (ms) {
+			*count = n, *consumed = blockStart;
+			return ms;
+		}
+		n += got;
+
+		if (s || got < wanted) break;
+	}
+	*count = n;
+	*consumed = pos;
+	return s;
+}
+
+void skrBeginAssembly(SKR_AssemblyState * restrict state)
+{
+	state->position = 0;
+	state->x = 0.0f;
+	state->prevGlyph = -1;
+	state->prevFont = 0;
+}
+
+SKR_Status skrAssembleUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_AssemblyState * restrict state,
+	SKR_Assembly * restrict assembly, int capacity, int * restrict count)
+{
+	Glyph glyphs[DECODE_BLOCK];
+	float advances[DECODE_BLOCK];
+	float kernings[DECODE_BLOCK];
+	SKR_Status s = SKR_SUCCESS;
+	*count = 0;
+	while (*count < capacity && state->position < length) {
+		unsigned long wanted = min(DECODE_BLOCK, (unsigned long) (capacity - *count));
+		unsigned long got, consumed;
+		s = skrGlyphsFromUTF8(font, text + state->position, length - state->position,
+			glyphs, advances, wanted, &got, &consumed);
+
+		/* kerning first, so that a failure leaves the state at the start of the block */
+		Glyph prevGlyph = state->prevGlyph;
+		for (unsigned long i = 0; i < got; ++i) {
+			kernings[i] = 0.0f;
+			if (prevGlyph >= 0) {
+				SKR_Status ks = skrGetKerning(font, prevGlyph, glyphs[i], &kernings[i]);
+				if (ks) return ks;
+			}
+			prevGlyph = glyphs[i];
+		}
+
+		for (unsigned long i = 0; i < got; ++i) {
+			state->x += kernings[i] * size;
+			assembly[(*count)++] = (SKR_Assembly) { glyphs[i], size, state->x, 0.0f, 0 };
+			state->x += advances[i] * size;
+			state->prevGlyph = glyphs[i];
+		}
+		state->position += consumed;
+
+		if (s || got < wanted) break;
+	}
+	return s;
 }
 
 SKR_Status skrAssembleStringUTF8(SKR_Font * restrict font,
 	char const * restrict line, float size,
 	SKR_Assembly * restrict assembly, int * restrict count)
 {
-	// TODO watch for buffer overflows
+	// TODO deprecate in favor of skrAssembleUTF8(), this can't watch for buffer overflows
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	unsigned long length = LengthOfString(line);
+	SKR_Status s = skrAssembleUTF8(font, line, length, size,
+		&state, assembly, INT_MAX, count);
+	if (s) return s;
+	/* the string ends in the middle of a sequence */
+	if (state.position < length) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+/*
+Same as skrAssembleUTF8(), except every character brings its own font.
+A block whose metrics or kerning can't be looked up is left out as a
+whole, with the state at its start.
+*/
+SKR_Status skrAssembleChainUTF8(SKR_FontChain const * restrict chain,
+	char const * restrict text, unsigned long length, float size,
+	SKR_AssemblyState * restrict state,
+	SKR_Assembly * restrict assembly, int capacity, int * restrict count)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	int32_t codes[DECODE_BLOCK];
+	int fonts[DECODE_BLOCK];
+	Glyph glyphs[DECODE_BLOCK];
+	float advances[DECODE_BLOCK];
+	float kernings[DECODE_BLOCK];
+	SKR_Status s = SKR_SUCCESS;
 	*count = 0;
-	float x = 0.0f;
-	while (*line != '\0') {
-		int charCode = GetCharCodeFromUTF8(&line);
-		Glyph glyph = skrGlyphFromCode(font, charCode);
-		SKR_HorMetrics metrics;
-		SKR_Status s = skrGetHorMetrics(font, glyph, &metrics);
-		if (s) return s;
-		assembly[(*count)++] = (SKR_Assembly) { glyph, size, x, 0.0f };
-		x += metrics.advanceWidth * size;
+	while (*count < capacity && state->position < length) {
+		unsigned long wanted = min(DECODE_BLOCK, (unsigned long) (capacity - *count));
+		unsigned long got, pos = state->position;
+		s = DecodeBlockUTF8(bytes, length, &pos, codes, wanted, &got);
+
+		ResolveCodes(chain, codes, fonts, glyphs, got);
+		for (unsigned long i = 0; i < got; ++i) {
+			SKR_HorMetrics metrics;
+			SKR_Status ms = skrGetHorMetrics(chain->fonts[fonts[i]], glyphs[i], &metrics);
+			if (ms) return ms;
+			advances[i] = metrics.advanceWidth;
+		}
+
+		Glyph prevGlyph = state->prevGlyph;
+		int prevFont = state->prevFont;
+		for (unsigned long i = 0; i < got; ++i) {
+			kernings[i] = 0.0f;
+			if (prevGlyph >= 0 && prevFont == fonts[i]) {
+				SKR_Status ks = skrGetKerning(chain->fonts[fonts[i]],
+					prevGlyph, glyphs[i], &kernings[i]);
+				if (ks) return ks;
+			}
+			prevGlyph = glyphs[i];
+			prevFont = fonts[i];
+		}
+
+		for (unsigned long i = 0; i < got; ++i) {
+			state->x += kernings[i] * size;
+			assembly[(*count)++] = (SKR_Assembly) { glyphs[i], size, state->x, 0.0f, fonts[i] };
+			state->x += advances[i] * size;
+			state->prevGlyph = glyphs[i];
+			state->prevFont = fonts[i];
+		}
+		state->position = pos;
+
+		if (s || got < wanted) break;
 	}
+	return s;
+}
+
+SKR_Status skrAssembleChainStringUTF8(SKR_FontChain const * restrict chain,
+	char const * restrict line, float size,
+	SKR_Assembly * restrict assembly, int * restrict count)
+{
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	unsigned long length = LengthOfString(line);
+	SKR_Status s = skrAssembleChainUTF8(chain, line, length, size,
+		&state, assembly, INT_MAX, count);
+	if (s) return s;
+	if (state.position < length) return SKR_FAILURE;
 	return SKR_SUCCESS;
 }
 
+/*
+Each glyph gets scaled and moved into place first, then the affine
+transformation of the whole assembly is applied on top.
+*/
+static SKR_Affine GlyphAffine(SKR_Assembly amb, SKR_Affine affine)
+{
+	return (SKR_Affine) {
+		affine.xx * amb.size, affine.xy * amb.size,
+		affine.yx * amb.size, affine.yy * amb.size,
+		affine.xx * amb.x + affine.xy * amb.y + affine.dx,
+		affine.yx * amb.x + affine.yy * amb.y + affine.dy };
+}
+
+static SKR_Affine const IdentityAffine = { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+
+/*
+Glyphs of a chain assembly each name their font; all others have
+only the one, and any other font index in them is an error.
+*/
+static SKR_Font * FontOfGlyph(SKR_Font * const * restrict fonts, int numFonts,
+	SKR_Assembly amb)
+{
+	return amb.font >= 0 && amb.font < numFonts ? fonts[amb.font] : 0;
+}
+
 SKR_Status skrGetAssemblyBounds(SKR_Font * restrict font,
 	SKR_Assembly * restrict assembly, int count, SKR_Bounds * restrict bounds)
+{
+	return skrGetAssemblyBoundsAffine(font, assembly, count, IdentityAffine, bounds);
+}
+
+/*
+Embedded bitmaps can only be used as they are, so only assemblies that
+are merely moved around get them. The pen is rounded to whole pixels.
+*/
+static int IsTranslation(SKR_Affine affine)
+{
+	return affine.xx == 1.0f && affine.xy == 0.0f &&
+		affine.yx == 0.0f && affine.yy == 1.0f;
+}
+
+static SKR_Status FindBitmap(SKR_Font * restrict font, SKR_Assembly amb,
+	SKR_Affine affine, StrikeGlyph * restrict sg, long * restrict x, long * restrict y)
+{
+	SKR_Strike strike;
+	if (!IsTranslation(affine)) return SKR_FAILURE;
+	if (skrFindStrike(font, amb.size, &strike)) return SKR_FAILURE;
+	if (FindStrikeGlyph(font, &strike, amb.glyph, sg)) return SKR_FAILURE;
+	*x = roundf(amb.x + affine.dx);
+	*y = roundf(amb.y + affine.dy);
+	return SKR_SUCCESS;
+}
+
+static SKR_Status GetGlyphBounds(SKR_Font * restrict font, SKR_Assembly amb,
+	SKR_Affine affine, SKR_Bounds * restrict bounds)
+{
+	StrikeGlyph sg;
+	long x, y;
+	if (FindBitmap(font, amb, affine, &sg, &x, &y) == SKR_SUCCESS) {
+		bounds->xMin = x + sg.metrics.xMin;
+		bounds->yMin = y + sg.metrics.yMin;
+		bounds->xMax = bounds->xMin + sg.metrics.width;
+		bounds->yMax = bounds->yMin + sg.metrics.height;
+		return SKR_SUCCESS;
+	}
+	return skrGetOutlineBoundsAffine(font, amb.glyph, GlyphAffine(amb, affine), bounds);
+}
+
+static SKR_Status GetAssemblyBounds(SKR_Font * const * restrict fonts, int numFonts,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Bounds * restrict bounds)
 {
 	if (count <= 0) return SKR_FAILURE;
-	SKR_Bounds total, next;
-	SKR_Transform transform = {
-		assembly[0].size, assembly[0].size, assembly[0].x, assembly[0].y };
-	SKR_Status s = skrGetOutlineBounds(font, assembly[0].glyph, transform, &total);
-	if (s) return s;
-	for (int i = 1; i < count; ++i) {
-		SKR_Transform transform = {
-			assembly[i].size, assembly[i].size, assembly[i].x, assembly[i].y };
-		s = skrGetOutlineBounds(font, assembly[i].glyph, transform, &next);
+	SKR_Bounds total = { 0, 0, 0, 0 }, next;
+	for (int i = 0; i < count; ++i) {
+		SKR_Font * font = FontOfGlyph(fonts, numFonts, assembly[i]);
+		if (font == 0) return SKR_FAILURE;
+		SKR_Status s = GetGlyphBounds(font, assembly[i], affine, &next);
 		if (s) return s;
+		if (i == 0) {
+			total = next;
+			continue;
+		}
 		total.xMin = min(total.xMin, next.xMin);
 		total.yMin = min(total.yMin, next.yMin);
 		total.xMax = max(total.xMax, next.xMax);
@@ -55,18 +378,77 @@ SKR_Status skrGetAssemblyBounds(SKR_Font * restrict font,
 	return SKR_SUCCESS;
 }
 
+SKR_Status skrGetAssemblyBoundsAffine(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Bounds * restrict bounds)
+{
+	SKR_Font * fonts[1] = { font };
+	return GetAssemblyBounds(fonts, 1, assembly, count, affine, bounds);
+}
+
+SKR_Status skrGetChainAssemblyBoundsAffine(SKR_FontChain const * restrict chain,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Bounds * restrict bounds)
+{
+	return GetAssemblyBounds(chain->fonts, chain->numFonts, assembly, count, affine, bounds);
+}
+
 SKR_Status skrDrawAssembly(SKR_Font * restrict font,
 	SKR_Assembly * restrict assembly, int count,
 	RasterCell * restrict raster, SKR_Bounds bounds)
 {
-	SKR_Dimensions dims = { bounds.xMax - bounds.xMin, bounds.yMax - bounds.yMin };
+	return skrDrawAssemblyAffine(font, assembly, count, IdentityAffine, raster, bounds);
+}
+
+static SKR_Status DrawAssemblyInWorkspace(SKR_Font * const * restrict fonts, int numFonts,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	Workspace * restrict ws, SKR_Bounds bounds)
+{
+	affine.dx -= bounds.xMin;
+	affine.dy -= bounds.yMin;
 	for (int i = 0; i < count; ++i) {
-		SKR_Assembly amb = assembly[i];
-		SKR_Transform transform = { amb.size, amb.size,
-			amb.x - bounds.xMin, amb.y - bounds.yMin };
-		SKR_Status s = skrDrawOutline(font, amb.glyph, transform, raster, dims);
+		SKR_Font * font = FontOfGlyph(fonts, numFonts, assembly[i]);
+		if (font == 0) return SKR_FAILURE;
+		StrikeGlyph sg;
+		long x, y;
+		if (FindBitmap(font, assembly[i], affine, &sg, &x, &y) == SKR_SUCCESS) {
+			DrawStrikeGlyph(&sg, x, y, ws);
+			continue;
+		}
+		SKR_Status s = DrawOutlineInWorkspace(font, assembly[i].glyph,
+			GlyphAffine(assembly[i], affine), ws);
 		if (s) return s;
 	}
 	return SKR_SUCCESS;
 }
 
+SKR_Status skrDrawAssemblyAffine(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	RasterCell * restrict raster, SKR_Bounds bounds)
+{
+	SKR_Dimensions dims = { bounds.xMax - bounds.xMin, bounds.yMax - bounds.yMin };
+	Workspace ws = PackedWorkspace(raster, dims);
+	SKR_Font * fonts[1] = { font };
+	return DrawAssemblyInWorkspace(fonts, 1, assembly, count, affine, &ws, bounds);
+}
+
+SKR_Status skrDrawChainAssemblyAffine(SKR_FontChain const * restrict chain,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	RasterCell * restrict raster, SKR_Bounds bounds)
+{
+	SKR_Dimensions dims = { bounds.xMax - bounds.xMin, bounds.yMax - bounds.yMin };
+	Workspace ws = PackedWorkspace(raster, dims);
+	return DrawAssemblyInWorkspace(chain->fonts, chain->numFonts,
+		assembly, count, affine, &ws, bounds);
+}
+
+SKR_Status skrDrawAssemblyPlanar(SKR_Font * restrict font,
+	SKR_Assembly const * restrict assembly, int count, SKR_Affine affine,
+	SKR_Raster const * restrict raster, SKR_Bounds bounds)
+{
+	if (raster->dims.width != (uint32_t) (bounds.xMax - bounds.xMin) ||
+		raster->dims.height != (uint32_t) (bounds.yMax - bounds.yMin)) return SKR_FAILURE;
+	Workspace ws = PlanarWorkspace(raster);
+	SKR_Font * fonts[1] = { font };
+	return DrawAssemblyInWorkspace(fonts, 1, assembly, count, affine, &ws, bounds);
+}
@@ -0,0 +1,358 @@
+#include "Internals.h"
+
+#include <immintrin.h> // TODO MSVC
+
+/*
+======== glyph cache ========
+
+Each glyph is rasterized once per size and horizontal subpixel phase,
+and stored as 8-bit coverage right after its GlyphRecord. The coverage
+rows are padded to a multiple of 8 pixels, just like a raster.
+*/
+
+#define SUBPIXEL_PHASES 4
+
+typedef struct {
+	SKR_Font const * font;
+	Glyph glyph;
+	float size;
+	int phase;
+} GlyphKey;
+
+typedef struct {
+	RingRecord ring;
+	GlyphKey key;
+	/* where the coverage sits relative to the pen position */
+	long xMin, yMin;
+	uint32_t width, height, stride;
+	/* embedded bitmaps sit at the rounded pen position, not the phase */
+	int snapped;
+} GlyphRecord;
+
+void skrInitGlyphCache(SKR_GlyphCache * restrict cache,
+	void * restrict memory, unsigned long size)
+{
+	InitRing(&cache->ring, memory, size);
+}
+
+static GlyphRecord const * FindGlyph(SKR_CacheRing const * restrict ring,
+	GlyphKey const * restrict key, uint32_t hash)
+{
+	GlyphRecord const * restrict record;
+	unsigned long probe = hash;
+	while ((record = NextRecord(ring, hash, &probe)) != 0) {
+		if (record->key.font == key->font && record->key.glyph == key->glyph &&
+			record->key.size == key->size && record->key.phase == key->phase) {
+			return record;
+		}
+	}
+	return 0;
+}
+
+/*
+Glyphs from an embedded bitmap strike need no rasterizing, they are
+just expanded to 8 bits per pixel. Since they cannot be shifted,
+the subpixel phase is ignored when they get blitted.
+*/
+static SKR_Status CopyStrikeGlyph(SKR_CacheRing * restrict ring,
+	GlyphKey const * restrict key, uint32_t hash, StrikeGlyph const * restrict sg,
+	GlyphRecord const ** restrict rendered)
+{
+	SKR_Status s;
+	SKR_Dimensions dims = { sg->metrics.width, sg->metrics.height };
+	unsigned long stride = CalcRasterWidth(dims);
+	unsigned long coverageSize = (stride * dims.height + 15) & ~15ul;
+
+	RingRecord * reserved;
+	s = ReserveRecord(ring, sizeof(GlyphRecord) + coverageSize, &reserved);
+	if (s) return s;
+	GlyphRecord * restrict record = (GlyphRecord *) reserved;
+
+	/* bitmaps are stored top down, coverage goes bottom up */
+	uint8_t * restrict coverage = (uint8_t *) (record + 1);
+	for (uint32_t row = 0; row < dims.height; ++row) {
+		ReadStrikeRow(sg, row, coverage + (dims.height - 1 - row) * stride);
+	}
+
+	record->key = *key;
+	record->xMin = sg->metrics.xMin;
+	record->yMin = sg->metrics.yMin;
+	record->width = dims.width;
+	record->height = dims.height;
+	record->stride = stride;
+	record->snapped = 1;
+	CommitRecord(ring, &record->ring, sizeof(GlyphRecord) + coverageSize, hash);
+	*rendered = record;
+	return SKR_SUCCESS;
+}
+
+/*
+The raster only exists while the glyph is being rendered, so it goes
+into the reserved space behind the coverage and is given back afterwards.
+*/
+static SKR_Status RenderGlyph(SKR_CacheRing * restrict ring,
+	GlyphKey const * restrict key, uint32_t hash, GlyphRecord const ** restrict rendered)
+{
+	SKR_Status s;
+	SKR_Strikes strikes;
+	SKR_Strike strike;
+	StrikeGlyph sg;
+	GetStrikes(key->font, &strikes);
+	if (FindStrike(key->font, &strikes, key->size, &strike) == SKR_SUCCESS &&
+		FindStrikeGlyph(key->font, &strike, key->glyph, &sg) == SKR_SUCCESS) {
+		return CopyStrikeGlyph(ring, key, hash, &sg, rendered);
+	}
+
+	SKR_Transform transform = { key->size, key->size,
+		(float) key->phase / SUBPIXEL_PHASES, 0.0f };
+	SKR_Bounds bounds;
+	s = skrGetOutlineBounds(key->font, key->glyph, transform, &bounds);
+	if (s) return s;
+	SKR_Dimensions dims = { bounds.xMax - bounds.xMin, bounds.yMax - bounds.yMin };
+	unsigned long stride = CalcRasterWidth(dims);
+	unsigned long coverageSize = (stride * dims.height + 15) & ~15ul;
+	unsigned long cellCount = skrCalcCellCount(dims);
+
+	RingRecord * reserved;
+	s = ReserveRecord(ring, sizeof(GlyphRecord) + coverageSize +
+		15 + cellCount * sizeof(RasterCell), &reserved);
+	if (s) return s;
+	GlyphRecord * restrict record = (GlyphRecord *) reserved;
+
+	uint8_t * restrict coverage = (uint8_t *) (record + 1);
+	uintptr_t rasterAddress = ((uintptr_t) (coverage + coverageSize) + 15) & ~(uintptr_t) 15;
+	RasterCell * restrict raster = (RasterCell *) rasterAddress;
+	for (unsigned long i = 0; i < cellCount; ++i) {
+		raster[i] = 0;
+	}
+	transform.xMove -= bounds.xMin;
+	transform.yMove -= bounds.yMin;
+	s = skrDrawOutline(key->font, key->glyph, transform, raster, dims);
+	if (s) return s;
+	ExportCoverage(raster, coverage, dims);
+
+	record->key = *key;
+	record->xMin = bounds.xMin;
+	record->yMin = bounds.yMin;
+	record->width = dims.width;
+	record->height = dims.height;
+	record->stride = stride;
+	record->snapped = 0;
+	CommitRecord(ring, &record->ring, sizeof(GlyphRecord) + coverageSize, hash);
+	*rendered = record;
+	return SKR_SUCCESS;
+}
+
+/*
+======== blitting ========
+*/
+
+/*
+Adds coverage onto pixels in the format skrExportImage() writes,
+saturating, so overlapping glyphs add up just like they do in a raster.
+*/
+static void BlitGlyph(GlyphRecord const * restrict record,
+	uint32_t * restrict image, SKR_Dimensions dims, long col, long row)
+{
+	__m128i const lowerMask = _mm_set_epi8(
+		-1, 3, 3, 3, -1, 2, 2, 2, -1, 1, 1, 1, -1, 0, 0, 0);
+	__m128i const upperMask = _mm_set_epi8(
+		-1, 7, 7, 7, -1, 6, 6, 6, -1, 5, 5, 5, -1, 4, 4, 4);
+
+	uint8_t const * restrict coverage = (uint8_t const *) (record + 1);
+	long x0 = max(0, -col), x1 = min((long) record->width, (long) dims.width - col);
+	long y0 = max(0, -row), y1 = min((long) record->height, (long) dims.height - row);
+
+	for (long y = y0; y < y1; ++y) {
+		uint8_t const * restrict source = coverage + y * record->stride;
+		uint32_t * restrict target = image + (row + y) * dims.width + col;
+		long x = x0;
+		for (; x + 8 <= x1; x += 8) {
+			__m128i value = _mm_loadl_epi64((__m128i const *) (source + x));
+			__m128i * restrict pixels = (__m128i *) (target + x);
+			__m128i lower = _mm_adds_epu8(_mm_loadu_si128(pixels + 0),
+				_mm_shuffle_epi8(value, lowerMask));
+			__m128i upper = _mm_adds_epu8(_mm_loadu_si128(pixels + 1),
+				_mm_shuffle_epi8(value, upperMask));
+			_mm_storeu_si128(pixels + 0, lower);
+			_mm_storeu_si128(pixels + 1, upper);
+		}
+		for (; x < x1; ++x) {
+			__m128i value = _mm_cvtsi32_si128(source[x] * 0x010101);
+			__m128i pixel = _mm_cvtsi32_si128(target[x]);
+			target[x] = _mm_cvtsi128_si32(_mm_adds_epu8(pixel, value));
+		}
+	}
+}
+
+/* Field by field, since the padding of a key holds anything at all. */
+static uint32_t HashGlyphKey(GlyphKey const * restrict key)
+{
+	uint32_t hash = HashBytes(2166136261u, &key->font, sizeof(key->font));
+	hash = HashBytes(hash, &key->glyph, sizeof(key->glyph));
+	hash = HashBytes(hash, &key->size, sizeof(key->size));
+	return HashBytes(hash, &key->phase, sizeof(key->phase));
+}
+
+/*
+Splits the pen position into the whole pixel and the subpixel phase
+the glyph gets rendered at.
+*/
+static void PlaceGlyph(SKR_Font const * restrict font, SKR_Assembly amb,
+	GlyphKey * restrict key, uint32_t * restrict hash, long * restrict x, long * restrict y)
+{
+	float whole = floorf(amb.x);
+	*x = whole;
+	int phase = roundf((amb.x - whole) * SUBPIXEL_PHASES);
+	if (phase == SUBPIXEL_PHASES) ++*x, phase = 0;
+	*y = roundf(amb.y);
+	*key = (GlyphKey) { font, amb.glyph, amb.size, phase };
+	*hash = HashGlyphKey(key);
+}
+
+static SKR_Status LookupGlyph(SKR_CacheRing * restrict ring,
+	GlyphKey const * restrict key, uint32_t hash, GlyphRecord const ** restrict record)
+{
+	*record = FindGlyph(ring, key, hash);
+	if (*record != 0) {
+		++ring->hits;
+		return SKR_SUCCESS;
+	}
+	++ring->misses;
+	return RenderGlyph(ring, key, hash, record);
+}
+
+static void BlitPlacedGlyph(GlyphRecord const * restrict record, SKR_Assembly amb,
+	long x, long y, unsigned char * restrict image, SKR_Bounds bounds)
+{
+	SKR_Dimensions dims = { bounds.xMax - bounds.xMin, bounds.yMax - bounds.yMin };
+	long pen = record->snapped ? (long) roundf(amb.x) : x;
+	BlitGlyph(record, (uint32_t *) image, dims,
+		pen + record->xMin - bounds.xMin, y + record->yMin - bounds.yMin);
+}
+
+SKR_Status skrDrawAssemblyCached(SKR_GlyphCache * restrict cache,
+	SKR_Font const * restrict font, SKR_Assembly const * restrict assembly, int count,
+	unsigned char * restrict image, SKR_Bounds bounds)
+{
+	for (int i = 0; i < count; ++i) {
+		GlyphKey key;
+		uint32_t hash;
+		long x, y;
+		if (assembly[i].font != 0) return SKR_FAILURE;
+		PlaceGlyph(font, assembly[i], &key, &hash, &x, &y);
+		GlyphRecord const * record;
+		SKR_Status s = LookupGlyph(&cache->ring, &key, hash, &record);
+		if (s) return s;
+		BlitPlacedGlyph(record, assembly[i], x, y, image, bounds);
+	}
+	return SKR_SUCCESS;
+}
+
+/*
+======== sharing between threads ========
+
+The shared glyph cache is split into shards, each a glyph cache of its
+own behind a spinlock. Glyphs get rendered while their shard is locked,
+so every glyph is only ever rendered once, and then copied into the
+private cache of the render context that asked for it. From there on,
+blitting it needs no locks at all.
+*/
+
+void skrInitSharedGlyphCache(SKR_SharedGlyphCache * restrict cache,
+	void * restrict memory, unsigned long size)
+{
+	unsigned long shardSize = size / SKR_CACHE_SHARDS & ~7ul;
+	for (int i = 0; i < SKR_CACHE_SHARDS; ++i) {
+		skrInitGlyphCache(&cache->shards[i], (unsigned char *) memory + i * shardSize, shardSize);
+		cache->locks[i] = 0;
+	}
+}
+
+void skrInitRenderContext(SKR_RenderContext * restrict context,
+	SKR_SharedGlyphCache * restrict shared, void * restrict memory, unsigned long size)
+{
+	context->shared = shared;
+	skrInitGlyphCache(&context->local, memory, size);
+}
+
+static SKR_Status CopyRecord(SKR_CacheRing * restrict ring,
+	GlyphRecord const * restrict source, uint32_t hash, GlyphRecord const ** restrict copied)
+{
+	/* records are always a multiple of 8 bytes long */
+	unsigned long size = source->ring.size;
+	RingRecord * reserved;
+	SKR_Status s = ReserveRecord(ring, size, &reserved);
+	if (s) return s;
+	uint64_t const * restrict from = (uint64_t const *) source;
+	uint64_t * restrict to = (uint64_t *) reserved;
+	for (unsigned long i = 0; i < size / 8; ++i) {
+		to[i] = from[i];
+	}
+	CommitRecord(ring, reserved, size, hash);
+	*copied = (GlyphRecord const *) reserved;
+	return SKR_SUCCESS;
+}
+
+/*
+The low bits of the hash pick the slot within a shard,
+so the shard is picked by the high bits.
+*/
+static SKR_Status LookupSharedGlyph(SKR_SharedGlyphCache * restrict shared,
+	SKR_CacheRing * restrict local, GlyphKey const * restrict key, uint32_t hash,
+	GlyphRecord const ** restrict record)
+{
+	int shard = (hash >> 24) % SKR_CACHE_SHARDS;
+	AcquireLock(&shared->locks[shard]);
+	GlyphRecord const * found;
+	SKR_Status s = LookupGlyph(&shared->shards[shard].ring, key, hash, &found);
+	if (!s) s = CopyRecord(local, found, hash, record);
+	ReleaseLock(&shared->locks[shard]);
+	return s;
+}
+
+/*
+Renders the glyph at every subpixel phase into its shard,
+unless it is there already.
+*/
+SKR_Status WarmGlyph(SKR_SharedGlyphCache * restrict shared,
+	SKR_Font const * restrict font, Glyph glyph, float size)
+{
+	for (int phase = 0; phase < SUBPIXEL_PHASES; ++phase) {
+		GlyphKey key = { font, glyph, size, phase };
+		uint32_t hash = HashGlyphKey(&key);
+		int shard = (hash >> 24) % SKR_CACHE_SHARDS;
+		AcquireLock(&shared->locks[shard]);
+		GlyphRecord const * record;
+		SKR_Status s = LookupGlyph(&shared->shards[shard].ring, &key, hash, &record);
+		ReleaseLock(&shared->locks[shard]);
+		if (s) return s;
+	}
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrDrawAssemblyInContext(SKR_RenderContext * restrict context,
+	SKR_Font const * restrict font, SKR_Assembly const * restrict assembly, int count,
+	unsigned char * restrict image, SKR_Bounds bounds)
+{
+	SKR_CacheRing * restrict local = &context->local.ring;
+	for (int i = 0; i < count; ++i) {
+		GlyphKey key;
+		uint32_t hash;
+		long x, y;
+		if (assembly[i].font != 0) return SKR_FAILURE;
+		PlaceGlyph(font, assembly[i], &key, &hash, &x, &y);
+		GlyphRecord const * record = FindGlyph(local, &key, hash);
+		if (record != 0) {
+			++local->hits;
+		} else {
+			++local->misses;
+			SKR_Status s = context->shared != 0 ?
+				LookupSharedGlyph(context->shared, local, &key, hash, &record) :
+				RenderGlyph(local, &key, hash, &record);
+			if (s) return s;
+		}
+		BlitPlacedGlyph(record, assembly[i], x, y, image, bounds);
+	}
+	return SKR_SUCCESS;
+}
@@ -0,0 +1,599 @@
+#include "Internals.h"
+
+#include <limits.h>
+
+/*
+======== font cache ========
+
+The cache block is position independent: sections are found through
+offsets from the start of the block, never through pointers.
+That way the same block can be attached to any number of faces,
+and it can be written to disk and mapped back in as is.
+*/
+
+#define FONT_CACHE_MAGIC 0x534B5263 // 'SKRc'
+
+/* Highest code point the direct character map will cover. */
+#define MAX_CACHED_CODE 0xFFFF
+
+typedef struct {
+	unsigned long source[2];
+	unsigned long count;
+	unsigned long offset;
+} CacheSection;
+
+/*
+Besides the version, the header records the sizes of the types that get
+stored verbatim, so that a cache from an incompatible build is rejected
+instead of misread. The magic number doubles as a byte order mark.
+*/
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t fontSize;
+	uint32_t longSize;
+	uint32_t checksum;
+	uint32_t numGlyphs;
+	unsigned long size;
+	CacheSection glyphs, metrics, boxes, outlines, kerning;
+	SKR_Font font;
+} FontCacheHeader;
+
+/*
+The keys below identify the tables a section was decoded from.
+Since faces of a collection share the underlying data, equal offsets
+imply equal table contents.
+*/
+
+static void GetGlyphsSource(SKR_Font const * restrict font, unsigned long source[2])
+{
+	source[0] = font->cmap.offset;
+	source[1] = font->mappingFormat == 4 ?
+		font->mapping.format4.endCodes : font->mapping.format6.glyphIndexArray;
+}
+
+static void GetMetricsSource(SKR_Font const * restrict font, unsigned long source[2])
+{
+	source[0] = font->hmtx.offset;
+	source[1] = (unsigned long) font->numberOfHMetrics << 16 | (uint16_t) font->unitsPerEm;
+}
+
+static void GetBoxesSource(SKR_Font const * restrict font, unsigned long source[2])
+{
+	if (font->cff.version != 0) {
+		source[0] = font->cff.table.offset;
+		source[1] = font->cff.charStrings;
+		return;
+	}
+	source[0] = font->glyf.offset;
+	source[1] = font->loca.offset;
+}
+
+static void GetKerningSource(SKR_Kerning const * restrict kerning,
+	unsigned long source[2])
+{
+	source[0] = kerning->sourceOffset;
+	source[1] = kerning->source;
+}
+
+/*
+The font passed to the cache builder is const, so if the kerning tables
+haven't been looked at yet, locate them on the side.
+*/
+static void GetKerning(SKR_Font const * restrict font, SKR_Kerning * restrict kerning)
+{
+	if (ParsedTables(font) & PARSED_KERNING) {
+		*kerning = font->kerning;
+	} else {
+		LocateKerning(font, kerning);
+	}
+}
+
+static unsigned long CountMappedCodes(SKR_Font const * restrict font)
+{
+	unsigned long count = 0;
+	switch (font->mappingFormat) {
+	case 4: {
+		SKR_cmap_format4 const * restrict mapping = &font->mapping.format4;
+		BYTES2 * startCodes = (BYTES2 *) ((BYTES1 *) font->data + mapping->startCodes);
+		BYTES2 * endCodes = (BYTES2 *) ((BYTES1 *) font->data + mapping->endCodes);
+		for (int i = 0; i < mapping->segCount; ++i) {
+			unsigned long endCode = ru16(endCodes[i]);
+			/* skip the mandatory 0xFFFF terminator segment */
+			if (ru16(startCodes[i]) == 0xFFFF) continue;
+			count = max(count, endCode + 1);
+		}
+		break;
+	}
+	case 6: {
+		SKR_cmap_format6 const * restrict mapping = &font->mapping.format6;
+		count = mapping->firstCode + mapping->entryCount;
+		break;
+	}
+	default:
+		SKR_assert(0);
+	}
+	return min(count, MAX_CACHED_CODE + 1ul);
+}
+
+static int SourcesMatch(unsigned long const a[2], unsigned long const b[2])
+{
+	return a[0] == b[0] && a[1] == b[1];
+}
+
+unsigned long skrCalcFontCacheSize(SKR_Font const * restrict font)
+{
+	unsigned long size = AlignSize(sizeof(FontCacheHeader));
+	size += AlignSize(CountMappedCodes(font) * sizeof(uint16_t));
+	size += AlignSize(font->numGlyphs * sizeof(SKR_HorMetrics));
+	size += AlignSize(font->numGlyphs * 4 * sizeof(int16_t));
+	size += CalcCachedOutlinesSize(font);
+	SKR_Kerning kerning;
+	GetKerning(font, &kerning);
+	size += CalcKerningIndexSize(font, &kerning);
+	return size;
+}
+
+SKR_Status skrBuildFontCache(SKR_Font const * restrict font,
+	void * restrict memory, unsigned long size)
+{
+	SKR_Status s;
+	if (font->instance != 0) return SKR_FAILURE;
+	unsigned long needed = skrCalcFontCacheSize(font);
+	if (size < needed) return SKR_FAILURE;
+
+	FontCacheHeader * restrict header = (FontCacheHeader *) memory;
+	BYTES1 * base = (BYTES1 *) memory;
+	unsigned long cursor = AlignSize(sizeof(FontCacheHeader));
+
+	header->magic = FONT_CACHE_MAGIC;
+	header->version = SKR_FONT_CACHE_VERSION;
+	header->fontSize = sizeof(SKR_Font);
+	header->longSize = sizeof(unsigned long);
+	header->numGlyphs = font->numGlyphs;
+	header->size = needed;
+	s = skrGetFontChecksum(font, &header->checksum);
+	if (s) return s;
+
+	SKR_Kerning kerning;
+	GetKerning(font, &kerning);
+	SKR_Strikes strikes;
+	GetStrikes(font, &strikes);
+
+	/* Pointers are meaningless in another process, so leave them out. */
+	header->font = *font;
+	header->font.data = 0;
+	header->font.length = 0;
+	header->font.cachedGlyphs = 0;
+	header->font.numCachedCodes = 0;
+	header->font.cachedMetrics = 0;
+	header->font.cachedBoxes = 0;
+	header->font.cachedOutlines = 0;
+	header->font.cachedKerning = 0;
+	header->font.instance = 0;
+	header->font.charstringCache = 0;
+	header->font.parsedTables = PARSED_KERNING | PARSED_STRIKES;
+	header->font.kerning = kerning;
+	header->font.strikes = strikes;
+
+	GetGlyphsSource(font, header->glyphs.source);
+	header->glyphs.count = CountMappedCodes(font);
+	header->glyphs.offset = cursor;
+	uint16_t * restrict glyphs = (uint16_t *) (base + cursor);
+	for (unsigned long code = 0; code < header->glyphs.count; ++code) {
+		glyphs[code] = GetRawGlyphFromCode(font, code);
+	}
+	cursor += AlignSize(header->glyphs.count * sizeof(uint16_t));
+
+	GetMetricsSource(font, header->metrics.source);
+	header->metrics.count = font->numGlyphs;
+	header->metrics.offset = cursor;
+	SKR_HorMetrics * restrict metrics = (SKR_HorMetrics *) (base + cursor);
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		s = GetRawHorMetrics(font, glyph, &metrics[glyph]);
+		if (s) return s;
+	}
+	cursor += AlignSize(header->metrics.count * sizeof(SKR_HorMetrics));
+
+	GetBoxesSource(font, header->boxes.source);
+	header->boxes.count = font->numGlyphs;
+	header->boxes.offset = cursor;
+	int16_t * restrict boxes = (int16_t *) (base + cursor);
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		s = LoadGlyphBox(font, glyph, &boxes[4 * glyph]);
+		if (s) return s;
+	}
+	cursor += AlignSize(header->boxes.count * 4 * sizeof(int16_t));
+
+	/* CFF fonts have no decoded outlines, and store an empty section */
+	GetBoxesSource(font, header->outlines.source);
+	header->outlines.count = CalcCachedOutlinesSize(font);
+	header->outlines.offset = cursor;
+	if (header->outlines.count != 0) {
+		BuildCachedOutlines(font, (uint8_t *) memory + cursor);
+	}
+	cursor += header->outlines.count;
+
+	GetKerningSource(&kerning, header->kerning.source);
+	header->kerning.count = CalcKerningIndexSize(font, &kerning);
+	header->kerning.offset = cursor;
+	BuildKerningIndex(font, &kerning, (uint8_t *) memory + cursor);
+	cursor += header->kerning.count;
+
+	SKR_assert(cursor == needed);
+	return SKR_SUCCESS;
+}
+
+/*
+A cache may have been truncated or corrupted on disk, so every section
+has to lie within the block, aligned, before any of it gets attached.
+The metrics, boxes and outline offsets are looked up by glyph, so they
+need one entry for each glyph the header claims.
+*/
+static SKR_Status CheckHeader(FontCacheHeader const * restrict header,
+	unsigned long size)
+{
+	if ((uintptr_t) header % 8 != 0) return SKR_FAILURE;
+	if (size < sizeof(FontCacheHeader)) return SKR_FAILURE;
+	if (header->magic != FONT_CACHE_MAGIC) return SKR_FAILURE;
+	if (header->version != SKR_FONT_CACHE_VERSION) return SKR_FAILURE;
+	if (header->fontSize != sizeof(SKR_Font)) return SKR_FAILURE;
+	if (header->longSize != sizeof(unsigned long)) return SKR_FAILURE;
+	if (header->size > size) return SKR_FAILURE;
+
+	unsigned long total = header->size;
+	if (header->glyphs.count > MAX_CACHED_CODE + 1ul) return SKR_FAILURE;
+	if (!RangeFits(header->glyphs.offset, header->glyphs.count,
+		sizeof(uint16_t), total)) return SKR_FAILURE;
+	if (header->metrics.count < header->numGlyphs) return SKR_FAILURE;
+	if (!RangeFits(header->metrics.offset, header->metrics.count,
+		sizeof(SKR_HorMetrics), total)) return SKR_FAILURE;
+	if (header->boxes.count < header->numGlyphs) return SKR_FAILURE;
+	if (!RangeFits(header->boxes.offset, header->boxes.count,
+		4 * sizeof(int16_t), total)) return SKR_FAILURE;
+	if (!RangeFits(header->outlines.offset, header->outlines.count, 1, total)) return SKR_FAILURE;
+	if (header->outlines.count != 0 && !CheckCachedOutlines((BYTES1 *) header +
+		header->outlines.offset, header->outlines.count, header->numGlyphs)) return SKR_FAILURE;
+	if (!RangeFits(header->kerning.offset, header->kerning.count, 1, total)) return SKR_FAILURE;
+	if (!CheckKerningIndex((BYTES1 *) header + header->kerning.offset,
+		header->kerning.count, header->numGlyphs)) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrAttachFontCache(SKR_Font * restrict font,
+	void const * restrict memory, unsigned long size)
+{
+	FontCacheHeader const * restrict header = (FontCacheHeader const *) memory;
+	BYTES1 * base = (BYTES1 *) memory;
+	/* the metrics and boxes of an instance are its own */
+	if (font->instance != 0) return SKR_FAILURE;
+	SKR_Status s = CheckHeader(header, size);
+	if (s) return s;
+
+	unsigned long source[2];
+	int attached = 0;
+
+	GetGlyphsSource(font, source);
+	if (SourcesMatch(source, header->glyphs.source)) {
+		font->cachedGlyphs = (uint16_t const *) (base + header->glyphs.offset);
+		font->numCachedCodes = header->glyphs.count;
+		++attached;
+	}
+
+	/* the other sections are indexed by glyph, so they only fit faces with as many */
+	if (header->numGlyphs == (uint32_t) font->numGlyphs) {
+		GetMetricsSource(font, source);
+		if (SourcesMatch(source, header->metrics.source)) {
+			font->cachedMetrics = (SKR_HorMetrics const *) (base + header->metrics.offset);
+			++attached;
+		}
+
+		GetBoxesSource(font, source);
+		if (SourcesMatch(source, header->boxes.source)) {
+			font->cachedBoxes = (int16_t const *) (base + header->boxes.offset);
+			++attached;
+		}
+
+		/* the outlines come from the same tables as the boxes */
+		if (header->outlines.count != 0 && SourcesMatch(source, header->outlines.source)) {
+			font->cachedOutlines = base + header->outlines.offset;
+			++attached;
+		}
+
+		SKR_Kerning kerning;
+		GetKerning(font, &kerning);
+		GetKerningSource(&kerning, source);
+		if (SourcesMatch(source, header->kerning.source)) {
+			font->cachedKerning = base + header->kerning.offset;
+			++attached;
+		}
+	}
+
+	return attached > 0 ? SKR_SUCCESS : SKR_FAILURE;
+}
+
+/*
+Everything skrInitializeFace() would compute is already in the snapshot,
+so loading only has to verify that the cache belongs to this font.
+*/
+SKR_Status skrLoadFontCache(SKR_Font * restrict font,
+	void const * restrict memory, unsigned long size)
+{
+	FontCacheHeader const * restrict header = (FontCacheHeader const *) memory;
+	SKR_Status s = CheckHeader(header, size);
+	if (s) return s;
+
+	uint32_t checksum;
+	s = CalcDirectoryChecksum(font, header->font.directory, &checksum);
+	if (s) return s;
+	if (checksum != header->checksum) return SKR_FAILURE;
+
+	void const * data = font->data;
+	unsigned long length = font->length;
+	SKR_Quality quality = font->quality;
+	SKR_CharstringCache * charstringCache = font->charstringCache;
+	*font = header->font;
+	font->data = data;
+	font->length = length;
+	font->quality = quality;
+	font->charstringCache = charstringCache;
+	return skrAttachFontCache(font, memory, size);
+}
+
+/*
+======== cache rings ========
+
+The run cache and the glyph cache both store variable-sized records
+back to back in a ring buffer, oldest first, and evict from the old end
+when they run out of room. An open addressing hash table maps hashes
+to records in the ring buffer.
+*/
+
+typedef struct {
+	uint32_t hash;
+	uint32_t offset; // plus one, so that 0 marks an empty slot
+} RingSlot;
+
+/* The slot table gets this fraction of the memory. */
+#define RING_SLOTS_SHARE 16
+
+uint32_t HashBytes(uint32_t hash, void const * restrict data, unsigned long length)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) data;
+	for (unsigned long i = 0; i < length; ++i) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static RingRecord * RecordAt(SKR_CacheRing const * restrict ring, unsigned long offset)
+{
+	return (RingRecord *) (ring->arena + offset);
+}
+
+void InitRing(SKR_CacheRing * restrict ring, void * restrict memory, unsigned long size)
+{
+	/* offsets in the slots are only 32 bits wide */
+	size = min(size, 0xFFFFFFF0ul);
+	unsigned long numSlots = 1;
+	while (2 * numSlots * sizeof(RingSlot) <= size / RING_SLOTS_SHARE) numSlots *= 2;
+	RingSlot * restrict slots = (RingSlot *) memory;
+	for (unsigned long i = 0; i < numSlots; ++i) {
+		slots[i] = (RingSlot) { 0, 0 };
+	}
+	unsigned long slotsSize = AlignSize(numSlots * sizeof(RingSlot));
+	ring->slots = slots;
+	ring->numSlots = numSlots;
+	ring->arena = (unsigned char *) memory + slotsSize;
+	ring->arenaSize = size > slotsSize ? (size - slotsSize) & ~7ul : 0;
+	ring->head = ring->tail = ring->wrapAt = 0;
+	ring->wrapped = 0;
+	ring->numRecords = 0;
+	ring->hits = ring->misses = 0;
+}
+
+void * NextRecord(SKR_CacheRing const * restrict ring,
+	uint32_t hash, unsigned long * restrict probe)
+{
+	RingSlot const * restrict slots = (RingSlot const *) ring->slots;
+	unsigned long mask = ring->numSlots - 1;
+	for (; slots[*probe & mask].offset != 0; ++*probe) {
+		RingSlot slot = slots[*probe & mask];
+		if (slot.hash == hash) {
+			++*probe;
+			return RecordAt(ring, slot.offset - 1);
+		}
+	}
+	return 0;
+}
+
+/*
+Removes the slot of the record at offset.
+Later slots of the same probe sequence get shifted back into the gap,
+so that no tombstones are needed.
+*/
+static void RemoveSlot(SKR_CacheRing * restrict ring, uint32_t hash, unsigned long offset)
+{
+	RingSlot * restrict slots = (RingSlot *) ring->slots;
+	unsigned long mask = ring->numSlots - 1;
+	unsigned long i = hash & mask;
+	while (slots[i].offset != offset + 1) {
+		SKR_assert(slots[i].offset != 0);
+		i = (i + 1) & mask;
+	}
+	for (unsigned long j = (i + 1) & mask; slots[j].offset != 0; j = (j + 1) & mask) {
+		unsigned long home = slots[j].hash & mask;
+		/* can the slot at j move back to i without passing its home slot? */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i] = (RingSlot) { 0, 0 };
+}
+
+static void EvictOldest(SKR_CacheRing * restrict ring)
+{
+	RingRecord const * restrict record = RecordAt(ring, ring->tail);
+	RemoveSlot(ring, record->hash, ring->tail);
+	ring->tail += record->size;
+	--ring->numRecords;
+	if (ring->numRecords == 0) {
+		ring->head = ring->tail = 0;
+		ring->wrapped = 0;
+	} else if (ring->wrapped && ring->tail == ring->wrapAt) {
+		ring->tail = 0;
+		ring->wrapped = 0;
+	}
+}
+
+/*
+Makes room for a record at the head of the ring buffer, evicting as
+many of the oldest records as it takes. The slot table is kept at most
+half full. Nothing is added until the record gets committed,
+and it may be committed with a smaller size than was reserved.
+*/
+SKR_Status ReserveRecord(SKR_CacheRing * restrict ring,
+	unsigned long size, RingRecord ** restrict record)
+{
+	size = AlignSize(size);
+	if (size > ring->arenaSize) return SKR_FAILURE;
+	while (ring->numRecords > 0 && 2 * (ring->numRecords + 1) > ring->numSlots) {
+		EvictOldest(ring);
+	}
+	if (2 * (ring->numRecords + 1) > ring->numSlots) return SKR_FAILURE;
+	for (;;) {
+		if (!ring->wrapped) {
+			if (ring->arenaSize - ring->head >= size) break;
+			ring->wrapped = 1;
+			ring->wrapAt = ring->head;
+			ring->head = 0;
+		} else {
+			if (ring->tail - ring->head >= size) break;
+			EvictOldest(ring);
+		}
+	}
+	*record = RecordAt(ring, ring->head);
+	return SKR_SUCCESS;
+}
+
+void CommitRecord(SKR_CacheRing * restrict ring, RingRecord * restrict record,
+	unsigned long size, uint32_t hash)
+{
+	RingSlot * restrict slots = (RingSlot *) ring->slots;
+	unsigned long mask = ring->numSlots - 1;
+	unsigned long offset = (unsigned char *) record - ring->arena;
+	SKR_assert(offset == ring->head);
+	record->hash = hash;
+	record->size = AlignSize(size);
+	ring->head = offset + record->size;
+	++ring->numRecords;
+	unsigned long i = hash & mask;
+	while (slots[i].offset != 0) i = (i + 1) & mask;
+	slots[i] = (RingSlot) { hash, offset + 1 };
+}
+
+/*
+======== run cache ========
+
+Each run is a RunRecord followed by its assembly and then its text.
+The text is kept so that a hash collision can never hand out the wrong run.
+*/
+
+typedef struct {
+	RingRecord ring;
+	SKR_Font const * font;
+	float size;
+	int count;
+	unsigned long length;
+	SKR_Bounds bounds;
+} RunRecord;
+
+static uint32_t HashRun(SKR_Font const * font,
+	char const * restrict text, unsigned long length, float size)
+{
+	uint32_t hash = HashBytes(2166136261u, text, length);
+	hash = HashBytes(hash, &size, sizeof(size));
+	return HashBytes(hash, &font, sizeof(font));
+}
+
+void skrInitRunCache(SKR_RunCache * restrict cache,
+	void * restrict memory, unsigned long size)
+{
+	InitRing(&cache->ring, memory, size);
+}
+
+static RunRecord const * FindRun(SKR_CacheRing const * restrict ring,
+	SKR_Font const * restrict font, BYTES1 * restrict text,
+	unsigned long length, float size, uint32_t hash)
+{
+	RunRecord const * restrict record;
+	unsigned long probe = hash;
+	while ((record = NextRecord(ring, hash, &probe)) != 0) {
+		if (record->font != font || record->size != size) continue;
+		if (record->length != length) continue;
+		SKR_Assembly const * assembly = (SKR_Assembly const *) (record + 1);
+		BYTES1 * stored = (BYTES1 *) (assembly + record->count);
+		unsigned long k = 0;
+		while (k < length && stored[k] == text[k]) ++k;
+		if (k == length) return record;
+	}
+	return 0;
+}
+
+SKR_Status skrAssembleCachedUTF8(SKR_RunCache * restrict cache,
+	SKR_Font * restrict font, char const * restrict text,
+	unsigned long length, float size,
+	SKR_Assembly const ** restrict assembly, int * restrict count,
+	SKR_Bounds * restrict bounds)
+{
+	SKR_CacheRing * restrict ring = &cache->ring;
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	uint32_t hash = HashRun(font, text, length, size);
+	RunRecord const * found = FindRun(ring, font, bytes, length, size, hash);
+	if (found != 0) {
+		++ring->hits;
+		*assembly = (SKR_Assembly const *) (found + 1);
+		*count = found->count;
+		*bounds = found->bounds;
+		return SKR_SUCCESS;
+	}
+	++ring->misses;
+
+	/* No text has more glyphs than bytes, and the excess is given back below. */
+	if (length > INT_MAX) return SKR_FAILURE;
+	RingRecord * reserved;
+	SKR_Status s = ReserveRecord(ring, sizeof(RunRecord) +
+		length * sizeof(SKR_Assembly) + length, &reserved);
+	if (s) return s;
+	RunRecord * restrict record = (RunRecord *) reserved;
+
+	SKR_Assembly * restrict glyphs = (SKR_Assembly *) (record + 1);
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	s = skrAssembleUTF8(font, text, length, size, &state, glyphs, length, &record->count);
+	if (s) return s;
+	if (state.position < length) return SKR_FAILURE;
+
+	if (record->count > 0) {
+		s = skrGetAssemblyBounds(font, glyphs, record->count, &record->bounds);
+		if (s) return s;
+	} else {
+		record->bounds = (SKR_Bounds) { 0, 0, 0, 0 };
+	}
+
+	uint8_t * restrict stored = (uint8_t *) (glyphs + record->count);
+	for (unsigned long k = 0; k < length; ++k) {
+		stored[k] = bytes[k];
+	}
+	record->font = font;
+	record->size = size;
+	record->length = length;
+	CommitRecord(ring, &record->ring, sizeof(RunRecord) +
+		record->count * sizeof(SKR_Assembly) + length, hash);
+
+	*assembly = glyphs;
+	*count = record->count;
+	*bounds = record->bounds;
+	return SKR_SUCCESS;
+}
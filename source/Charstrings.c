@@ -0,0 +1,1044 @@
+#include "Internals.h"
+
+#include <float.h>
+
+void DrawLine(Workspace * restrict ws, Line line);
+void DrawCubic(Workspace * restrict ws, Cubic initialCubic);
+
+/*
+======== CFF tables ========
+
+Fonts with CFF or CFF2 outlines store each glyph as a Type 2 charstring,
+a little program for a stack machine that draws cubic curves, and that
+calls into subroutines shared between glyphs. Everything is found through
+INDEXes (arrays of variable-sized objects) and DICTs (lists of keys,
+each preceded by its operands).
+
+The version 1 format can hold several fonts, but the one in an OpenType
+font only ever holds a single one. CIDFonts (and all of CFF2) split the
+glyphs up between several font DICTs, each with subroutines of its own.
+
+All offsets kept in SKR_CFF are from the start of the font data,
+and every read gets checked against the end of the table.
+*/
+
+static int InsideCFF(SKR_Font const * restrict font,
+	unsigned long offset, unsigned long length)
+{
+	return InsideTable(font->cff.table, offset, length);
+}
+
+/* CFF packs its numbers bytewise, so no alignment here. */
+static unsigned long ReadOffset(BYTES1 * restrict bytes, int size)
+{
+	unsigned long value = 0;
+	for (int i = 0; i < size; ++i) {
+		value = value << 8 | bytes[i];
+	}
+	return value;
+}
+
+typedef struct {
+	unsigned long count;
+	unsigned long offsets;
+	unsigned long data; // one before the first object, as the offsets start at 1
+	unsigned long end;
+	int offSize;
+} CFF_Index;
+
+static SKR_Status ReadIndex(SKR_Font const * restrict font,
+	unsigned long offset, CFF_Index * restrict index)
+{
+	BYTES1 * restrict base = (BYTES1 *) font->data;
+	int countSize = font->cff.version == 2 ? 4 : 2;
+	if (!InsideCFF(font, offset, countSize)) return SKR_FAILURE;
+	index->count = ReadOffset(base + offset, countSize);
+	if (index->count == 0) {
+		index->offsets = index->data = 0;
+		index->offSize = 1;
+		index->end = offset + countSize;
+		return SKR_SUCCESS;
+	}
+	if (!InsideCFF(font, offset + countSize, 1)) return SKR_FAILURE;
+	index->offSize = base[offset + countSize];
+	if (index->offSize < 1 || index->offSize > 4) return SKR_FAILURE;
+	index->offsets = offset + countSize + 1;
+	if (index->count > font->cff.table.length) return SKR_FAILURE;
+	unsigned long arraySize = (index->count + 1) * index->offSize;
+	if (!InsideCFF(font, index->offsets, arraySize)) return SKR_FAILURE;
+	index->data = index->offsets + arraySize - 1;
+	unsigned long last = ReadOffset(base + index->offsets +
+		index->count * index->offSize, index->offSize);
+	if (last < 1 || !InsideCFF(font, index->data + 1, last - 1)) return SKR_FAILURE;
+	index->end = index->data + last;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status GetIndexObject(SKR_Font const * restrict font,
+	CFF_Index const * restrict index, unsigned long i,
+	unsigned long * restrict beg, unsigned long * restrict end)
+{
+	if (!(i < index->count)) return SKR_FAILURE;
+	BYTES1 * restrict offsets = (BYTES1 *) font->data + index->offsets + i * index->offSize;
+	unsigned long first = ReadOffset(offsets, index->offSize);
+	unsigned long last = ReadOffset(offsets + index->offSize, index->offSize);
+	if (first < 1 || first > last || index->data + last > index->end) return SKR_FAILURE;
+	*beg = index->data + first;
+	*end = index->data + last;
+	return SKR_SUCCESS;
+}
+
+/*
+The operands of the keys looked for here are all plain integers,
+but real numbers still have to be skipped over properly.
+*/
+static SKR_Status SkipReal(BYTES1 * restrict * restrict ptr, BYTES1 * end)
+{
+	for (;;) {
+		if (*ptr >= end) return SKR_FAILURE;
+		uint8_t nibbles = *((*ptr)++);
+		if ((nibbles & 0x0F) == 0x0F || (nibbles & 0xF0) == 0xF0) return SKR_SUCCESS;
+	}
+}
+
+/* Two-byte keys, which start with 12, get 1200 added to their second byte. */
+#define DICT_ESCAPE(key) (1200 + (key))
+
+#define DICT_CHARSTRINGS     17
+#define DICT_PRIVATE         18
+#define DICT_SUBRS           19
+#define DICT_VSINDEX         22
+#define DICT_VSTORE          24
+#define DICT_CHARSTRING_TYPE DICT_ESCAPE(6)
+#define DICT_ROS             DICT_ESCAPE(30)
+#define DICT_FDARRAY         DICT_ESCAPE(36)
+#define DICT_FDSELECT        DICT_ESCAPE(37)
+
+#define DICT_MAX_OPERANDS 48
+
+/*
+Looks for key in the DICT between beg and end. Keys that aren't
+present fail. Operands that don't fit are counted but not kept,
+which only matters to keys with that many operands, like the blended
+hinting values of CFF2 (which don't get looked at).
+*/
+static SKR_Status FindDictEntry(SKR_Font const * restrict font,
+	unsigned long beg, unsigned long end, int key,
+	long operands[DICT_MAX_OPERANDS], int * restrict count)
+{
+	BYTES1 * restrict ptr = (BYTES1 *) font->data + beg;
+	BYTES1 * restrict stop = (BYTES1 *) font->data + end;
+	*count = 0;
+	while (ptr < stop) {
+		int b0 = *(ptr++);
+		long value;
+		if (b0 <= 27) {
+			int op = b0;
+			if (b0 == 12) {
+				if (ptr >= stop) return SKR_FAILURE;
+				op = DICT_ESCAPE(*(ptr++));
+			}
+			if (op == key) {
+				return *count <= DICT_MAX_OPERANDS ? SKR_SUCCESS : SKR_FAILURE;
+			}
+			*count = 0;
+			continue;
+		} else if (b0 == 28) {
+			if (stop - ptr < 2) return SKR_FAILURE;
+			value = (int16_t) ReadOffset(ptr, 2);
+			ptr += 2;
+		} else if (b0 == 29) {
+			if (stop - ptr < 4) return SKR_FAILURE;
+			value = (int32_t) ReadOffset(ptr, 4);
+			ptr += 4;
+		} else if (b0 == 30) {
+			if (SkipReal(&ptr, stop)) return SKR_FAILURE;
+			value = 0;
+		} else if (b0 >= 32 && b0 <= 246) {
+			value = b0 - 139;
+		} else if (b0 >= 247 && b0 <= 254) {
+			if (ptr >= stop) return SKR_FAILURE;
+			value = ((b0 - 247) & 3) * 256 + *(ptr++) + 108;
+			if (b0 >= 251) value = -value;
+		} else {
+			return SKR_FAILURE;
+		}
+		if (*count < DICT_MAX_OPERANDS) operands[*count] = value;
+		++*count;
+	}
+	return SKR_FAILURE;
+}
+
+/* Reads an offset from the DICT that has to lie within the table. */
+static SKR_Status FindDictOffset(SKR_Font const * restrict font,
+	unsigned long beg, unsigned long end, int key,
+	unsigned long from, unsigned long * restrict offset)
+{
+	long operands[DICT_MAX_OPERANDS];
+	int count;
+	SKR_Status s = FindDictEntry(font, beg, end, key, operands, &count);
+	if (s) return s;
+	if (count != 1 || operands[0] < 0) return SKR_FAILURE;
+	*offset = from + operands[0];
+	return InsideCFF(font, *offset, 0) ? SKR_SUCCESS : SKR_FAILURE;
+}
+
+/*
+Finds the private DICT that belongs to a top or font DICT. It holds the
+local subroutines, at an offset from the private DICT itself, and in CFF2,
+which variation data blends use. Neither of them has to be there.
+*/
+static SKR_Status ParsePrivateDict(SKR_Font const * restrict font,
+	unsigned long beg, unsigned long end,
+	unsigned long * restrict localSubrs, long * restrict vsindex)
+{
+	long operands[DICT_MAX_OPERANDS];
+	int count;
+	SKR_Status s = FindDictEntry(font, beg, end, DICT_PRIVATE, operands, &count);
+	if (s) {
+		*localSubrs = 0;
+		*vsindex = 0;
+		return SKR_SUCCESS;
+	}
+	if (count != 2 || operands[0] < 0 || operands[1] < 0) return SKR_FAILURE;
+	unsigned long privateBeg = font->cff.table.offset + operands[1];
+	if (!InsideCFF(font, privateBeg, operands[0])) return SKR_FAILURE;
+	unsigned long privateEnd = privateBeg + operands[0];
+	if (FindDictOffset(font, privateBeg, privateEnd, DICT_SUBRS, privateBeg, localSubrs)) {
+		*localSubrs = 0;
+	}
+	*vsindex = 0;
+	if (!FindDictEntry(font, privateBeg, privateEnd, DICT_VSINDEX, operands, &count)) {
+		if (count != 1 || operands[0] < 0) return SKR_FAILURE;
+		*vsindex = operands[0];
+	}
+	return SKR_SUCCESS;
+}
+
+static SKR_Status ParseCFF1(SKR_Font * restrict font)
+{
+	SKR_Status s;
+	SKR_CFF * restrict cff = &font->cff;
+	BYTES1 * restrict addr = (BYTES1 *) font->data + cff->table.offset;
+	if (cff->table.length < 4 || addr[0] != 1) return SKR_FAILURE;
+
+	CFF_Index names, topDicts, strings, globalSubrs;
+	s = ReadIndex(font, cff->table.offset + addr[2], &names);
+	if (s) return s;
+	s = ReadIndex(font, names.end, &topDicts);
+	if (s) return s;
+	s = ReadIndex(font, topDicts.end, &strings);
+	if (s) return s;
+	s = ReadIndex(font, strings.end, &globalSubrs);
+	if (s) return s;
+	cff->globalSubrs = strings.end;
+
+	unsigned long beg, end;
+	s = GetIndexObject(font, &topDicts, 0, &beg, &end);
+	if (s) return s;
+	long operands[DICT_MAX_OPERANDS];
+	int count;
+	if (!FindDictEntry(font, beg, end, DICT_CHARSTRING_TYPE, operands, &count)) {
+		if (count != 1 || operands[0] != 2) return SKR_FAILURE;
+	}
+	s = FindDictOffset(font, beg, end, DICT_CHARSTRINGS,
+		cff->table.offset, &cff->charStrings);
+	if (s) return s;
+
+	if (!FindDictEntry(font, beg, end, DICT_ROS, operands, &count)) {
+		s = FindDictOffset(font, beg, end, DICT_FDARRAY,
+			cff->table.offset, &cff->fdArray);
+		if (s) return s;
+		return FindDictOffset(font, beg, end, DICT_FDSELECT,
+			cff->table.offset, &cff->fdSelect);
+	}
+	long vsindex;
+	return ParsePrivateDict(font, beg, end, &cff->localSubrs, &vsindex);
+}
+
+typedef struct {
+	BYTES1 majorVersion;
+	BYTES1 minorVersion;
+	BYTES1 headerSize;
+	BYTES1 topDictLength[2];
+} CFF2_Header;
+
+static SKR_Status ParseCFF2(SKR_Font * restrict font)
+{
+	SKR_Status s;
+	SKR_CFF * restrict cff = &font->cff;
+	CFF2_Header const * restrict header = (CFF2_Header const *)
+		((BYTES1 *) font->data + cff->table.offset);
+	if (cff->table.length < sizeof(CFF2_Header) || header->majorVersion != 2) return SKR_FAILURE;
+	unsigned long beg = cff->table.offset + header->headerSize;
+	unsigned long length = ReadOffset(header->topDictLength, 2);
+	if (!InsideCFF(font, beg, length)) return SKR_FAILURE;
+	unsigned long end = beg + length;
+
+	CFF_Index globalSubrs;
+	s = ReadIndex(font, end, &globalSubrs);
+	if (s) return s;
+	cff->globalSubrs = end;
+
+	s = FindDictOffset(font, beg, end, DICT_CHARSTRINGS,
+		cff->table.offset, &cff->charStrings);
+	if (s) return s;
+	s = FindDictOffset(font, beg, end, DICT_FDARRAY,
+		cff->table.offset, &cff->fdArray);
+	if (s) return s;
+	if (FindDictOffset(font, beg, end, DICT_FDSELECT,
+		cff->table.offset, &cff->fdSelect)) {
+		cff->fdSelect = 0;
+	}
+	/* The item variation store comes after the length of the whole store. */
+	if (!FindDictOffset(font, beg, end, DICT_VSTORE,
+		cff->table.offset, &cff->varStore)) {
+		cff->varStore += 2;
+	}
+	return SKR_SUCCESS;
+}
+
+SKR_Status ParseCharstringTables(SKR_Font * restrict font)
+{
+	SKR_Status s;
+	font->cff = (SKR_CFF) { 0 };
+	if (font->glyf.offset != 0) return SKR_SUCCESS;
+	if (!FindTable(font, TagFromString("CFF2"), &font->cff.table)) {
+		font->cff.version = 2;
+		s = ParseCFF2(font);
+	} else if (!FindTable(font, TagFromString("CFF "), &font->cff.table)) {
+		font->cff.version = 1;
+		s = ParseCFF1(font);
+	} else {
+		return SKR_FAILURE;
+	}
+	if (s) return s;
+	CFF_Index charStrings;
+	s = ReadIndex(font, font->cff.charStrings, &charStrings);
+	if (s) return s;
+	return charStrings.count >= (unsigned long) font->numGlyphs ? SKR_SUCCESS : SKR_FAILURE;
+}
+
+/*
+FDSelect maps glyphs to font DICTs, either one byte per glyph (format 0),
+or in ranges of glyphs (format 3, and format 4 with wider fields in CFF2).
+Without an FDSelect, all glyphs belong to the first font DICT.
+*/
+static SKR_Status SelectFontDict(SKR_Font const * restrict font,
+	Glyph glyph, unsigned long * restrict fd)
+{
+	unsigned long offset = font->cff.fdSelect;
+	if (offset == 0) {
+		*fd = 0;
+		return SKR_SUCCESS;
+	}
+	BYTES1 * restrict base = (BYTES1 *) font->data;
+	if (!InsideCFF(font, offset, 1)) return SKR_FAILURE;
+	int format = base[offset];
+	if (format == 0) {
+		if (!InsideCFF(font, offset + 1, glyph + 1)) return SKR_FAILURE;
+		*fd = base[offset + 1 + glyph];
+		return SKR_SUCCESS;
+	}
+	if (format != 3 && format != 4) return SKR_FAILURE;
+	int firstSize = format == 3 ? 2 : 4;
+	int fdSize = format == 3 ? 1 : 2;
+	int rangeSize = firstSize + fdSize;
+	if (!InsideCFF(font, offset + 1, firstSize)) return SKR_FAILURE;
+	unsigned long numRanges = ReadOffset(base + offset + 1, firstSize);
+	unsigned long ranges = offset + 1 + firstSize;
+	if (numRanges == 0 || numRanges > font->cff.table.length / rangeSize) return SKR_FAILURE;
+	/* the ranges are followed by a sentinel, that ends the last of them */
+	if (!InsideCFF(font, ranges, numRanges * rangeSize + firstSize)) return SKR_FAILURE;
+	unsigned long lower = 0, upper = numRanges;
+	while (upper - lower > 1) {
+		unsigned long mid = (lower + upper) / 2;
+		if (ReadOffset(base + ranges + mid * rangeSize, firstSize) <= (unsigned long) glyph) {
+			lower = mid;
+		} else {
+			upper = mid;
+		}
+	}
+	BYTES1 * restrict range = base + ranges + lower * rangeSize;
+	if (ReadOffset(range, firstSize) > (unsigned long) glyph) return SKR_FAILURE;
+	if (ReadOffset(range + rangeSize, firstSize) <= (unsigned long) glyph) return SKR_FAILURE;
+	*fd = ReadOffset(range + firstSize, fdSize);
+	return SKR_SUCCESS;
+}
+
+/*
+Every blend in a CFF2 charstring takes one delta per region of the
+item variation data that vsindex picks.
+*/
+static SKR_Status CountBlendRegions(SKR_Font const * restrict font,
+	long vsindex, int * restrict numRegions)
+{
+	unsigned long store = font->cff.varStore;
+	*numRegions = 0;
+	if (store == 0) return SKR_SUCCESS;
+	BYTES1 * restrict base = (BYTES1 *) font->data;
+	if (!InsideCFF(font, store, 8)) return SKR_FAILURE;
+	unsigned long numData = ReadOffset(base + store + 6, 2);
+	if (vsindex < 0 || (unsigned long) vsindex >= numData) return SKR_FAILURE;
+	if (!InsideCFF(font, store + 8, 4 * numData)) return SKR_FAILURE;
+	unsigned long data = store + ReadOffset(base + store + 8 + 4 * vsindex, 4);
+	if (!InsideCFF(font, data, 6)) return SKR_FAILURE;
+	*numRegions = ReadOffset(base + data + 4, 2);
+	return SKR_SUCCESS;
+}
+
+/*
+======== charstrings ========
+
+The interpreter hands the outline to a sink, one verb at a time:
+a move to a new contour, a line, or a cubic. Contours get closed
+with an explicit line. The sink either just counts the verbs,
+stores them away, or draws them right away.
+The box of a glyph is the box of its points, control points included,
+so it always contains the outline.
+*/
+
+#define VERB_MOVE  0
+#define VERB_LINE  1
+#define VERB_CUBIC 2
+
+#define SINK_COUNT 0
+#define SINK_STORE 1
+#define SINK_DRAW  2
+
+typedef struct {
+	int mode;
+	unsigned long numPoints;
+	unsigned long numVerbs;
+	float box[4];
+	/* for SINK_STORE */
+	Point * restrict points;
+	uint8_t * restrict verbs;
+	/* for SINK_DRAW */
+	Workspace * restrict ws;
+	SKR_Affine affine;
+	Point pen;
+} OutlineSink;
+
+static OutlineSink BeginSink(int mode)
+{
+	OutlineSink sink = { 0 };
+	sink.mode = mode;
+	sink.box[0] = sink.box[1] = FLT_MAX;
+	sink.box[2] = sink.box[3] = -FLT_MAX;
+	return sink;
+}
+
+static Point TransformPoint(SKR_Affine const * restrict affine, Point p)
+{
+	return (Point) {
+		p.x * affine->xx + p.y * affine->xy + affine->dx,
+		p.x * affine->yx + p.y * affine->yy + affine->dy };
+}
+
+/* The points of a cubic are its two control points, then where it ends. */
+static void DrawVerb(OutlineSink * restrict sink, int verb, Point const * restrict points)
+{
+	switch (verb) {
+	case VERB_MOVE:
+		sink->pen = TransformPoint(&sink->affine, points[0]);
+		break;
+	case VERB_LINE: {
+		Point end = TransformPoint(&sink->affine, points[0]);
+		DrawLine(sink->ws, (Line) { sink->pen, end });
+		sink->pen = end;
+		break;
+	}
+	case VERB_CUBIC: {
+		Cubic cubic = { sink->pen, TransformPoint(&sink->affine, points[2]),
+			TransformPoint(&sink->affine, points[0]),
+			TransformPoint(&sink->affine, points[1]) };
+		DrawCubic(sink->ws, cubic);
+		sink->pen = cubic.end;
+		break;
+	}
+	default: SKR_assert(0);
+	}
+}
+
+static int PointsOfVerb(int verb)
+{
+	return verb == VERB_CUBIC ? 3 : 1;
+}
+
+static void EmitVerb(OutlineSink * restrict sink, int verb, Point const * restrict points)
+{
+	int n = PointsOfVerb(verb);
+	for (int i = 0; i < n; ++i) {
+		sink->box[0] = min(sink->box[0], points[i].x);
+		sink->box[1] = min(sink->box[1], points[i].y);
+		sink->box[2] = max(sink->box[2], points[i].x);
+		sink->box[3] = max(sink->box[3], points[i].y);
+	}
+	switch (sink->mode) {
+	case SINK_STORE:
+		for (int i = 0; i < n; ++i) {
+			sink->points[sink->numPoints + i] = points[i];
+		}
+		sink->verbs[sink->numVerbs] = verb;
+		break;
+	case SINK_DRAW:
+		DrawVerb(sink, verb, points);
+		break;
+	}
+	sink->numPoints += n;
+	sink->numVerbs += 1;
+}
+
+/* CFF2 allows for this much, CFF (version 1) only for 48 operands. */
+#define CHARSTRING_STACK 513
+#define CHARSTRING_DEPTH 10
+
+typedef struct {
+	SKR_Font const * font;
+	OutlineSink * sink;
+	CFF_Index subrs[2]; // local, then global
+	long bias[2];
+	int numRegions;
+	float stack[CHARSTRING_STACK];
+	int top;
+	int numStems;
+	int widthSeen;
+	int depth;
+	int ended;
+	int open;
+	Point pen, start;
+} Charstring;
+
+static long CalcSubrBias(unsigned long count)
+{
+	if (count < 1240) return 107;
+	if (count < 33900) return 1131;
+	return 32768;
+}
+
+static void ClosePath(Charstring * restrict cs)
+{
+	if (cs->open && (cs->pen.x != cs->start.x || cs->pen.y != cs->start.y)) {
+		EmitVerb(cs->sink, VERB_LINE, &cs->start);
+	}
+	cs->open = 0;
+}
+
+/* The current point stays where the closed contour ended, not where it started. */
+static void MoveTo(Charstring * restrict cs, float dx, float dy)
+{
+	ClosePath(cs);
+	cs->pen.x += dx;
+	cs->pen.y += dy;
+	cs->start = cs->pen;
+	EmitVerb(cs->sink, VERB_MOVE, &cs->pen);
+	cs->open = 1;
+}
+
+/* Charstrings that draw without moving first start at the current point. */
+static void OpenPath(Charstring * restrict cs)
+{
+	if (!cs->open) MoveTo(cs, 0.0f, 0.0f);
+}
+
+static void LineTo(Charstring * restrict cs, float dx, float dy)
+{
+	OpenPath(cs);
+	cs->pen.x += dx;
+	cs->pen.y += dy;
+	EmitVerb(cs->sink, VERB_LINE, &cs->pen);
+}
+
+static void CurveTo(Charstring * restrict cs,
+	float dx1, float dy1, float dx2, float dy2, float dx3, float dy3)
+{
+	OpenPath(cs);
+	Point points[3];
+	points[0] = (Point) { cs->pen.x + dx1, cs->pen.y + dy1 };
+	points[1] = (Point) { points[0].x + dx2, points[0].y + dy2 };
+	points[2] = (Point) { points[1].x + dx3, points[1].y + dy3 };
+	cs->pen = points[2];
+	EmitVerb(cs->sink, VERB_CUBIC, points);
+}
+
+/*
+In CFF (version 1), the first operator that clears the stack may
+have the advance width of the glyph as an extra first operand.
+Whether it does shows in the number of operands.
+Returns where the actual operands start.
+*/
+static int SkipWidth(Charstring * restrict cs, int hasWidth)
+{
+	if (cs->widthSeen) return 0;
+	cs->widthSeen = 1;
+	return hasWidth;
+}
+
+static float ReadFixed(BYTES1 * restrict bytes)
+{
+	return (int32_t) ReadOffset(bytes, 4) / 65536.0f;
+}
+
+static SKR_Status Execute(Charstring * restrict cs, unsigned long beg, unsigned long end);
+
+static SKR_Status CallSubr(Charstring * restrict cs, int global)
+{
+	if (cs->top < 1 || cs->depth >= CHARSTRING_DEPTH) return SKR_FAILURE;
+	long number = (long) cs->stack[--cs->top] + cs->bias[global];
+	if (number < 0) return SKR_FAILURE;
+	unsigned long beg, end;
+	SKR_Status s = GetIndexObject(cs->font, &cs->subrs[global], number, &beg, &end);
+	if (s) return s;
+	++cs->depth;
+	s = Execute(cs, beg, end);
+	--cs->depth;
+	return s;
+}
+
+/* Keeps the default values of a blend, and drops its deltas. */
+static SKR_Status Blend(Charstring * restrict cs)
+{
+	if (cs->top < 1) return SKR_FAILURE;
+	long n = (long) cs->stack[cs->top - 1];
+	if (n < 0 || n * (cs->numRegions + 1) + 1 > cs->top) return SKR_FAILURE;
+	cs->top -= 1 + n * cs->numRegions;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status ExecuteEscaped(Charstring * restrict cs, int op)
+{
+	float const * restrict a = cs->stack;
+	int n = cs->top;
+	switch (op) {
+	case 0: // dotsection
+		break;
+	case 34: // hflex
+		if (n < 7) return SKR_FAILURE;
+		CurveTo(cs, a[0], 0.0f, a[1], a[2], a[3], 0.0f);
+		CurveTo(cs, a[4], 0.0f, a[5], -a[2], a[6], 0.0f);
+		break;
+	case 35: // flex
+		if (n < 13) return SKR_FAILURE;
+		CurveTo(cs, a[0], a[1], a[2], a[3], a[4], a[5]);
+		CurveTo(cs, a[6], a[7], a[8], a[9], a[10], a[11]);
+		break;
+	case 36: { // hflex1
+		if (n < 9) return SKR_FAILURE;
+		float startY = cs->pen.y;
+		CurveTo(cs, a[0], a[1], a[2], a[3], a[4], 0.0f);
+		CurveTo(cs, a[5], 0.0f, a[6], a[7], a[8], startY - (cs->pen.y + a[7]));
+		break;
+	}
+	case 37: { // flex1
+		if (n < 11) return SKR_FAILURE;
+		float dx = a[0] + a[2] + a[4] + a[6] + a[8];
+		float dy = a[1] + a[3] + a[5] + a[7] + a[9];
+		CurveTo(cs, a[0], a[1], a[2], a[3], a[4], a[5]);
+		if (gabs(dx) > gabs(dy)) {
+			CurveTo(cs, a[6], a[7], a[8], a[9], a[10], -dy);
+		} else {
+			CurveTo(cs, a[6], a[7], a[8], a[9], -dx, a[10]);
+		}
+		break;
+	}
+	/* the arithmetic operators, which no font in use seems to need */
+	default: return SKR_FAILURE;
+	}
+	cs->top = 0;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status ExecuteOperator(Charstring * restrict cs,
+	int op, BYTES1 * restrict * restrict ptr, BYTES1 * end)
+{
+	float const * restrict a = cs->stack;
+	int n = cs->top;
+	int i = 0;
+	switch (op) {
+	case 1: case 3: case 18: case 23: // hstem, vstem, hstemhm, vstemhm
+		i = SkipWidth(cs, n % 2);
+		cs->numStems += (n - i) / 2;
+		break;
+	case 19: case 20: // hintmask, cntrmask, with an implicit vstem
+		i = SkipWidth(cs, n % 2);
+		cs->numStems += (n - i) / 2;
+		if (end - *ptr < (cs->numStems + 7) / 8) return SKR_FAILURE;
+		*ptr += (cs->numStems + 7) / 8;
+		break;
+	case 21: // rmoveto
+		i = SkipWidth(cs, n > 2);
+		if (n - i < 2) return SKR_FAILURE;
+		MoveTo(cs, a[i], a[i + 1]);
+		break;
+	case 22: // hmoveto
+		i = SkipWidth(cs, n > 1);
+		if (n - i < 1) return SKR_FAILURE;
+		MoveTo(cs, a[i], 0.0f);
+		break;
+	case 4: // vmoveto
+		i = SkipWidth(cs, n > 1);
+		if (n - i < 1) return SKR_FAILURE;
+		MoveTo(cs, 0.0f, a[i]);
+		break;
+	case 5: // rlineto
+		for (; i + 2 <= n; i += 2) {
+			LineTo(cs, a[i], a[i + 1]);
+		}
+		break;
+	case 6: case 7: { // hlineto, vlineto
+		int horizontal = op == 6;
+		for (; i < n; ++i, horizontal = !horizontal) {
+			LineTo(cs, horizontal ? a[i] : 0.0f, horizontal ? 0.0f : a[i]);
+		}
+		break;
+	}
+	case 8: // rrcurveto
+		for (; i + 6 <= n; i += 6) {
+			CurveTo(cs, a[i], a[i + 1], a[i + 2], a[i + 3], a[i + 4], a[i + 5]);
+		}
+		break;
+	case 24: // rcurveline
+		for (; i + 6 <= n - 2; i += 6) {
+			CurveTo(cs, a[i], a[i + 1], a[i + 2], a[i + 3], a[i + 4], a[i + 5]);
+		}
+		if (i + 2 <= n) LineTo(cs, a[i], a[i + 1]);
+		break;
+	case 25: // rlinecurve
+		for (; i + 2 <= n - 6; i += 2) {
+			LineTo(cs, a[i], a[i + 1]);
+		}
+		if (i + 6 <= n) CurveTo(cs, a[i], a[i + 1], a[i + 2], a[i + 3], a[i + 4], a[i + 5]);
+		break;
+	case 26: { // vvcurveto
+		float dx1 = n % 2 ? a[i++] : 0.0f;
+		for (; i + 4 <= n; i += 4, dx1 = 0.0f) {
+			CurveTo(cs, dx1, a[i], a[i + 1], a[i + 2], 0.0f, a[i + 3]);
+		}
+		break;
+	}
+	case 27: { // hhcurveto
+		float dy1 = n % 2 ? a[i++] : 0.0f;
+		for (; i + 4 <= n; i += 4, dy1 = 0.0f) {
+			CurveTo(cs, a[i], dy1, a[i + 1], a[i + 2], a[i + 3], 0.0f);
+		}
+		break;
+	}
+	case 30: case 31: { // vhcurveto, hvcurveto
+		/* the curves alternate between starting horizontally and vertically */
+		int horizontal = op == 31;
+		for (; i + 4 <= n; i += 4, horizontal = !horizontal) {
+			float last = n - i == 5 ? a[i + 4] : 0.0f;
+			if (horizontal) {
+				CurveTo(cs, a[i], 0.0f, a[i + 1], a[i + 2], last, a[i + 3]);
+			} else {
+				CurveTo(cs, 0.0f, a[i], a[i + 1], a[i + 2], a[i + 3], last);
+			}
+		}
+		break;
+	}
+	case 10: // callsubr
+		return CallSubr(cs, 0);
+	case 29: // callgsubr
+		return CallSubr(cs, 1);
+	case 14: // endchar
+		if (cs->font->cff.version == 2) return SKR_FAILURE;
+		i = SkipWidth(cs, n == 1 || n == 5);
+		/* accented characters the old way, through seac */
+		if (n - i == 4) return SKR_FAILURE;
+		ClosePath(cs);
+		cs->ended = 1;
+		break;
+	case 15: { // vsindex
+		if (cs->font->cff.version != 2 || n < 1) return SKR_FAILURE;
+		SKR_Status s = CountBlendRegions(cs->font, (long) a[n - 1], &cs->numRegions);
+		if (s) return s;
+		break;
+	}
+	case 16: // blend
+		if (cs->font->cff.version != 2) return SKR_FAILURE;
+		return Blend(cs);
+	case 12:
+		if (*ptr >= end) return SKR_FAILURE;
+		return ExecuteEscaped(cs, *((*ptr)++));
+	default: return SKR_FAILURE;
+	}
+	cs->top = 0;
+	return SKR_SUCCESS;
+}
+
+/* Runs until the end of the charstring, a return, or an endchar. */
+static SKR_Status Execute(Charstring * restrict cs, unsigned long beg, unsigned long end)
+{
+	BYTES1 * restrict ptr = (BYTES1 *) cs->font->data + beg;
+	BYTES1 * restrict stop = (BYTES1 *) cs->font->data + end;
+	while (ptr < stop && !cs->ended) {
+		int b0 = *(ptr++);
+		float value;
+		if (b0 >= 32 && b0 <= 246) {
+			value = b0 - 139;
+		} else if (b0 >= 247 && b0 <= 254) {
+			if (ptr >= stop) return SKR_FAILURE;
+			value = ((b0 - 247) & 3) * 256 + *(ptr++) + 108;
+			if (b0 >= 251) value = -value;
+		} else if (b0 == 255) {
+			if (stop - ptr < 4) return SKR_FAILURE;
+			value = ReadFixed(ptr);
+			ptr += 4;
+		} else if (b0 == 28) {
+			if (stop - ptr < 2) return SKR_FAILURE;
+			value = (int16_t) ReadOffset(ptr, 2);
+			ptr += 2;
+		} else if (b0 == 11) { // return
+			return SKR_SUCCESS;
+		} else {
+			SKR_Status s = ExecuteOperator(cs, b0, &ptr, stop);
+			if (s) return s;
+			continue;
+		}
+		if (cs->top >= CHARSTRING_STACK) return SKR_FAILURE;
+		cs->stack[cs->top++] = value;
+	}
+	return SKR_SUCCESS;
+}
+
+static SKR_Status LocateLocalSubrs(SKR_Font const * restrict font, Glyph glyph,
+	unsigned long * restrict localSubrs, long * restrict vsindex)
+{
+	if (font->cff.fdArray == 0) {
+		*localSubrs = font->cff.localSubrs;
+		*vsindex = 0;
+		return SKR_SUCCESS;
+	}
+	SKR_Status s;
+	unsigned long fd, beg, end;
+	s = SelectFontDict(font, glyph, &fd);
+	if (s) return s;
+	CFF_Index fontDicts;
+	s = ReadIndex(font, font->cff.fdArray, &fontDicts);
+	if (s) return s;
+	s = GetIndexObject(font, &fontDicts, fd, &beg, &end);
+	if (s) return s;
+	return ParsePrivateDict(font, beg, end, localSubrs, vsindex);
+}
+
+static SKR_Status InterpretCharstring(SKR_Font const * restrict font,
+	Glyph glyph, OutlineSink * restrict sink)
+{
+	SKR_Status s;
+	Charstring cs;
+	cs.font = font;
+	cs.sink = sink;
+	cs.top = 0;
+	cs.numStems = 0;
+	cs.widthSeen = font->cff.version == 2;
+	cs.depth = 0;
+	cs.ended = 0;
+	cs.open = 0;
+	cs.pen = (Point) { 0.0f, 0.0f };
+	cs.start = cs.pen;
+
+	CFF_Index charStrings;
+	s = ReadIndex(font, font->cff.charStrings, &charStrings);
+	if (s) return s;
+	unsigned long beg, end;
+	s = GetIndexObject(font, &charStrings, glyph, &beg, &end);
+	if (s) return s;
+
+	unsigned long localSubrs;
+	long vsindex;
+	s = LocateLocalSubrs(font, glyph, &localSubrs, &vsindex);
+	if (s) return s;
+	if (localSubrs != 0) {
+		s = ReadIndex(font, localSubrs, &cs.subrs[0]);
+		if (s) return s;
+	} else {
+		cs.subrs[0] = (CFF_Index) { 0 };
+	}
+	s = ReadIndex(font, font->cff.globalSubrs, &cs.subrs[1]);
+	if (s) return s;
+	cs.bias[0] = CalcSubrBias(cs.subrs[0].count);
+	cs.bias[1] = CalcSubrBias(cs.subrs[1].count);
+	s = CountBlendRegions(font, vsindex, &cs.numRegions);
+	if (s) return s;
+
+	s = Execute(&cs, beg, end);
+	if (s) return s;
+	ClosePath(&cs);
+	return SKR_SUCCESS;
+}
+
+/*
+======== charstring cache ========
+
+Each outline is a CharstringRecord, followed by its points and then
+its verbs. Both passes of storing an outline, the one that counts and
+the one that stores, happen under the lock of the shard, and so does
+drawing it, so a record can't get evicted while it is in use.
+*/
+
+typedef struct {
+	RingRecord ring;
+	SKR_Font const * font;
+	Glyph glyph;
+	uint32_t numPoints;
+	uint32_t numVerbs;
+	float box[4];
+} CharstringRecord;
+
+void skrInitCharstringCache(SKR_CharstringCache * restrict cache,
+	void * restrict memory, unsigned long size)
+{
+	unsigned long shardSize = size / SKR_CACHE_SHARDS & ~7ul;
+	for (int i = 0; i < SKR_CACHE_SHARDS; ++i) {
+		InitRing(&cache->shards[i], (unsigned char *) memory + i * shardSize, shardSize);
+		cache->locks[i] = 0;
+	}
+}
+
+static CharstringRecord const * FindOutline(SKR_CacheRing const * restrict ring,
+	SKR_Font const * restrict font, Glyph glyph, uint32_t hash)
+{
+	CharstringRecord const * restrict record;
+	unsigned long probe = hash;
+	while ((record = NextRecord(ring, hash, &probe)) != 0) {
+		if (record->font == font && record->glyph == glyph) {
+			return record;
+		}
+	}
+	return 0;
+}
+
+/*
+Interprets the charstring twice, once to find out how much room the
+outline takes up, and once to store it. An outline too large for
+the shard isn't an error, it just doesn't get a record.
+*/
+static SKR_Status StoreOutline(SKR_CacheRing * restrict ring,
+	SKR_Font const * restrict font, Glyph glyph, uint32_t hash,
+	CharstringRecord const ** restrict stored)
+{
+	SKR_Status s;
+	OutlineSink sink = BeginSink(SINK_COUNT);
+	s = InterpretCharstring(font, glyph, &sink);
+	if (s) return s;
+	unsigned long size = sizeof(CharstringRecord) +
+		sink.numPoints * sizeof(Point) + sink.numVerbs;
+	RingRecord * reserved;
+	*stored = 0;
+	if (ReserveRecord(ring, size, &reserved)) return SKR_SUCCESS;
+
+	CharstringRecord * restrict record = (CharstringRecord *) reserved;
+	OutlineSink store = BeginSink(SINK_STORE);
+	store.points = (Point *) (record + 1);
+	store.verbs = (uint8_t *) (store.points + sink.numPoints);
+	s = InterpretCharstring(font, glyph, &store);
+	if (s) return s;
+	SKR_assert(store.numPoints == sink.numPoints && store.numVerbs == sink.numVerbs);
+	record->font = font;
+	record->glyph = glyph;
+	record->numPoints = store.numPoints;
+	record->numVerbs = store.numVerbs;
+	for (int i = 0; i < 4; ++i) {
+		record->box[i] = store.box[i];
+	}
+	CommitRecord(ring, reserved, size, hash);
+	*stored = record;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status LookupOutline(SKR_CacheRing * restrict ring,
+	SKR_Font const * restrict font, Glyph glyph, uint32_t hash,
+	CharstringRecord const ** restrict record)
+{
+	*record = FindOutline(ring, font, glyph, hash);
+	if (*record != 0) {
+		++ring->hits;
+		return SKR_SUCCESS;
+	}
+	++ring->misses;
+	return StoreOutline(ring, font, glyph, hash, record);
+}
+
+static void ReplayOutline(CharstringRecord const * restrict record,
+	OutlineSink * restrict sink)
+{
+	Point const * restrict points = (Point const *) (record + 1);
+	uint8_t const * restrict verbs = (uint8_t const *) (points + record->numPoints);
+	for (uint32_t i = 0; i < record->numVerbs; ++i) {
+		DrawVerb(sink, verbs[i], points);
+		points += PointsOfVerb(verbs[i]);
+	}
+}
+
+/*
+The low bits of the hash pick the slot within a shard,
+so the shard is picked by the high bits.
+*/
+static int PickShard(SKR_Font const * font, Glyph glyph, uint32_t * restrict hash)
+{
+	*hash = HashBytes(2166136261u, &font, sizeof(font));
+	*hash = HashBytes(*hash, &glyph, sizeof(glyph));
+	return (*hash >> 24) % SKR_CACHE_SHARDS;
+}
+
+/* affine already has to be scaled down by unitsPerEm. */
+SKR_Status DrawCharstring(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, Workspace * restrict ws)
+{
+	OutlineSink sink = BeginSink(SINK_DRAW);
+	sink.ws = ws;
+	sink.affine = affine;
+	SKR_CharstringCache * restrict cache = font->charstringCache;
+	if (cache == 0) return InterpretCharstring(font, glyph, &sink);
+
+	uint32_t hash;
+	int shard = PickShard(font, glyph, &hash);
+	AcquireLock(&cache->locks[shard]);
+	CharstringRecord const * record;
+	SKR_Status s = LookupOutline(&cache->shards[shard], font, glyph, hash, &record);
+	if (!s && record != 0) ReplayOutline(record, &sink);
+	ReleaseLock(&cache->locks[shard]);
+	if (!s && record == 0) s = InterpretCharstring(font, glyph, &sink);
+	return s;
+}
+
+static int16_t ClampToInt16(float value)
+{
+	return max(INT16_MIN, min(INT16_MAX, value));
+}
+
+static void ConvertBox(float const from[4], unsigned long numPoints, int16_t box[4])
+{
+	if (numPoints == 0) {
+		box[0] = box[1] = INT16_MAX;
+		box[2] = box[3] = INT16_MIN;
+		return;
+	}
+	box[0] = ClampToInt16(floorf(from[0]));
+	box[1] = ClampToInt16(floorf(from[1]));
+	box[2] = ClampToInt16(ceilf(from[2]));
+	box[3] = ClampToInt16(ceilf(from[3]));
+}
+
+SKR_Status LoadCharstringBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4])
+{
+	SKR_CharstringCache * restrict cache = font->charstringCache;
+	if (cache != 0) {
+		uint32_t hash;
+		int shard = PickShard(font, glyph, &hash);
+		AcquireLock(&cache->locks[shard]);
+		CharstringRecord const * record;
+		SKR_Status s = LookupOutline(&cache->shards[shard], font, glyph, hash, &record);
+		if (!s && record != 0) ConvertBox(record->box, record->numPoints, box);
+		ReleaseLock(&cache->locks[shard]);
+		if (s) return s;
+		if (record != 0) return SKR_SUCCESS;
+	}
+	OutlineSink sink = BeginSink(SINK_COUNT);
+	SKR_Status s = InterpretCharstring(font, glyph, &sink);
+	if (s) return s;
+	ConvertBox(sink.box, sink.numPoints, box);
+	return SKR_SUCCESS;
+}
@@ -13,6 +13,125 @@ unsigned long skrCalcCellCount(SKR_Dimensions dims)
 	return CalcRasterWidth(dims) * dims.height;
 }
 
+/*
+Rows of planar rasters are padded to 16 cells instead, so that a row
+can be walked one full AVX2 register at a time.
+*/
+uint32_t CalcPlaneWidth(SKR_Dimensions dims)
+{
+	return (dims.width + 15) & ~15;
+}
+
+static unsigned long CellValueSize(SKR_CellFormat format)
+{
+	return format == SKR_CELLS_32 ? sizeof(int32_t) : sizeof(int16_t);
+}
+
+/*
+Planar rasters are split into tiles of RASTER_TILE_WIDTH by
+RASTER_TILE_HEIGHT cells, with one byte per tile in a tile map that
+says whether anything was drawn into the tile yet. Tiles only get
+cleared right before that first happens, and exporting fills in the
+untouched ones straight from the running sums, which a tile without
+edges or tails leaves as they are. Blank space like that between lines,
+words and glyphs costs nothing then, except for writing out the image.
+*/
+static uint32_t CalcTileColumns(SKR_Dimensions dims)
+{
+	return CalcPlaneWidth(dims) / RASTER_TILE_WIDTH;
+}
+
+static uint32_t CalcTileRows(SKR_Dimensions dims)
+{
+	return (dims.height + RASTER_TILE_HEIGHT - 1) / RASTER_TILE_HEIGHT;
+}
+
+/*
+The memory of a planar raster holds the edge plane, the tail plane,
+one more row of cells for skrExportSpans(), and then the tile map.
+*/
+static unsigned long CalcPlaneSize(SKR_Dimensions dims, SKR_CellFormat format)
+{
+	return CalcPlaneWidth(dims) * dims.height * CellValueSize(format);
+}
+
+unsigned long skrCalcRasterSize(SKR_Dimensions dims, SKR_CellFormat format)
+{
+	unsigned long sumsSize = CalcPlaneWidth(dims) * CellValueSize(format);
+	return 2 * CalcPlaneSize(dims, format) + sumsSize + CalcTileColumns(dims) * CalcTileRows(dims);
+}
+
+void skrInitRaster(SKR_Raster * restrict raster, void * restrict memory,
+	SKR_Dimensions dims, SKR_CellFormat format)
+{
+	unsigned long planeSize = CalcPlaneSize(dims, format);
+	unsigned long sumsSize = CalcPlaneWidth(dims) * CellValueSize(format);
+	unsigned long numTiles = CalcTileColumns(dims) * CalcTileRows(dims);
+	raster->edges = memory;
+	raster->tails = (unsigned char *) memory + planeSize;
+	raster->tiles = (uint8_t *) memory + 2 * planeSize + sumsSize;
+	for (unsigned long i = 0; i < numTiles; ++i) {
+		raster->tiles[i] = 0;
+	}
+	raster->dims = dims;
+	raster->format = format;
+}
+
+Workspace PackedWorkspace(RasterCell * restrict raster, SKR_Dimensions dims)
+{
+	return (Workspace) { raster, 0, 0, 0, 0, 0, dims, CalcRasterWidth(dims), 0, 0.0f, 0.0f };
+}
+
+Workspace PlanarWorkspace(SKR_Raster const * restrict raster)
+{
+	uint32_t width = CalcPlaneWidth(raster->dims);
+	uint32_t tileColumns = CalcTileColumns(raster->dims);
+	if (raster->format == SKR_CELLS_32) {
+		return (Workspace) { 0, 0, 0, raster->edges, raster->tails,
+			raster->tiles, raster->dims, width, tileColumns, 0.0f, 0.0f };
+	}
+	return (Workspace) { 0, raster->edges, raster->tails, 0, 0,
+		raster->tiles, raster->dims, width, tileColumns, 0.0f, 0.0f };
+}
+
+/*
+Clears a tile of a planar raster, and marks it as drawn into.
+The stores are spelled out because compilers turn a loop over them
+into rep stosq, which takes longer to get going than a tile row takes.
+*/
+void ClaimTile(Workspace * restrict ws, unsigned long tileX, unsigned long tileY)
+{
+	__m128i const zero = _mm_setzero_si128();
+	unsigned long row = tileY * RASTER_TILE_HEIGHT;
+	unsigned long rowEnd = min(row + RASTER_TILE_HEIGHT, (unsigned long) ws->dims.height);
+	unsigned long start = row * ws->rasterWidth + tileX * RASTER_TILE_WIDTH;
+	for (; row < rowEnd; ++row, start += ws->rasterWidth) {
+		if (ws->edges != 0) {
+			__m128i * restrict edges = (__m128i *) (ws->edges + start);
+			__m128i * restrict tails = (__m128i *) (ws->tails + start);
+			edges[0] = zero; edges[1] = zero;
+			tails[0] = zero; tails[1] = zero;
+		} else {
+			__m128i * restrict edges = (__m128i *) (ws->wideEdges + start);
+			__m128i * restrict tails = (__m128i *) (ws->wideTails + start);
+			edges[0] = zero; edges[1] = zero; edges[2] = zero; edges[3] = zero;
+			tails[0] = zero; tails[1] = zero; tails[2] = zero; tails[3] = zero;
+		}
+	}
+	ws->tiles[tileY * ws->tileColumns + tileX] = 1;
+}
+
+/* Claims all tiles that overlap the cells from (xBeg, yBeg) up to (xEnd, yEnd). */
+void ClaimTiles(Workspace * restrict ws, long xBeg, long yBeg, long xEnd, long yEnd)
+{
+	if (xBeg >= xEnd || yBeg >= yEnd) return;
+	for (long ty = yBeg / RASTER_TILE_HEIGHT; ty <= (yEnd - 1) / RASTER_TILE_HEIGHT; ++ty) {
+		for (long tx = xBeg / RASTER_TILE_WIDTH; tx <= (xEnd - 1) / RASTER_TILE_WIDTH; ++tx) {
+			if (!ws->tiles[ty * ws->tileColumns + tx]) ClaimTile(ws, tx, ty);
+		}
+	}
+}
+
 static __m128i GatherEdge_sse2(__m128i * restrict pointer)
 {
 	__m128i lowerEdge = _mm_srai_epi32(_mm_slli_epi32(pointer[0], 16), 16);
@@ -93,8 +212,17 @@ static void WritePixels(unsigned char * restrict image, SKR_Dimensions dims,
 	}
 }
 
-void skrExportImage(RasterCell * restrict raster,
-	unsigned char * restrict image, SKR_Dimensions dims)
+/* How the winding sum of a cell becomes its coverage. */
+typedef __m128i (*CoverageStep)(__m128i value, SKR_FillRule rule);
+
+/*
+Walks the packed raster eight columns at a time, summing up the tails
+down each column. Both exporters go through here, and only differ in
+their coverage step, which gets inlined along with this.
+*/
+static inline void ExportColumns(RasterCell * restrict raster,
+	unsigned char * restrict image, SKR_Dimensions dims,
+	CoverageStep step, SKR_FillRule rule)
 {
 	long const width = CalcRasterWidth(dims);
 	for (long col = 0; col < width; col += 8) {
@@ -108,9 +236,8 @@ void skrExportImage(RasterCell * restrict raster,
 
 			__m128i cellValue = _mm_adds_epi16(accumulator, edgeValue);
 			accumulator = _mm_adds_epi16(accumulator, tailValue);
-			cellValue = _mm_max_epi16(cellValue, _mm_setzero_si128());
 
-			cellValue = BoundPixelValues(cellValue);
+			cellValue = step(cellValue, rule);
 			__m128i pixels[2];
 			ConvertPixels(cellValue, pixels);
 			WritePixels(image, dims, pixels, row, col);
@@ -119,3 +246,455 @@ void skrExportImage(RasterCell * restrict raster,
 	}
 }
 
+/* Glyphs only ever wind one way, so anything below zero is just rounding. */
+static __m128i ClampCoverage(__m128i value, SKR_FillRule rule)
+{
+	(void) rule;
+	return BoundPixelValues(_mm_max_epi16(value, _mm_setzero_si128()));
+}
+
+void skrExportImage(RasterCell * restrict raster,
+	unsigned char * restrict image, SKR_Dimensions dims)
+{
+	ExportColumns(raster, image, dims, ClampCoverage, SKR_FILL_NONZERO);
+}
+
+/*
+Fill rules only differ in how the winding sum of a cell becomes its
+coverage, where GRAIN is one full layer of ink. Under the even-odd rule,
+every other layer takes the ink away again.
+*/
+static __m128i ApplyFillRule(__m128i value, SKR_FillRule rule)
+{
+	__m128i magnitude = _mm_max_epi16(value, _mm_subs_epi16(_mm_setzero_si128(), value));
+	if (rule == SKR_FILL_EVEN_ODD) {
+		magnitude = _mm_and_si128(magnitude, _mm_set1_epi16(2 * GRAIN - 1));
+		magnitude = _mm_min_epi16(magnitude, _mm_sub_epi16(_mm_set1_epi16(2 * GRAIN), magnitude));
+	}
+	return BoundPixelValues(magnitude);
+}
+
+void skrExportFilled(RasterCell * restrict raster,
+	unsigned char * restrict image, SKR_Dimensions dims, SKR_FillRule rule)
+{
+	ExportColumns(raster, image, dims, ApplyFillRule, rule);
+}
+
+/*
+Planar rasters need no gathering at all: a row of edges or tails
+is loaded as it is. With AVX2, sixteen columns go through at once.
+The columns are walked a tile at a time, so that the pixels of tiles
+nothing was drawn into can be worked out once, and then just written.
+*/
+#ifndef __AVX2__
+static void ExportPlanar_sse2(SKR_Raster const * restrict raster,
+	unsigned char * restrict image)
+{
+	SKR_Dimensions const dims = raster->dims;
+	long const width = CalcPlaneWidth(dims);
+	long const tileColumns = CalcTileColumns(dims);
+	int16_t const * restrict edges = raster->edges;
+	int16_t const * restrict tails = raster->tails;
+	for (long col = 0; col < (long) dims.width; col += 8) {
+		uint8_t const * restrict tile = raster->tiles + col / RASTER_TILE_WIDTH;
+		__m128i accumulator = _mm_setzero_si128();
+		for (long row = 0; row < dims.height; tile += tileColumns) {
+			long const rowEnd = min(row + RASTER_TILE_HEIGHT, (long) dims.height);
+			if (!*tile) {
+				__m128i pixels[2];
+				ConvertPixels(BoundPixelValues(_mm_max_epi16(accumulator, _mm_setzero_si128())), pixels);
+				for (; row < rowEnd; ++row) {
+					WritePixels(image, dims, pixels, row, col);
+				}
+				continue;
+			}
+			for (; row < rowEnd; ++row) {
+				__m128i edgeValue = _mm_load_si128((__m128i *) (edges + row * width + col));
+				__m128i tailValue = _mm_load_si128((__m128i *) (tails + row * width + col));
+
+				__m128i cellValue = _mm_adds_epi16(accumulator, edgeValue);
+				accumulator = _mm_adds_epi16(accumulator, tailValue);
+				cellValue = _mm_max_epi16(cellValue, _mm_setzero_si128());
+
+				cellValue = BoundPixelValues(cellValue);
+				__m128i pixels[2];
+				ConvertPixels(cellValue, pixels);
+				WritePixels(image, dims, pixels, row, col);
+			}
+		}
+		SKR_assert(_mm_movemask_epi8(_mm_cmpeq_epi8(accumulator, _mm_setzero_si128())) == 0xFFFF);
+	}
+}
+
+#define ExportPlanar ExportPlanar_sse2
+#else
+/* Turns sixteen clamped 16-bit values into pixels, and writes them. */
+static void WritePixels_avx2(unsigned char * restrict image, SKR_Dimensions dims,
+	__m256i value, unsigned long row, unsigned long col)
+{
+	__m256i const lowerMask = _mm256_set_epi8(
+		0xFF, 0x06, 0x06, 0x06, 0xFF, 0x04, 0x04, 0x04,
+		0xFF, 0x02, 0x02, 0x02, 0xFF, 0x00, 0x00, 0x00,
+		0xFF, 0x06, 0x06, 0x06, 0xFF, 0x04, 0x04, 0x04,
+		0xFF, 0x02, 0x02, 0x02, 0xFF, 0x00, 0x00, 0x00);
+	__m256i const upperMask = _mm256_set_epi8(
+		0xFF, 0x0E, 0x0E, 0x0E, 0xFF, 0x0C, 0x0C, 0x0C,
+		0xFF, 0x0A, 0x0A, 0x0A, 0xFF, 0x08, 0x08, 0x08,
+		0xFF, 0x0E, 0x0E, 0x0E, 0xFF, 0x0C, 0x0C, 0x0C,
+		0xFF, 0x0A, 0x0A, 0x0A, 0xFF, 0x08, 0x08, 0x08);
+	/* the shuffles work within each half, so the halves get sorted out after */
+	__m256i lower = _mm256_shuffle_epi8(value, lowerMask);
+	__m256i upper = _mm256_shuffle_epi8(value, upperMask);
+	__m128i pixels[4] = {
+		_mm256_castsi256_si128(lower), _mm256_castsi256_si128(upper),
+		_mm256_extracti128_si256(lower, 1), _mm256_extracti128_si256(upper, 1) };
+	WritePixels(image, dims, &pixels[0], row, col);
+	if (col + 8 < dims.width) {
+		WritePixels(image, dims, &pixels[2], row, col + 8);
+	}
+}
+
+static __m256i BoundPixelValues_avx2(__m256i value)
+{
+	value = _mm256_max_epi16(value, _mm256_setzero_si256());
+	return _mm256_min_epi16(value, _mm256_set1_epi16(0xFF));
+}
+
+static void ExportPlanar_avx2(SKR_Raster const * restrict raster,
+	unsigned char * restrict image)
+{
+	SKR_Dimensions const dims = raster->dims;
+	long const width = CalcPlaneWidth(dims);
+	long const tileColumns = CalcTileColumns(dims);
+	int16_t const * restrict edges = raster->edges;
+	int16_t const * restrict tails = raster->tails;
+	for (long col = 0; col < (long) dims.width; col += 16) {
+		uint8_t const * restrict tile = raster->tiles + col / RASTER_TILE_WIDTH;
+		__m256i accumulator = _mm256_setzero_si256();
+		for (long row = 0; row < dims.height; tile += tileColumns) {
+			long const rowEnd = min(row + RASTER_TILE_HEIGHT, (long) dims.height);
+			if (!*tile) {
+				__m256i cellValue = BoundPixelValues_avx2(accumulator);
+				for (; row < rowEnd; ++row) {
+					WritePixels_avx2(image, dims, cellValue, row, col);
+				}
+				continue;
+			}
+			for (; row < rowEnd; ++row) {
+				__m256i edgeValue = _mm256_load_si256((__m256i *) (edges + row * width + col));
+				__m256i tailValue = _mm256_load_si256((__m256i *) (tails + row * width + col));
+
+				__m256i cellValue = _mm256_adds_epi16(accumulator, edgeValue);
+				accumulator = _mm256_adds_epi16(accumulator, tailValue);
+				WritePixels_avx2(image, dims, BoundPixelValues_avx2(cellValue), row, col);
+			}
+		}
+		SKR_assert(_mm256_movemask_epi8(_mm256_cmpeq_epi8(accumulator, _mm256_setzero_si256())) == -1);
+	}
+}
+
+#define ExportPlanar ExportPlanar_avx2
+#endif
+
+/*
+32-bit cells accumulate in 32-bit lanes, and only get narrowed
+(with saturation) once the pixel value is known.
+*/
+#ifndef __AVX2__
+static void ExportWide_sse2(SKR_Raster const * restrict raster,
+	unsigned char * restrict image)
+{
+	SKR_Dimensions const dims = raster->dims;
+	long const width = CalcPlaneWidth(dims);
+	long const tileColumns = CalcTileColumns(dims);
+	int32_t const * restrict edges = raster->edges;
+	int32_t const * restrict tails = raster->tails;
+	for (long col = 0; col < (long) dims.width; col += 8) {
+		uint8_t const * restrict tile = raster->tiles + col / RASTER_TILE_WIDTH;
+		__m128i lowerAccumulator = _mm_setzero_si128();
+		__m128i upperAccumulator = _mm_setzero_si128();
+		for (long row = 0; row < dims.height; tile += tileColumns) {
+			long const rowEnd = min(row + RASTER_TILE_HEIGHT, (long) dims.height);
+			if (!*tile) {
+				__m128i cellValue = _mm_packs_epi32(lowerAccumulator, upperAccumulator);
+				__m128i pixels[2];
+				ConvertPixels(BoundPixelValues(_mm_max_epi16(cellValue, _mm_setzero_si128())), pixels);
+				for (; row < rowEnd; ++row) {
+					WritePixels(image, dims, pixels, row, col);
+				}
+				continue;
+			}
+			for (; row < rowEnd; ++row) {
+				__m128i const * restrict edgeValues = (__m128i const *) (edges + row * width + col);
+				__m128i const * restrict tailValues = (__m128i const *) (tails + row * width + col);
+
+				__m128i lowerValue = _mm_add_epi32(lowerAccumulator, _mm_load_si128(edgeValues + 0));
+				__m128i upperValue = _mm_add_epi32(upperAccumulator, _mm_load_si128(edgeValues + 1));
+				lowerAccumulator = _mm_add_epi32(lowerAccumulator, _mm_load_si128(tailValues + 0));
+				upperAccumulator = _mm_add_epi32(upperAccumulator, _mm_load_si128(tailValues + 1));
+
+				__m128i cellValue = _mm_packs_epi32(lowerValue, upperValue);
+				cellValue = _mm_max_epi16(cellValue, _mm_setzero_si128());
+				cellValue = BoundPixelValues(cellValue);
+				__m128i pixels[2];
+				ConvertPixels(cellValue, pixels);
+				WritePixels(image, dims, pixels, row, col);
+			}
+		}
+		SKR_assert(_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_or_si128(lowerAccumulator, upperAccumulator), _mm_setzero_si128())) == 0xFFFF);
+	}
+}
+
+#define ExportWide ExportWide_sse2
+#else
+/* packing works within each half, which leaves the quarters out of order */
+static __m256i PackValues_avx2(__m256i lower, __m256i upper)
+{
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(lower, upper), 0xD8);
+}
+
+static void ExportWide_avx2(SKR_Raster const * restrict raster,
+	unsigned char * restrict image)
+{
+	SKR_Dimensions const dims = raster->dims;
+	long const width = CalcPlaneWidth(dims);
+	long const tileColumns = CalcTileColumns(dims);
+	int32_t const * restrict edges = raster->edges;
+	int32_t const * restrict tails = raster->tails;
+	for (long col = 0; col < (long) dims.width; col += 16) {
+		uint8_t const * restrict tile = raster->tiles + col / RASTER_TILE_WIDTH;
+		__m256i lowerAccumulator = _mm256_setzero_si256();
+		__m256i upperAccumulator = _mm256_setzero_si256();
+		for (long row = 0; row < dims.height; tile += tileColumns) {
+			long const rowEnd = min(row + RASTER_TILE_HEIGHT, (long) dims.height);
+			if (!*tile) {
+				__m256i cellValue = BoundPixelValues_avx2(
+					PackValues_avx2(lowerAccumulator, upperAccumulator));
+				for (; row < rowEnd; ++row) {
+					WritePixels_avx2(image, dims, cellValue, row, col);
+				}
+				continue;
+			}
+			for (; row < rowEnd; ++row) {
+				__m256i const * restrict edgeValues = (__m256i const *) (edges + row * width + col);
+				__m256i const * restrict tailValues = (__m256i const *) (tails + row * width + col);
+
+				__m256i lowerValue = _mm256_add_epi32(lowerAccumulator, _mm256_load_si256(edgeValues + 0));
+				__m256i upperValue = _mm256_add_epi32(upperAccumulator, _mm256_load_si256(edgeValues + 1));
+				lowerAccumulator = _mm256_add_epi32(lowerAccumulator, _mm256_load_si256(tailValues + 0));
+				upperAccumulator = _mm256_add_epi32(upperAccumulator, _mm256_load_si256(tailValues + 1));
+
+				__m256i cellValue = PackValues_avx2(lowerValue, upperValue);
+				WritePixels_avx2(image, dims, BoundPixelValues_avx2(cellValue), row, col);
+			}
+		}
+		SKR_assert(_mm256_testz_si256(
+			_mm256_or_si256(lowerAccumulator, upperAccumulator),
+			_mm256_or_si256(lowerAccumulator, upperAccumulator)));
+	}
+}
+
+#define ExportWide ExportWide_avx2
+#endif
+
+void skrExportPlanar(SKR_Raster const * restrict raster, unsigned char * restrict image)
+{
+	if (raster->format == SKR_CELLS_32) {
+		ExportWide(raster, image);
+	} else {
+		ExportPlanar(raster, image);
+	}
+}
+
+/*
+Spans come out row by row, so unlike above, the running sums of all
+columns have to be kept around from one row to the next, in the row
+of cells that comes after the planes. A row is summed up one tile
+across at a time, which yields sixteen alpha values at once. Where
+they all continue the current run, as they mostly do in blank space
+and in the middle of thick strokes, that's all there is to it.
+*/
+#ifndef __AVX2__
+static __m128i SumTile_sse2(int16_t const * restrict edges,
+	int16_t const * restrict tails, int16_t * restrict sums, int drawn)
+{
+	__m128i * restrict sumValues = (__m128i *) sums;
+	__m128i lowerValue = _mm_load_si128(sumValues + 0);
+	__m128i upperValue = _mm_load_si128(sumValues + 1);
+	if (drawn) {
+		__m128i const * restrict edgeValues = (__m128i const *) edges;
+		__m128i const * restrict tailValues = (__m128i const *) tails;
+		__m128i lowerSum = lowerValue, upperSum = upperValue;
+		lowerValue = _mm_adds_epi16(lowerSum, _mm_load_si128(edgeValues + 0));
+		upperValue = _mm_adds_epi16(upperSum, _mm_load_si128(edgeValues + 1));
+		_mm_store_si128(sumValues + 0, _mm_adds_epi16(lowerSum, _mm_load_si128(tailValues + 0)));
+		_mm_store_si128(sumValues + 1, _mm_adds_epi16(upperSum, _mm_load_si128(tailValues + 1)));
+	}
+	return _mm_packus_epi16(lowerValue, upperValue);
+}
+
+static __m128i SumWideTile_sse2(int32_t const * restrict edges,
+	int32_t const * restrict tails, int32_t * restrict sums, int drawn)
+{
+	__m128i * restrict sumValues = (__m128i *) sums;
+	__m128i values[4];
+	for (int i = 0; i < 4; ++i) {
+		values[i] = _mm_load_si128(sumValues + i);
+	}
+	if (drawn) {
+		__m128i const * restrict edgeValues = (__m128i const *) edges;
+		__m128i const * restrict tailValues = (__m128i const *) tails;
+		for (int i = 0; i < 4; ++i) {
+			__m128i sum = values[i];
+			values[i] = _mm_add_epi32(sum, _mm_load_si128(edgeValues + i));
+			_mm_store_si128(sumValues + i, _mm_add_epi32(sum, _mm_load_si128(tailValues + i)));
+		}
+	}
+	return _mm_packus_epi16(
+		_mm_packs_epi32(values[0], values[1]),
+		_mm_packs_epi32(values[2], values[3]));
+}
+
+#define SumTile SumTile_sse2
+#define SumWideTile SumWideTile_sse2
+#else
+static __m128i SumTile_avx2(int16_t const * restrict edges,
+	int16_t const * restrict tails, int16_t * restrict sums, int drawn)
+{
+	__m256i value = _mm256_load_si256((__m256i *) sums);
+	if (drawn) {
+		__m256i sum = value;
+		value = _mm256_adds_epi16(sum, _mm256_load_si256((__m256i const *) edges));
+		_mm256_store_si256((__m256i *) sums,
+			_mm256_adds_epi16(sum, _mm256_load_si256((__m256i const *) tails)));
+	}
+	return _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+}
+
+static __m128i SumWideTile_avx2(int32_t const * restrict edges,
+	int32_t const * restrict tails, int32_t * restrict sums, int drawn)
+{
+	__m256i * restrict sumValues = (__m256i *) sums;
+	__m256i lowerValue = _mm256_load_si256(sumValues + 0);
+	__m256i upperValue = _mm256_load_si256(sumValues + 1);
+	if (drawn) {
+		__m256i const * restrict edgeValues = (__m256i const *) edges;
+		__m256i const * restrict tailValues = (__m256i const *) tails;
+		__m256i lowerSum = lowerValue, upperSum = upperValue;
+		lowerValue = _mm256_add_epi32(lowerSum, _mm256_load_si256(edgeValues + 0));
+		upperValue = _mm256_add_epi32(upperSum, _mm256_load_si256(edgeValues + 1));
+		_mm256_store_si256(sumValues + 0, _mm256_add_epi32(lowerSum, _mm256_load_si256(tailValues + 0)));
+		_mm256_store_si256(sumValues + 1, _mm256_add_epi32(upperSum, _mm256_load_si256(tailValues + 1)));
+	}
+	__m256i value = PackValues_avx2(lowerValue, upperValue);
+	return _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+}
+
+#define SumTile SumTile_avx2
+#define SumWideTile SumWideTile_avx2
+#endif
+
+typedef struct {
+	SKR_Span * restrict spans;
+	unsigned long capacity;
+	unsigned long count;
+	uint32_t row;
+	uint32_t start;
+	uint8_t alpha;
+} SpanWriter;
+
+/* Ends the current run at column end. Runs without coverage are dropped. */
+static void EndRun(SpanWriter * restrict writer, uint32_t end)
+{
+	if (writer->alpha != 0) {
+		if (writer->count < writer->capacity) {
+			writer->spans[writer->count] = (SKR_Span) {
+				writer->row, writer->start, end - writer->start, writer->alpha };
+		}
+		++writer->count;
+	}
+}
+
+/* Continues the runs of a row with the first numValues of the values at col. */
+static void ScanValues(SpanWriter * restrict writer, __m128i values, uint32_t col, int numValues)
+{
+	uint32_t remaining = (1u << numValues) - 1;
+	for (;;) {
+		__m128i same = _mm_cmpeq_epi8(values, _mm_set1_epi8(writer->alpha));
+		uint32_t differ = ~_mm_movemask_epi8(same) & remaining;
+		if (!differ) return;
+		uint8_t alphas[16];
+		_mm_storeu_si128((__m128i *) alphas, values);
+		int i = __builtin_ctz(differ);
+		EndRun(writer, col + i);
+		writer->start = col + i;
+		writer->alpha = alphas[i];
+		remaining &= ~0u << (i + 1);
+	}
+}
+
+SKR_Status skrExportSpans(SKR_Raster const * restrict raster,
+	SKR_Span * restrict spans, unsigned long capacity, unsigned long * restrict count)
+{
+	SKR_Dimensions const dims = raster->dims;
+	unsigned long const width = CalcPlaneWidth(dims);
+	unsigned long const tileColumns = CalcTileColumns(dims);
+	int const wide = raster->format == SKR_CELLS_32;
+	unsigned char * restrict sums = (unsigned char *) raster->tails + CalcPlaneSize(dims, raster->format);
+	for (unsigned long i = 0; i < width * CellValueSize(raster->format); i += 16) {
+		_mm_store_si128((__m128i *) (sums + i), _mm_setzero_si128());
+	}
+
+	SpanWriter writer = { spans, capacity, 0, 0, 0, 0 };
+	for (uint32_t row = 0; row < dims.height; ++row) {
+		uint8_t const * restrict tiles = raster->tiles + row / RASTER_TILE_HEIGHT * tileColumns;
+		writer.row = row;
+		writer.start = 0;
+		writer.alpha = 0;
+		for (uint32_t col = 0; col < dims.width; col += RASTER_TILE_WIDTH) {
+			unsigned long idx = row * width + col;
+			int drawn = tiles[col / RASTER_TILE_WIDTH];
+			__m128i values;
+			if (wide) {
+				values = SumWideTile((int32_t const *) raster->edges + idx,
+					(int32_t const *) raster->tails + idx, (int32_t *) sums + col, drawn);
+			} else {
+				values = SumTile((int16_t const *) raster->edges + idx,
+					(int16_t const *) raster->tails + idx, (int16_t *) sums + col, drawn);
+			}
+			ScanValues(&writer, values, col, min((uint32_t) RASTER_TILE_WIDTH, dims.width - col));
+		}
+		EndRun(&writer, dims.width);
+	}
+	*count = writer.count;
+	return writer.count > capacity ? SKR_FAILURE : SKR_SUCCESS;
+}
+
+/*
+The same as skrExportImage(), but writes plain 8-bit coverage,
+in rows that are padded to the width of the raster.
+*/
+void ExportCoverage(RasterCell * restrict raster,
+	uint8_t * restrict coverage, SKR_Dimensions dims)
+{
+	long const width = CalcRasterWidth(dims);
+	for (long col = 0; col < width; col += 8) {
+		uint32_t * cursor = raster + col;
+		uint8_t * target = coverage + col;
+		__m128i accumulator = _mm_setzero_si128();
+		for (long row = 0; row < dims.height; ++row, cursor += width, target += width) {
+			__m128i * restrict pointer = (__m128i *) cursor;
+
+			__m128i edgeValue = GatherEdge(pointer);
+			__m128i tailValue = GatherTail(pointer);
+
+			__m128i cellValue = _mm_adds_epi16(accumulator, edgeValue);
+			accumulator = _mm_adds_epi16(accumulator, tailValue);
+			cellValue = _mm_max_epi16(cellValue, _mm_setzero_si128());
+
+			cellValue = BoundPixelValues(cellValue);
+			_mm_storel_epi64((__m128i *) target, _mm_packus_epi16(cellValue, cellValue));
+		}
+	}
+}
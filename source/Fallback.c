@@ -0,0 +1,119 @@
+#include "Internals.h"
+
+/*
+======== font chains ========
+
+The character maps Skribist reads stop at U+FFFF, so that is as far as
+a chain has to cover. Its index is split into pages of CHAIN_PAGE_SIZE
+characters, and a directory that tells which page each block of
+characters uses. Every entry of a page holds the glyph of its character,
+with the index of the font it comes from above it. All the blocks that
+no font has any glyph in share page 0, which stays empty; its entries
+resolve to glyph 0 of the first font, the missing glyph.
+*/
+
+#define CHAIN_PAGE_BITS 6
+#define CHAIN_PAGE_SIZE (1 << CHAIN_PAGE_BITS)
+#define CHAIN_NUM_PAGES (0x10000 >> CHAIN_PAGE_BITS)
+
+#define ENTRY_FONT_SHIFT 16
+#define ENTRY_GLYPH_MASK 0xFFFF
+
+/* Returns whether any of the fonts has a glyph in the block. */
+static int FillPage(SKR_Font * const * restrict fonts, int count,
+	unsigned long block, uint32_t entries[CHAIN_PAGE_SIZE])
+{
+	int32_t codes[CHAIN_PAGE_SIZE];
+	Glyph glyphs[CHAIN_PAGE_SIZE];
+	for (int i = 0; i < CHAIN_PAGE_SIZE; ++i) {
+		codes[i] = block << CHAIN_PAGE_BITS | i;
+		entries[i] = 0;
+	}
+	int covered = 0;
+	for (int f = 0; f < count; ++f) {
+		GlyphsFromCodes(fonts[f], codes, glyphs, CHAIN_PAGE_SIZE);
+		for (int i = 0; i < CHAIN_PAGE_SIZE; ++i) {
+			if (entries[i] != 0) continue;
+			if (glyphs[i] == 0 || !(glyphs[i] < fonts[f]->numGlyphs)) continue;
+			entries[i] = (uint32_t) f << ENTRY_FONT_SHIFT | glyphs[i];
+			covered = 1;
+		}
+	}
+	return covered;
+}
+
+unsigned long skrCalcFontChainSize(SKR_Font * const * restrict fonts, int count)
+{
+	if (count < 1 || count > SKR_MAX_CHAIN_FONTS) return 0;
+	unsigned long numPages = 1;
+	for (unsigned long block = 0; block < CHAIN_NUM_PAGES; ++block) {
+		uint32_t entries[CHAIN_PAGE_SIZE];
+		numPages += FillPage(fonts, count, block, entries);
+	}
+	return AlignSize(CHAIN_NUM_PAGES * sizeof(uint16_t)) +
+		numPages * CHAIN_PAGE_SIZE * sizeof(uint32_t);
+}
+
+SKR_Status skrInitFontChain(SKR_FontChain * restrict chain,
+	SKR_Font * const * restrict fonts, int count,
+	void * restrict memory, unsigned long size)
+{
+	if (count < 1 || count > SKR_MAX_CHAIN_FONTS) return SKR_FAILURE;
+	unsigned long directorySize = AlignSize(CHAIN_NUM_PAGES * sizeof(uint16_t));
+	unsigned long pageSize = CHAIN_PAGE_SIZE * sizeof(uint32_t);
+	if (size < directorySize + pageSize) return SKR_FAILURE;
+	uint16_t * restrict pages = (uint16_t *) memory;
+	uint32_t * restrict entries = (uint32_t *) ((unsigned char *) memory + directorySize);
+	unsigned long maxPages = (size - directorySize) / pageSize;
+
+	for (int i = 0; i < CHAIN_PAGE_SIZE; ++i) {
+		entries[i] = 0;
+	}
+	unsigned long numPages = 1;
+	for (unsigned long block = 0; block < CHAIN_NUM_PAGES; ++block) {
+		uint32_t page[CHAIN_PAGE_SIZE];
+		if (!FillPage(fonts, count, block, page)) {
+			pages[block] = 0;
+			continue;
+		}
+		if (numPages == maxPages) return SKR_FAILURE;
+		uint32_t * restrict target = entries + numPages * CHAIN_PAGE_SIZE;
+		for (int i = 0; i < CHAIN_PAGE_SIZE; ++i) {
+			target[i] = page[i];
+		}
+		pages[block] = numPages++;
+	}
+
+	for (int f = 0; f < count; ++f) {
+		chain->fonts[f] = fonts[f];
+	}
+	chain->numFonts = count;
+	chain->pages = pages;
+	chain->entries = entries;
+	return SKR_SUCCESS;
+}
+
+static uint32_t LookUpEntry(SKR_FontChain const * restrict chain, int32_t code)
+{
+	if ((uint32_t) code >= CHAIN_NUM_PAGES << CHAIN_PAGE_BITS) return 0;
+	unsigned long page = chain->pages[code >> CHAIN_PAGE_BITS];
+	return chain->entries[page << CHAIN_PAGE_BITS | (code & (CHAIN_PAGE_SIZE - 1))];
+}
+
+void skrResolveCode(SKR_FontChain const * restrict chain, int32_t code,
+	int * restrict font, Glyph * restrict glyph)
+{
+	uint32_t entry = LookUpEntry(chain, code);
+	*font = entry >> ENTRY_FONT_SHIFT;
+	*glyph = entry & ENTRY_GLYPH_MASK;
+}
+
+void ResolveCodes(SKR_FontChain const * restrict chain, int32_t const * restrict codes,
+	int * restrict fonts, Glyph * restrict glyphs, unsigned long count)
+{
+	for (unsigned long i = 0; i < count; ++i) {
+		uint32_t entry = LookUpEntry(chain, codes[i]);
+		fonts[i] = entry >> ENTRY_FONT_SHIFT;
+		glyphs[i] = entry & ENTRY_GLYPH_MASK;
+	}
+}
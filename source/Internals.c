@@ -20,6 +20,17 @@ unsigned long LengthOfString(char const * str)
 	return i;
 }
 
+/*
+Whether count elements of elemSize bytes, starting at an 8-byte aligned
+offset, fit into size bytes, without overflowing along the way.
+*/
+int RangeFits(unsigned long offset, unsigned long count,
+	unsigned long elemSize, unsigned long size)
+{
+	if (offset % 8 != 0 || offset > size) return 0;
+	return count <= (size - offset) / elemSize;
+}
+
 int CompareStrings(char const * a, char const * b, long n)
 {
 	for (long i = 0; i < n; ++i) {
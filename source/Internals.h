@@ -29,14 +29,75 @@ typedef struct {
 	Point beg, end, ctrl;
 } Curve;
 
+typedef struct {
+	Point beg, end, ctrl1, ctrl2;
+} Cubic;
+
+/*
+Where the cells of the raster being drawn go. Packed rasters hold both
+values of a cell in one RasterCell; for planar rasters, raster is 0,
+and edges and tails point to the planes instead, or for 32-bit cells,
+wideEdges and wideTails do. The pointers that don't apply are 0.
+rasterWidth is the padded width of a row, in cells.
+Planar rasters also have a tile map (see Exporting.c), which packed
+rasters go without.
+flatness and mergeLength are the tolerances of the font's SKR_Quality,
+in pixels, measured as Manhattan distances. They are filled in by
+DrawOutlineInWorkspace().
+*/
 typedef struct {
 	RasterCell * restrict raster;
+	int16_t * restrict edges;
+	int16_t * restrict tails;
+	int32_t * restrict wideEdges;
+	int32_t * restrict wideTails;
+	uint8_t * restrict tiles;
 	SKR_Dimensions dims;
 	uint32_t rasterWidth;
+	uint32_t tileColumns;
+	float flatness;
+	float mergeLength;
 } Workspace;
 
+#define RASTER_TILE_WIDTH 16
+#define RASTER_TILE_HEIGHT 8
+
+void ClaimTile(Workspace * restrict ws, unsigned long tileX, unsigned long tileY);
+void ClaimTiles(Workspace * restrict ws, long xBeg, long yBeg, long xEnd, long yEnd);
+
+Workspace PackedWorkspace(RasterCell * restrict raster, SKR_Dimensions dims);
+Workspace PlanarWorkspace(SKR_Raster const * restrict raster);
+/* Fills in flatness and mergeLength. */
+SKR_Status ApplyQuality(Workspace * restrict ws, SKR_Quality quality);
+SKR_Status DrawOutlineInWorkspace(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, Workspace * restrict ws);
+
+/*
+Glyphs whose box fits into a tile this many pixels across,
+and that have at most SMALL_MAX_POINTS points, take the
+small glyph path (see SmallGlyphs.c).
+*/
+#define SMALL_TILE_SIZE 32
+#define SMALL_MAX_POINTS 256
+
+/* A point in GRAIN units. */
+typedef struct {
+	int32_t x, y;
+} FixedPoint;
+
+void DrawSmallOutline(Workspace * restrict ws, long xOrigin, long yOrigin,
+	SKR_Dimensions dims, FixedPoint const * restrict points,
+	uint8_t const * restrict onCurve, uint16_t const * restrict contourEnds, int numContours);
+
+uint32_t CalcRasterWidth(SKR_Dimensions dims);
+uint32_t CalcPlaneWidth(SKR_Dimensions dims);
+void ExportCoverage(RasterCell * restrict raster,
+	uint8_t * restrict coverage, SKR_Dimensions dims);
+
 char * FormatUint(unsigned int n, char buf[8]);
 unsigned long LengthOfString(char const * str);
+int RangeFits(unsigned long offset, unsigned long count,
+	unsigned long elemSize, unsigned long size);
 int CompareStrings(char const * a, char const * b, long n);
 Point Midpoint(Point a, Point b);
 
@@ -71,3 +132,205 @@ static inline uint32_t ru32(BYTES4 raw)
 	uint32_t b2 = bytes[1], b3 = bytes[0];
 	return b0 | b1 << 8 | b2 << 16 | b3 << 24;
 }
+
+/* Bytewise, since offsets inside of tables needn't be aligned. */
+static inline uint16_t At16(BYTES1 * addr)
+{
+	return addr[0] << 8 | addr[1];
+}
+
+static inline int16_t AtI16(BYTES1 * addr)
+{
+	return (int16_t) At16(addr);
+}
+
+static inline uint32_t At32(BYTES1 * addr)
+{
+	return (uint32_t) At16(addr) << 16 | At16(addr + 2);
+}
+
+/* Whether length bytes at offset (both from the start of the font) lie within table. */
+static inline int InsideTable(SKR_TTF_Table table, unsigned long offset, unsigned long length)
+{
+	return offset >= table.offset &&
+		offset - table.offset <= table.length &&
+		length <= table.length - (offset - table.offset);
+}
+
+/* Rounds up to the alignment of the sections in caller-provided memory. */
+static inline unsigned long AlignSize(unsigned long size)
+{
+	return (size + 7) & ~7ul;
+}
+
+/*
+Tags compare as big-endian integers, which is also
+the order the table directory is sorted in.
+*/
+static inline uint32_t TagFromString(char const tag[4])
+{
+	BYTES1 * bytes = (BYTES1 *) tag;
+	return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 |
+		(uint32_t) bytes[2] << 8 | (uint32_t) bytes[3];
+}
+
+SKR_Status FindTable(SKR_Font const * restrict font,
+	uint32_t tag, SKR_TTF_Table * restrict table);
+SKR_Status CalcDirectoryChecksum(SKR_Font const * restrict font,
+	unsigned long directory, uint32_t * restrict checksum);
+
+/*
+Bits of SKR_Font.parsedTables,
+for optional tables that only get parsed on first use.
+*/
+#define PARSED_KERNING 0x01
+#define PARSED_STRIKES 0x02
+
+/*
+A font may be shared between threads, so several of them can ask for
+the same table at once. The first one claims the table by setting its bit
+shifted up by PARSING_SHIFT, and the others wait until it is published.
+Everything written before PublishTable() is visible to anyone who sees
+the table bit through ParsedTables().
+*/
+#define PARSING_SHIFT 16
+
+static inline unsigned int ParsedTables(SKR_Font const * restrict font)
+{
+	return __atomic_load_n(&font->parsedTables, __ATOMIC_ACQUIRE);
+}
+
+/* Returns 1 if the caller has to parse the table and publish it. */
+static inline int ClaimTable(SKR_Font * restrict font, unsigned int parsed)
+{
+	if (ParsedTables(font) & parsed) return 0;
+	unsigned int old = __atomic_fetch_or(&font->parsedTables,
+		parsed << PARSING_SHIFT, __ATOMIC_ACQUIRE);
+	if (!(old & parsed << PARSING_SHIFT)) return 1;
+	while (!(ParsedTables(font) & parsed)) __builtin_ia32_pause();
+	return 0;
+}
+
+static inline void PublishTable(SKR_Font * restrict font, unsigned int parsed)
+{
+	__atomic_fetch_or(&font->parsedTables, parsed, __ATOMIC_RELEASE);
+}
+
+static inline void AcquireLock(int * restrict lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) __builtin_ia32_pause();
+	}
+}
+
+static inline void ReleaseLock(int * restrict lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void LocateKerning(SKR_Font const * restrict font, SKR_Kerning * restrict kerning);
+unsigned long CalcKerningIndexSize(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning);
+void BuildKerningIndex(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning, void * restrict memory);
+/* Whether a kerning index read back from a font cache is safe to look up in. */
+int CheckKerningIndex(void const * restrict memory, unsigned long size, unsigned long numGlyphs);
+
+/* A glyph of a strike, with each row padded to rowBits. */
+typedef struct {
+	SKR_BitmapMetrics metrics;
+	BYTES1 * image;
+	unsigned long rowBits;
+	int bitDepth, bitAligned;
+} StrikeGlyph;
+
+void LocateStrikes(SKR_Font const * restrict font, SKR_Strikes * restrict strikes);
+void GetStrikes(SKR_Font const * restrict font, SKR_Strikes * restrict strikes);
+SKR_Status FindStrike(SKR_Font const * restrict font,
+	SKR_Strikes const * restrict strikes, float size, SKR_Strike * restrict strike);
+SKR_Status FindStrikeGlyph(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph, StrikeGlyph * restrict sg);
+void ReadStrikeRow(StrikeGlyph const * restrict sg, uint32_t row, uint8_t * restrict coverage);
+void DrawStrikeGlyph(StrikeGlyph const * restrict sg, long x, long y,
+	Workspace * restrict ws);
+
+SKR_Status WarmGlyph(SKR_SharedGlyphCache * restrict shared,
+	SKR_Font const * restrict font, Glyph glyph, float size);
+
+int DecodeSequenceUTF8(BYTES1 * restrict bytes,
+	unsigned long available, int32_t * restrict code);
+
+void GlyphsFromCodes(SKR_Font const * restrict font,
+	int32_t const * restrict codes, Glyph * restrict glyphs, unsigned long count);
+/* The same for a font chain (see Fallback.c), which also picks the fonts. */
+void ResolveCodes(SKR_FontChain const * restrict chain, int32_t const * restrict codes,
+	int * restrict fonts, Glyph * restrict glyphs, unsigned long count);
+
+/*
+These bypass the font cache, and are what it gets built from.
+Empty glyphs get an inverted box (xMin > xMax).
+*/
+Glyph GetRawGlyphFromCode(SKR_Font const * restrict font, int charCode);
+SKR_Status GetRawHorMetrics(SKR_Font const * restrict font,
+	Glyph glyph, SKR_HorMetrics * restrict metrics);
+SKR_Status LoadGlyphBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4]);
+
+/* Same as LoadGlyphBox(), but served from the font cache if there is one. */
+SKR_Status GetGlyphBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4]);
+
+/*
+Where the outline of a glyph lies, and where the memory it lies in ends,
+as far as vector loads may reach.
+*/
+typedef struct {
+	BYTES1 * lowerBound, * upperBound;
+	BYTES1 * dataEnd;
+} MemRange;
+
+/* This one ignores instances, and always looks into the glyf table. */
+SKR_Status GetRawOutlineRange(SKR_Font const * restrict font,
+	Glyph glyph, MemRange * restrict range);
+/* Decodes all points of a simple outline; fails for compound ones. */
+SKR_Status DecodeOutline(MemRange range, int32_t * restrict xs,
+	int32_t * restrict ys, uint8_t * restrict onCurve);
+
+/* The section of decoded outlines in a font cache (see Outline.c). */
+unsigned long CalcCachedOutlinesSize(SKR_Font const * restrict font);
+void BuildCachedOutlines(SKR_Font const * restrict font, void * restrict memory);
+/* Whether the offsets of the section lie within it; the records get checked on use. */
+int CheckCachedOutlines(void const * restrict memory, unsigned long size,
+	unsigned long numGlyphs);
+
+/* These draw and measure CFF and CFF2 outlines (see Charstrings.c). */
+SKR_Status ParseCharstringTables(SKR_Font * restrict font);
+SKR_Status DrawCharstring(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, Workspace * restrict ws);
+SKR_Status LoadCharstringBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4]);
+
+/* These instance glyphs on first use (see Variations.c). */
+SKR_Status GetInstancedOutlineRange(SKR_Instance * restrict instance,
+	Glyph glyph, MemRange * restrict range);
+SKR_Status GetInstancedHorMetrics(SKR_Instance * restrict instance,
+	Glyph glyph, SKR_HorMetrics * restrict metrics);
+
+/*
+Every record in a cache ring starts with this header,
+which is filled in by CommitRecord().
+*/
+typedef struct {
+	uint32_t hash;
+	uint32_t size;
+} RingRecord;
+
+uint32_t HashBytes(uint32_t hash, void const * restrict data, unsigned long length);
+void InitRing(SKR_CacheRing * restrict ring, void * restrict memory, unsigned long size);
+/* Walks the records with the given hash. Start with *probe = hash. */
+void * NextRecord(SKR_CacheRing const * restrict ring,
+	uint32_t hash, unsigned long * restrict probe);
+SKR_Status ReserveRecord(SKR_CacheRing * restrict ring,
+	unsigned long size, RingRecord ** restrict record);
+void CommitRecord(SKR_CacheRing * restrict ring, RingRecord * restrict record,
+	unsigned long size, uint32_t hash);
@@ -0,0 +1,704 @@
+#include "Internals.h"
+
+/*
+======== kerning ========
+
+Kerning can come from two places: the GPOS 'kern' feature, or the older
+kern table. GPOS takes precedence, as in every other text stack.
+
+Looking pairs up directly in either table involves a couple of binary
+searches per pair, which is fine for occasional queries. For layout,
+the font cache carries a flattened pair index instead (see below).
+*/
+
+#define KERNING_NONE 0
+#define KERNING_KERN 1
+#define KERNING_GPOS 2
+
+/* Marks pairs that are not in the explicit pair index. */
+#define NO_SUBTABLE 0xFFFF
+#define NO_CLASS_TABLE 0xFF
+#define EMPTY_KEY 0xFFFFFFFF
+
+typedef struct {
+	BYTES2 version;
+	BYTES2 nTables;
+} TTF_kern;
+
+typedef struct {
+	BYTES2 version;
+	BYTES2 length;
+	BYTES2 coverage;
+	BYTES2 nPairs;
+	BYTES2 searchRange;
+	BYTES2 entrySelector;
+	BYTES2 rangeShift;
+} TTF_kern_format0;
+
+typedef struct {
+	BYTES2 left;
+	BYTES2 right;
+	BYTES2 value;
+} TTF_kern_pair;
+
+typedef struct {
+	BYTES2 majorVersion;
+	BYTES2 minorVersion;
+	BYTES2 scriptList;
+	BYTES2 featureList;
+	BYTES2 lookupList;
+} TTF_GPOS;
+
+// kern subtable coverage bits
+#define KERN_HORIZONTAL   0x01
+#define KERN_MINIMUM      0x02
+#define KERN_CROSS_STREAM 0x04
+
+#define LOOKUP_PAIR_POS  2
+#define LOOKUP_EXTENSION 9
+
+// value format bits
+#define VF_X_PLACEMENT 0x01
+#define VF_Y_PLACEMENT 0x02
+#define VF_X_ADVANCE   0x04
+
+/* Whether count elements of size bytes each fit in, without overflowing. */
+static int InsideTableArray(SKR_TTF_Table table, unsigned long offset,
+	unsigned long count, unsigned long size)
+{
+	if (!InsideTable(table, offset, 0)) return 0;
+	return size == 0 || count <= (table.length - (offset - table.offset)) / size;
+}
+
+static SKR_Status Locate_kern(SKR_Font const * restrict font,
+	SKR_Kerning * restrict kerning)
+{
+	SKR_TTF_Table table;
+	SKR_Status s = FindTable(font, TagFromString("kern"), &table);
+	if (s) return s;
+	if (!InsideTable(table, table.offset, sizeof(TTF_kern))) return SKR_FAILURE;
+
+	BYTES1 * base = (BYTES1 *) font->data;
+	TTF_kern const * restrict kern = (TTF_kern const *) (base + table.offset);
+	/* Apple's version 1 kern tables aren't supported. */
+	if (ru16(kern->version) != 0) return SKR_FAILURE;
+
+	int nTables = ru16(kern->nTables);
+	unsigned long cursor = table.offset + sizeof(TTF_kern);
+	for (int i = 0; i < nTables; ++i) {
+		if (!InsideTable(table, cursor, sizeof(TTF_kern_format0))) return SKR_FAILURE;
+		TTF_kern_format0 const * restrict sub = (TTF_kern_format0 const *) (base + cursor);
+		int coverage = ru16(sub->coverage);
+		int format = coverage >> 8;
+		int direction = coverage & (KERN_HORIZONTAL | KERN_MINIMUM | KERN_CROSS_STREAM);
+		if (format == 0 && direction == KERN_HORIZONTAL) {
+			unsigned long nPairs = ru16(sub->nPairs);
+			if (!InsideTable(table, cursor + sizeof(TTF_kern_format0),
+				nPairs * sizeof(TTF_kern_pair))) return SKR_FAILURE;
+			kerning->source = KERNING_KERN;
+			kerning->sourceOffset = table.offset;
+			kerning->subtables[0] = cursor;
+			kerning->numSubtables = 1;
+			return SKR_SUCCESS;
+		}
+		cursor += ru16(sub->length);
+	}
+	return SKR_FAILURE;
+}
+
+static void AddLookupIndex(int * restrict lookups, int * restrict count, int index)
+{
+	/* keep the list sorted, since lookups have to be applied in order */
+	int i = *count;
+	while (i > 0 && lookups[i - 1] > index) --i;
+	if (i > 0 && lookups[i - 1] == index) return;
+	if (*count >= SKR_MAX_PAIR_SUBTABLES) return;
+	for (int j = *count; j > i; --j) lookups[j] = lookups[j - 1];
+	lookups[i] = index;
+	++*count;
+}
+
+static int ValueRecordSize(int valueFormat)
+{
+	return 2 * __builtin_popcount(valueFormat & 0xFF);
+}
+
+static int CheckCoverage(SKR_TTF_Table table, BYTES1 * base, unsigned long offset)
+{
+	if (!InsideTable(table, offset, 4)) return 0;
+	int format = At16(base + offset);
+	int count = At16(base + offset + 2);
+	if (format == 1) return InsideTableArray(table, offset + 4, count, 2);
+	if (format == 2) return InsideTableArray(table, offset + 4, count, 6);
+	return 0;
+}
+
+static int CheckClassDef(SKR_TTF_Table table, BYTES1 * base, unsigned long offset)
+{
+	if (!InsideTable(table, offset, 4)) return 0;
+	int format = At16(base + offset);
+	if (format == 1) {
+		if (!InsideTable(table, offset, 6)) return 0;
+		return InsideTableArray(table, offset + 6, At16(base + offset + 4), 2);
+	}
+	if (format == 2) return InsideTableArray(table, offset + 4, At16(base + offset + 2), 6);
+	return 0;
+}
+
+/*
+Lookups binary-search straight through coverage, class definitions and
+pair sets without checking anything, so all of them have to be checked
+once, here.
+*/
+static int CheckPairPos(SKR_TTF_Table table, BYTES1 * base, unsigned long offset)
+{
+	if (!InsideTable(table, offset, 10)) return 0;
+	BYTES1 * subtable = base + offset;
+	int posFormat = At16(subtable);
+	if (!CheckCoverage(table, base, offset + At16(subtable + 2))) return 0;
+	int valueFormat1 = At16(subtable + 4);
+	int valueFormat2 = At16(subtable + 6);
+	unsigned long recordSize = ValueRecordSize(valueFormat1) + ValueRecordSize(valueFormat2);
+
+	if (posFormat == 1) {
+		int pairSetCount = At16(subtable + 8);
+		if (!InsideTableArray(table, offset + 10, pairSetCount, 2)) return 0;
+		for (int i = 0; i < pairSetCount; ++i) {
+			unsigned long pairSet = offset + At16(subtable + 10 + 2 * i);
+			if (!InsideTable(table, pairSet, 2)) return 0;
+			if (!InsideTableArray(table, pairSet + 2,
+				At16(base + pairSet), 2 + recordSize)) return 0;
+		}
+		return 1;
+	}
+
+	if (!InsideTable(table, offset, 16)) return 0;
+	if (!CheckClassDef(table, base, offset + At16(subtable + 8))) return 0;
+	if (!CheckClassDef(table, base, offset + At16(subtable + 10))) return 0;
+	unsigned long numClasses = (unsigned long) At16(subtable + 12) * At16(subtable + 14);
+	return InsideTableArray(table, offset + 16, numClasses, recordSize);
+}
+
+/*
+GPOS is a tree of 16-bit offsets, and every one of them gets checked
+against the table before it's followed. Anything malformed makes the
+whole table unusable, so kerning falls back to the kern table.
+*/
+static SKR_Status Locate_GPOS(SKR_Font const * restrict font,
+	SKR_Kerning * restrict kerning)
+{
+	SKR_TTF_Table table;
+	SKR_Status s = FindTable(font, TagFromString("GPOS"), &table);
+	if (s) return s;
+	if (!InsideTable(table, table.offset, sizeof(TTF_GPOS))) return SKR_FAILURE;
+
+	BYTES1 * base = (BYTES1 *) font->data;
+	TTF_GPOS const * restrict gpos = (TTF_GPOS const *) (base + table.offset);
+	if (ru16(gpos->majorVersion) != 1) return SKR_FAILURE;
+
+	/*
+	Scripts and languages are ignored here; every lookup that
+	any 'kern' feature refers to gets used.
+	*/
+	unsigned long featureList = table.offset + ru16(gpos->featureList);
+	if (!InsideTable(table, featureList, 2)) return SKR_FAILURE;
+	int featureCount = At16(base + featureList);
+	if (!InsideTableArray(table, featureList + 2, featureCount, 6)) return SKR_FAILURE;
+	int lookups[SKR_MAX_PAIR_SUBTABLES];
+	int numLookups = 0;
+	for (int i = 0; i < featureCount; ++i) {
+		BYTES1 * record = base + featureList + 2 + 6 * i;
+		if (TagFromString((char const *) record) != TagFromString("kern")) continue;
+		unsigned long feature = featureList + At16(record + 4);
+		if (!InsideTable(table, feature, 4)) return SKR_FAILURE;
+		int lookupIndexCount = At16(base + feature + 2);
+		if (!InsideTableArray(table, feature + 4, lookupIndexCount, 2)) return SKR_FAILURE;
+		for (int j = 0; j < lookupIndexCount; ++j) {
+			AddLookupIndex(lookups, &numLookups, At16(base + feature + 4 + 2 * j));
+		}
+	}
+	if (numLookups == 0) return SKR_FAILURE;
+
+	unsigned long lookupList = table.offset + ru16(gpos->lookupList);
+	if (!InsideTable(table, lookupList, 2)) return SKR_FAILURE;
+	int lookupCount = At16(base + lookupList);
+	if (!InsideTableArray(table, lookupList + 2, lookupCount, 2)) return SKR_FAILURE;
+	kerning->numSubtables = 0;
+	for (int i = 0; i < numLookups; ++i) {
+		if (lookups[i] >= lookupCount) return SKR_FAILURE;
+		unsigned long lookup = lookupList + At16(base + lookupList + 2 + 2 * lookups[i]);
+		if (!InsideTable(table, lookup, 6)) return SKR_FAILURE;
+		int lookupType = At16(base + lookup);
+		int subTableCount = At16(base + lookup + 4);
+		if (!InsideTableArray(table, lookup + 6, subTableCount, 2)) return SKR_FAILURE;
+		for (int j = 0; j < subTableCount; ++j) {
+			unsigned long subtable = lookup + At16(base + lookup + 6 + 2 * j);
+			if (lookupType == LOOKUP_EXTENSION) {
+				if (!InsideTable(table, subtable, 8)) return SKR_FAILURE;
+				if (At16(base + subtable + 2) != LOOKUP_PAIR_POS) continue;
+				unsigned long extension = ru32(*(BYTES4 *) (base + subtable + 4));
+				if (extension > table.length) return SKR_FAILURE;
+				subtable += extension;
+			} else if (lookupType != LOOKUP_PAIR_POS) {
+				continue;
+			}
+			if (!InsideTable(table, subtable, 2)) return SKR_FAILURE;
+			int posFormat = At16(base + subtable);
+			if (posFormat != 1 && posFormat != 2) continue;
+			if (!CheckPairPos(table, base, subtable)) return SKR_FAILURE;
+			if (kerning->numSubtables >= SKR_MAX_PAIR_SUBTABLES) break;
+			kerning->subtables[kerning->numSubtables++] = subtable;
+		}
+	}
+
+	kerning->source = KERNING_GPOS;
+	kerning->sourceOffset = table.offset;
+	return SKR_SUCCESS;
+}
+
+void LocateKerning(SKR_Font const * restrict font, SKR_Kerning * restrict kerning)
+{
+	if (!Locate_GPOS(font, kerning)) return;
+	if (!Locate_kern(font, kerning)) return;
+	kerning->source = KERNING_NONE;
+	kerning->sourceOffset = 0;
+	kerning->numSubtables = 0;
+}
+
+static void RequireKerning(SKR_Font * restrict font)
+{
+	if (!ClaimTable(font, PARSED_KERNING)) return;
+	LocateKerning(font, &font->kerning);
+	PublishTable(font, PARSED_KERNING);
+}
+
+/*
+======== direct lookup ========
+*/
+
+static int ReadXAdvance(BYTES1 * valueRecord, int valueFormat)
+{
+	if (!(valueFormat & VF_X_ADVANCE)) return 0;
+	int skip = 2 * __builtin_popcount(valueFormat & (VF_X_PLACEMENT | VF_Y_PLACEMENT));
+	return AtI16(valueRecord + skip);
+}
+
+static long CoverageIndex(BYTES1 * coverage, Glyph glyph)
+{
+	int format = At16(coverage);
+	int count = At16(coverage + 2);
+	long lower = 0, upper = count;
+	if (format == 1) {
+		while (lower < upper) {
+			long mid = (lower + upper) / 2;
+			Glyph midGlyph = At16(coverage + 4 + 2 * mid);
+			if (midGlyph < glyph) lower = mid + 1;
+			else if (midGlyph > glyph) upper = mid;
+			else return mid;
+		}
+	} else if (format == 2) {
+		while (lower < upper) {
+			long mid = (lower + upper) / 2;
+			BYTES1 * range = coverage + 4 + 6 * mid;
+			if (At16(range + 2) < glyph) lower = mid + 1;
+			else if (At16(range) > glyph) upper = mid;
+			else return At16(range + 4) + (glyph - At16(range));
+		}
+	}
+	return -1;
+}
+
+static int ClassOf(BYTES1 * classDef, Glyph glyph)
+{
+	int format = At16(classDef);
+	if (format == 1) {
+		Glyph startGlyph = At16(classDef + 2);
+		int glyphCount = At16(classDef + 4);
+		if (glyph < startGlyph || glyph - startGlyph >= glyphCount) return 0;
+		return At16(classDef + 6 + 2 * (glyph - startGlyph));
+	} else if (format == 2) {
+		long lower = 0, upper = At16(classDef + 2);
+		while (lower < upper) {
+			long mid = (lower + upper) / 2;
+			BYTES1 * range = classDef + 4 + 6 * mid;
+			if (At16(range + 2) < glyph) lower = mid + 1;
+			else if (At16(range) > glyph) upper = mid;
+			else return At16(range + 4);
+		}
+	}
+	return 0;
+}
+
+/*
+Returns whether the subtable applies to the pair at all.
+In practice fonts keep all of their kerning in one lookup,
+so the first subtable that applies decides.
+*/
+static int LookupPairPos(BYTES1 * subtable, Glyph left, Glyph right, int * restrict value)
+{
+	int posFormat = At16(subtable);
+	long covIndex = CoverageIndex(subtable + At16(subtable + 2), left);
+	if (covIndex < 0) return 0;
+	int valueFormat1 = At16(subtable + 4);
+	int valueFormat2 = At16(subtable + 6);
+	int recordSize = ValueRecordSize(valueFormat1) + ValueRecordSize(valueFormat2);
+
+	if (posFormat == 1) {
+		if (covIndex >= At16(subtable + 8)) return 0;
+		BYTES1 * pairSet = subtable + At16(subtable + 10 + 2 * covIndex);
+		long lower = 0, upper = At16(pairSet);
+		while (lower < upper) {
+			long mid = (lower + upper) / 2;
+			BYTES1 * record = pairSet + 2 + (2 + recordSize) * mid;
+			Glyph second = At16(record);
+			if (second < right) lower = mid + 1;
+			else if (second > right) upper = mid;
+			else {
+				*value = ReadXAdvance(record + 2, valueFormat1);
+				return 1;
+			}
+		}
+		return 0;
+	} else {
+		int class1 = ClassOf(subtable + At16(subtable + 8), left);
+		int class2 = ClassOf(subtable + At16(subtable + 10), right);
+		int class1Count = At16(subtable + 12);
+		int class2Count = At16(subtable + 14);
+		if (class1 >= class1Count || class2 >= class2Count) return 0;
+		BYTES1 * record = subtable + 16 + recordSize * (class1 * class2Count + class2);
+		*value = ReadXAdvance(record, valueFormat1);
+		return 1;
+	}
+}
+
+static int LookupKernPair(BYTES1 * format0, Glyph left, Glyph right)
+{
+	TTF_kern_format0 const * restrict sub = (TTF_kern_format0 const *) format0;
+	TTF_kern_pair const * restrict pairs = (TTF_kern_pair const *) (sub + 1);
+	uint32_t key = (uint32_t) left << 16 | (uint32_t) right;
+	long lower = 0, upper = ru16(sub->nPairs);
+	while (lower < upper) {
+		long mid = (lower + upper) / 2;
+		uint32_t midKey = (uint32_t) ru16(pairs[mid].left) << 16 | ru16(pairs[mid].right);
+		if (midKey < key) lower = mid + 1;
+		else if (midKey > key) upper = mid;
+		else return ri16(pairs[mid].value);
+	}
+	return 0;
+}
+
+static int LookupRawKerning(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning, Glyph left, Glyph right)
+{
+	BYTES1 * base = (BYTES1 *) font->data;
+	switch (kerning->source) {
+	case KERNING_KERN:
+		return LookupKernPair(base + kerning->subtables[0], left, right);
+	case KERNING_GPOS:
+		for (int i = 0; i < kerning->numSubtables; ++i) {
+			int value;
+			if (LookupPairPos(base + kerning->subtables[i], left, right, &value))
+				return value;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+======== pair index ========
+
+The index flattens all subtables into two structures:
+- A hash table of all explicitly listed pairs (kern format 0 and
+  PairPos format 1), remembering which subtable each came from.
+- For every class-based PairPos subtable, the class of every glyph on
+  each side (so coverage and ClassDef lookups become array reads),
+  plus its class-pair matrix of advances.
+- For every glyph, the first class table whose coverage includes it
+  when it's on the left side, so uncovered tables are skipped outright.
+A pair then usually costs one hash probe plus a few array reads.
+*/
+
+typedef struct {
+	uint32_t key;
+	int16_t value;
+	uint16_t subtable;
+} PairEntry;
+
+typedef struct {
+	uint32_t subtable;
+	uint16_t class1Count, class2Count;
+	unsigned long class1Offset, class2Offset, matrixOffset;
+} ClassTable;
+
+typedef struct {
+	uint32_t capacity;
+	uint32_t numClassTables;
+	unsigned long firstTableOffset;
+	ClassTable classTables[SKR_MAX_PAIR_SUBTABLES];
+} KerningIndex;
+
+static uint32_t HashPair(uint32_t key)
+{
+	key ^= key >> 15;
+	key *= 0x2C1B3C6Du;
+	key ^= key >> 12;
+	return key;
+}
+
+static unsigned long CountExplicitPairs(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning)
+{
+	BYTES1 * base = (BYTES1 *) font->data;
+	if (kerning->source == KERNING_KERN) {
+		TTF_kern_format0 const * restrict sub =
+			(TTF_kern_format0 const *) (base + kerning->subtables[0]);
+		return ru16(sub->nPairs);
+	}
+	unsigned long count = 0;
+	for (int i = 0; i < kerning->numSubtables; ++i) {
+		BYTES1 * subtable = base + kerning->subtables[i];
+		if (At16(subtable) != 1) continue;
+		int pairSetCount = At16(subtable + 8);
+		for (int j = 0; j < pairSetCount; ++j) {
+			count += At16(subtable + At16(subtable + 10 + 2 * j));
+		}
+	}
+	return count;
+}
+
+static uint32_t CalcCapacity(unsigned long numPairs)
+{
+	uint32_t capacity = 2;
+	while (capacity < 2 * numPairs) capacity *= 2;
+	return capacity;
+}
+
+unsigned long CalcKerningIndexSize(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning)
+{
+	unsigned long size = AlignSize(sizeof(KerningIndex));
+	size += AlignSize(CalcCapacity(CountExplicitPairs(font, kerning)) * sizeof(PairEntry));
+	size += AlignSize(font->numGlyphs * sizeof(uint8_t));
+	if (kerning->source != KERNING_GPOS) return size;
+	BYTES1 * base = (BYTES1 *) font->data;
+	for (int i = 0; i < kerning->numSubtables; ++i) {
+		BYTES1 * subtable = base + kerning->subtables[i];
+		if (At16(subtable) != 2) continue;
+		unsigned long numClasses = (unsigned long) At16(subtable + 12) * At16(subtable + 14);
+		size += 2 * AlignSize(font->numGlyphs * sizeof(uint16_t));
+		size += AlignSize(numClasses * sizeof(int16_t));
+	}
+	return size;
+}
+
+static void InsertPair(KerningIndex * restrict index, Glyph left, Glyph right,
+	int value, int subtable)
+{
+	PairEntry * restrict entries = (PairEntry *) ((BYTES1 *) index +
+		AlignSize(sizeof(KerningIndex)));
+	uint32_t key = (uint32_t) left << 16 | (uint32_t) right;
+	uint32_t mask = index->capacity - 1;
+	uint32_t slot = HashPair(key) & mask;
+	while (entries[slot].key != EMPTY_KEY) {
+		/* earlier subtables take precedence */
+		if (entries[slot].key == key) return;
+		slot = (slot + 1) & mask;
+	}
+	entries[slot] = (PairEntry) { key, value, subtable };
+}
+
+static void FlattenClassTable(SKR_Font const * restrict font, BYTES1 * subtable,
+	ClassTable * restrict table, BYTES1 * indexAddr)
+{
+	uint16_t * restrict class1 = (uint16_t *) (indexAddr + table->class1Offset);
+	uint16_t * restrict class2 = (uint16_t *) (indexAddr + table->class2Offset);
+	int16_t * restrict matrix = (int16_t *) (indexAddr + table->matrixOffset);
+	BYTES1 * coverage = subtable + At16(subtable + 2);
+	BYTES1 * classDef1 = subtable + At16(subtable + 8);
+	BYTES1 * classDef2 = subtable + At16(subtable + 10);
+
+	/* class 0 in class1 means 'not covered', so everything is shifted by one */
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		int c1 = ClassOf(classDef1, glyph);
+		int covered = CoverageIndex(coverage, glyph) >= 0;
+		class1[glyph] = covered && c1 < table->class1Count ? c1 + 1 : 0;
+		int c2 = ClassOf(classDef2, glyph);
+		class2[glyph] = c2 < table->class2Count ? c2 : NO_SUBTABLE;
+	}
+
+	int valueFormat1 = At16(subtable + 4);
+	int valueFormat2 = At16(subtable + 6);
+	int recordSize = ValueRecordSize(valueFormat1) + ValueRecordSize(valueFormat2);
+	unsigned long numClasses = (unsigned long) table->class1Count * table->class2Count;
+	for (unsigned long i = 0; i < numClasses; ++i) {
+		matrix[i] = ReadXAdvance(subtable + 16 + recordSize * i, valueFormat1);
+	}
+}
+
+void BuildKerningIndex(SKR_Font const * restrict font,
+	SKR_Kerning const * restrict kerning, void * restrict memory)
+{
+	BYTES1 * base = (BYTES1 *) font->data;
+	KerningIndex * restrict index = (KerningIndex *) memory;
+	index->capacity = CalcCapacity(CountExplicitPairs(font, kerning));
+	index->numClassTables = 0;
+
+	PairEntry * restrict entries = (PairEntry *) ((BYTES1 *) memory +
+		AlignSize(sizeof(KerningIndex)));
+	for (uint32_t i = 0; i < index->capacity; ++i) {
+		entries[i] = (PairEntry) { EMPTY_KEY, 0, NO_SUBTABLE };
+	}
+	unsigned long cursor = AlignSize(sizeof(KerningIndex)) +
+		AlignSize(index->capacity * sizeof(PairEntry));
+	index->firstTableOffset = cursor;
+	uint8_t * restrict firstTable = (uint8_t *) memory + cursor;
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		firstTable[glyph] = NO_CLASS_TABLE;
+	}
+	cursor += AlignSize(font->numGlyphs * sizeof(uint8_t));
+
+	if (kerning->source == KERNING_KERN) {
+		TTF_kern_format0 const * restrict sub =
+			(TTF_kern_format0 const *) (base + kerning->subtables[0]);
+		TTF_kern_pair const * restrict pairs = (TTF_kern_pair const *) (sub + 1);
+		int nPairs = ru16(sub->nPairs);
+		for (int i = 0; i < nPairs; ++i) {
+			InsertPair(index, ru16(pairs[i].left), ru16(pairs[i].right),
+				ri16(pairs[i].value), 0);
+		}
+		return;
+	}
+
+	for (int i = 0; i < kerning->numSubtables; ++i) {
+		BYTES1 * subtable = base + kerning->subtables[i];
+		if (At16(subtable) == 1) {
+			BYTES1 * coverage = subtable + At16(subtable + 2);
+			int valueFormat1 = At16(subtable + 4);
+			int valueFormat2 = At16(subtable + 6);
+			int recordSize = ValueRecordSize(valueFormat1) + ValueRecordSize(valueFormat2);
+			int pairSetCount = At16(subtable + 8);
+			/* walk the coverage to recover the first glyph of every pair set */
+			for (Glyph left = 0; left < font->numGlyphs; ++left) {
+				long covIndex = CoverageIndex(coverage, left);
+				if (covIndex < 0 || covIndex >= pairSetCount) continue;
+				BYTES1 * pairSet = subtable + At16(subtable + 10 + 2 * covIndex);
+				int pairValueCount = At16(pairSet);
+				for (int j = 0; j < pairValueCount; ++j) {
+					BYTES1 * record = pairSet + 2 + (2 + recordSize) * j;
+					InsertPair(index, left, At16(record),
+						ReadXAdvance(record + 2, valueFormat1), i);
+				}
+			}
+		} else {
+			ClassTable * restrict table = &index->classTables[index->numClassTables++];
+			table->subtable = i;
+			table->class1Count = At16(subtable + 12);
+			table->class2Count = At16(subtable + 14);
+			table->class1Offset = cursor;
+			cursor += AlignSize(font->numGlyphs * sizeof(uint16_t));
+			table->class2Offset = cursor;
+			cursor += AlignSize(font->numGlyphs * sizeof(uint16_t));
+			table->matrixOffset = cursor;
+			cursor += AlignSize((unsigned long) table->class1Count *
+				table->class2Count * sizeof(int16_t));
+			FlattenClassTable(font, subtable, table, (BYTES1 *) memory);
+
+			uint16_t const * restrict class1 = (uint16_t const *)
+				((BYTES1 *) memory + table->class1Offset);
+			for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+				if (class1[glyph] != 0 && firstTable[glyph] == NO_CLASS_TABLE)
+					firstTable[glyph] = index->numClassTables - 1;
+			}
+		}
+	}
+
+	SKR_assert(cursor == CalcKerningIndexSize(font, kerning));
+}
+
+/*
+A font cache may come from disk, so nothing in the index is taken on
+trust: every part has to fit, the hash table needs an empty slot to end
+its probes, and the classes have to lie within their matrices.
+*/
+int CheckKerningIndex(void const * restrict memory, unsigned long size, unsigned long numGlyphs)
+{
+	BYTES1 * indexAddr = (BYTES1 *) memory;
+	KerningIndex const * restrict index = (KerningIndex const *) memory;
+	if (size < AlignSize(sizeof(KerningIndex))) return 0;
+
+	uint32_t capacity = index->capacity;
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0) return 0;
+	if (!RangeFits(AlignSize(sizeof(KerningIndex)), capacity, sizeof(PairEntry), size)) return 0;
+	PairEntry const * restrict entries = (PairEntry const *) (indexAddr +
+		AlignSize(sizeof(KerningIndex)));
+	int hasEmpty = 0;
+	for (uint32_t i = 0; i < capacity; ++i) {
+		hasEmpty |= entries[i].key == EMPTY_KEY;
+	}
+	if (!hasEmpty) return 0;
+
+	if (!RangeFits(index->firstTableOffset, numGlyphs, sizeof(uint8_t), size)) return 0;
+	if (index->numClassTables > SKR_MAX_PAIR_SUBTABLES) return 0;
+	for (uint32_t i = 0; i < index->numClassTables; ++i) {
+		ClassTable const * restrict table = &index->classTables[i];
+		unsigned long numClasses = (unsigned long) table->class1Count * table->class2Count;
+		if (!RangeFits(table->class1Offset, numGlyphs, sizeof(uint16_t), size)) return 0;
+		if (!RangeFits(table->class2Offset, numGlyphs, sizeof(uint16_t), size)) return 0;
+		if (!RangeFits(table->matrixOffset, numClasses, sizeof(int16_t), size)) return 0;
+		uint16_t const * restrict class1 = (uint16_t const *) (indexAddr + table->class1Offset);
+		uint16_t const * restrict class2 = (uint16_t const *) (indexAddr + table->class2Offset);
+		for (unsigned long glyph = 0; glyph < numGlyphs; ++glyph) {
+			if (class1[glyph] > table->class1Count) return 0;
+			if (class2[glyph] != NO_SUBTABLE && class2[glyph] >= table->class2Count) return 0;
+		}
+	}
+	return 1;
+}
+
+static int LookupCachedKerning(void const * restrict memory, Glyph left, Glyph right)
+{
+	BYTES1 * indexAddr = (BYTES1 *) memory;
+	KerningIndex const * restrict index = (KerningIndex const *) memory;
+	PairEntry const * restrict entries = (PairEntry const *) (indexAddr +
+		AlignSize(sizeof(KerningIndex)));
+
+	uint32_t key = (uint32_t) left << 16 | (uint32_t) right;
+	uint32_t mask = index->capacity - 1;
+	uint32_t slot = HashPair(key) & mask;
+	while (entries[slot].key != key && entries[slot].key != EMPTY_KEY) {
+		slot = (slot + 1) & mask;
+	}
+	PairEntry entry = entries[slot];
+
+	uint32_t first = (indexAddr + index->firstTableOffset)[left];
+	if (first == NO_CLASS_TABLE) return entry.value;
+	for (uint32_t i = first; i < index->numClassTables; ++i) {
+		ClassTable const * restrict table = &index->classTables[i];
+		if (table->subtable >= entry.subtable) break;
+		int c1 = ((uint16_t const *) (indexAddr + table->class1Offset))[left];
+		if (c1 == 0) continue;
+		int c2 = ((uint16_t const *) (indexAddr + table->class2Offset))[right];
+		if (c2 == NO_SUBTABLE) continue;
+		int16_t const * restrict matrix = (int16_t const *) (indexAddr + table->matrixOffset);
+		return matrix[(c1 - 1) * table->class2Count + c2];
+	}
+
+	return entry.value;
+}
+
+SKR_Status skrGetKerning(SKR_Font * restrict font,
+	Glyph left, Glyph right, float * restrict kerning)
+{
+	if (!(left < font->numGlyphs && right < font->numGlyphs)) return SKR_FAILURE;
+	int value;
+	if (font->cachedKerning != 0) {
+		value = LookupCachedKerning(font->cachedKerning, left, right);
+	} else {
+		RequireKerning(font);
+		value = LookupRawKerning(font, &font->kerning, left, right);
+	}
+	*kerning = (float) value / font->unitsPerEm;
+	return SKR_SUCCESS;
+}
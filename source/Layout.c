@@ -0,0 +1,394 @@
+#include "Internals.h"
+
+#include <float.h>
+
+/*
+======== line breaking ========
+*/
+
+float skrGetLineHeight(SKR_Font const * restrict font, float size)
+{
+	float units = font->ascender - font->descender + font->lineGap;
+	return units / font->unitsPerEm * size;
+}
+
+/*
+Breaks a single line off the text, starting at byte start.
+The outcome depends on nothing but the text from start onwards,
+which is what makes incremental relayout possible.
+*/
+static SKR_Status BreakLine(SKR_Font * restrict font,
+	BYTES1 * restrict text, unsigned long length,
+	SKR_ParagraphStyle const * restrict style,
+	unsigned long start, SKR_Line * restrict line)
+{
+	SKR_Line lastBreak = { 0 };
+	int haveBreak = 0;
+	unsigned long pos = start, visibleEnd = start;
+	float x = 0.0f, visibleWidth = 0.0f;
+	Glyph prevGlyph = -1;
+
+	while (pos < length) {
+		int32_t code;
+		int sequence = DecodeSequenceUTF8(text + pos, length - pos, &code);
+		if (sequence <= 0) return SKR_FAILURE;
+
+		if (code == '\n') {
+			*line = (SKR_Line) { start, visibleEnd, pos + 1, visibleWidth };
+			return SKR_SUCCESS;
+		}
+
+		Glyph glyph = skrGlyphFromCode(font, code);
+		SKR_HorMetrics metrics;
+		SKR_Status s = skrGetHorMetrics(font, glyph, &metrics);
+		if (s) return s;
+		float advance = metrics.advanceWidth;
+		if (prevGlyph >= 0) {
+			float kerning;
+			s = skrGetKerning(font, prevGlyph, glyph, &kerning);
+			if (s) return s;
+			advance += kerning;
+		}
+		advance *= style->size;
+
+		if (code == ' ') {
+			/* spaces may hang past the end of the line */
+			if (visibleEnd == pos) {
+				lastBreak = (SKR_Line) { start, pos, 0, visibleWidth };
+				haveBreak = 1;
+			}
+			x += advance;
+			pos += sequence;
+			lastBreak.next = pos;
+		} else {
+			if (style->width > 0.0f && x + advance > style->width && pos > start) {
+				if (haveBreak) {
+					*line = lastBreak;
+				} else {
+					/* the word alone is too long, so cut it right here */
+					*line = (SKR_Line) { start, pos, pos, x };
+				}
+				return SKR_SUCCESS;
+			}
+			x += advance;
+			pos += sequence;
+			visibleEnd = pos;
+			visibleWidth = x;
+		}
+		prevGlyph = glyph;
+	}
+
+	*line = (SKR_Line) { start, visibleEnd, length, visibleWidth };
+	return SKR_SUCCESS;
+}
+
+/*
+A newline at the very end of the text is followed by one more, empty line.
+*/
+static int IsLastLine(BYTES1 * restrict text, unsigned long length,
+	SKR_Line const * restrict line)
+{
+	if (line->next < length) return 0;
+	return line->next == line->start || text[line->next - 1] != '\n';
+}
+
+SKR_Status skrBreakLines(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length,
+	SKR_ParagraphStyle const * restrict style,
+	SKR_Line * restrict lines, int capacity, int * restrict count)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	unsigned long start = 0;
+	*count = 0;
+	for (;;) {
+		if (*count >= capacity) return SKR_FAILURE;
+		SKR_Line * restrict line = &lines[*count];
+		SKR_Status s = BreakLine(font, bytes, length, style, start, line);
+		if (s) return s;
+		++*count;
+		if (IsLastLine(bytes, length, line)) break;
+		start = line->next;
+	}
+	return SKR_SUCCESS;
+}
+
+/* Index of the line that holds byte pos. */
+static int FindLine(SKR_Line const * restrict lines, int count, unsigned long pos)
+{
+	int low = 0, high = count - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (lines[mid].start <= pos) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+/*
+The old lines after the edit get moved to the back of the array,
+and the new ones are broken into the gap in front of them.
+As soon as a new line ends where an old line past the edit began,
+the text that follows is the same as before, and so are its lines.
+*/
+SKR_Status skrRebreakLines(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length,
+	SKR_ParagraphStyle const * restrict style, SKR_TextEdit edit,
+	SKR_Line * restrict lines, int capacity, int * restrict count,
+	int * restrict first, int * restrict rebuilt)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	if (*count <= 0) {
+		*first = 0;
+		SKR_Status s = skrBreakLines(font, text, length, style, lines, capacity, count);
+		*rebuilt = *count;
+		return s;
+	}
+
+	/*
+	An edit may pull the start of its line back onto the line above.
+	If that line was cut in the middle of a word, the word decided where
+	the line before it broke as well, so back up to where the word starts.
+	*/
+	int n = FindLine(lines, *count, edit.position);
+	if (n > 0) --n;
+	while (n > 0 && lines[n].end == lines[n].next) --n;
+	*first = n;
+
+	int tail = capacity - (*count - n - 1);
+	for (int i = *count - 1; i > n; --i) {
+		lines[tail + i - n - 1] = lines[i];
+	}
+
+	unsigned long oldEnd = edit.position + edit.removed;
+	unsigned long delta = edit.inserted - edit.removed;
+	unsigned long start = lines[n].start;
+	for (;;) {
+		if (n >= tail) return SKR_FAILURE;
+		SKR_Line * restrict line = &lines[n];
+		SKR_Status s = BreakLine(font, bytes, length, style, start, line);
+		if (s) return s;
+		++n;
+		if (IsLastLine(bytes, length, line)) {
+			tail = capacity;
+			break;
+		}
+		start = line->next;
+
+		while (tail < capacity &&
+			(lines[tail].start < oldEnd || lines[tail].start + delta < start)) ++tail;
+		if (tail < capacity && lines[tail].start + delta == start) break;
+	}
+	*rebuilt = n - *first;
+
+	for (; tail < capacity; ++tail, ++n) {
+		SKR_Line line = lines[tail];
+		line.start += delta;
+		line.end += delta;
+		line.next += delta;
+		lines[n] = line;
+	}
+	*count = n;
+	return SKR_SUCCESS;
+}
+
+/*
+======== line assembly ========
+*/
+
+SKR_Status skrAssembleLine(SKR_Font * restrict font, char const * restrict text,
+	SKR_ParagraphStyle const * restrict style, SKR_Line const * restrict lines,
+	int index, SKR_Assembly * restrict assembly, int capacity, int * restrict count)
+{
+	SKR_Line const line = lines[index];
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	if (style->width > 0.0f) {
+		switch (style->alignment) {
+		case SKR_ALIGN_LEFT: break;
+		case SKR_ALIGN_CENTER: state.x = (style->width - line.width) / 2.0f; break;
+		case SKR_ALIGN_RIGHT: state.x = style->width - line.width; break;
+		}
+	}
+
+	unsigned long length = line.end - line.start;
+	SKR_Status s = skrAssembleUTF8(font, text + line.start, length, style->size,
+		&state, assembly, capacity, count);
+	if (s) return s;
+	if (state.position < length) return SKR_FAILURE;
+
+	float y = -index * skrGetLineHeight(font, style->size);
+	for (int i = 0; i < *count; ++i) {
+		assembly[i].y = y;
+	}
+	return SKR_SUCCESS;
+}
+
+/*
+======== measuring ========
+*/
+
+/* How many glyphs get converted at once while measuring. */
+#define MEASURE_BLOCK 64
+
+/* Only valid for sequences that have already been decoded once. */
+static int SequenceLength(int lead)
+{
+	return lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+}
+
+SKR_Status skrMeasureUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_TextMetrics * restrict metrics)
+{
+	Glyph glyphs[MEASURE_BLOCK];
+	float advances[MEASURE_BLOCK];
+	float const scale = size / font->unitsPerEm;
+	float x = 0.0f;
+	float xMin = FLT_MAX, yMin = FLT_MAX, xMax = -FLT_MAX, yMax = -FLT_MAX;
+	Glyph prevGlyph = -1;
+	unsigned long pos = 0;
+	while (pos < length) {
+		unsigned long got, consumed;
+		SKR_Status s = skrGlyphsFromUTF8(font, text + pos, length - pos,
+			glyphs, advances, MEASURE_BLOCK, &got, &consumed);
+		if (s) return s;
+		/* the text ends in the middle of a sequence */
+		if (got == 0) return SKR_FAILURE;
+
+		for (unsigned long i = 0; i < got; ++i) {
+			if (prevGlyph >= 0) {
+				float kerning;
+				s = skrGetKerning(font, prevGlyph, glyphs[i], &kerning);
+				if (s) return s;
+				x += kerning * size;
+			}
+			int16_t box[4];
+			s = GetGlyphBox(font, glyphs[i], box);
+			if (s) return s;
+			if (box[0] <= box[2]) {
+				xMin = min(xMin, x + box[0] * scale);
+				yMin = min(yMin, box[1] * scale);
+				xMax = max(xMax, x + box[2] * scale);
+				yMax = max(yMax, box[3] * scale);
+			}
+			x += advances[i] * size;
+			prevGlyph = glyphs[i];
+		}
+		pos += consumed;
+	}
+
+	metrics->advance = x;
+	metrics->ascent = font->ascender * scale;
+	metrics->descent = font->descender * scale;
+	metrics->xMin = xMin, metrics->yMin = yMin;
+	metrics->xMax = xMax, metrics->yMax = yMax;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrMeasureCaretsUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	SKR_Caret * restrict carets, unsigned long capacity, unsigned long * restrict count)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	Glyph glyphs[MEASURE_BLOCK];
+	float advances[MEASURE_BLOCK];
+	float pen = 0.0f;
+	Glyph prevGlyph = -1;
+	unsigned long pos = 0, n = 0;
+	while (pos < length) {
+		unsigned long got, consumed;
+		SKR_Status s = skrGlyphsFromUTF8(font, text + pos, length - pos,
+			glyphs, advances, MEASURE_BLOCK, &got, &consumed);
+		if (s) return s;
+		if (got == 0) return SKR_FAILURE;
+
+		unsigned long byte = pos;
+		for (unsigned long i = 0; i < got; ++i) {
+			if (prevGlyph >= 0) {
+				float kerning;
+				s = skrGetKerning(font, prevGlyph, glyphs[i], &kerning);
+				if (s) return s;
+				pen += kerning * size;
+			}
+			if (n < capacity) carets[n] = (SKR_Caret) { pen, byte };
+			++n;
+			pen += advances[i] * size;
+			byte += SequenceLength(bytes[byte]);
+			prevGlyph = glyphs[i];
+		}
+		pos += consumed;
+	}
+	if (n < capacity) carets[n] = (SKR_Caret) { pen, length };
+	*count = ++n;
+	return n <= capacity ? SKR_SUCCESS : SKR_FAILURE;
+}
+
+/*
+x belongs to the caret whose neighbours' midpoints enclose it,
+which assumes the carets run left to right.
+*/
+unsigned long skrHitTestCarets(SKR_Caret const * restrict carets,
+	unsigned long count, float x)
+{
+	if (count == 0) return 0;
+	/* the first caret whose midpoint with the next one lies past x */
+	unsigned long lo = 0, hi = count - 1;
+	while (lo < hi) {
+		unsigned long mid = lo + (hi - lo) / 2;
+		if (x < (carets[mid].x + carets[mid + 1].x) / 2.0f) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return carets[lo].offset;
+}
+
+/*
+Same rule as skrHitTestCarets(): the caret in front of a glyph wins
+while x lies before the midpoint between it and the next caret.
+*/
+SKR_Status skrHitTestUTF8(SKR_Font * restrict font,
+	char const * restrict text, unsigned long length, float size,
+	float x, unsigned long * restrict offset)
+{
+	BYTES1 * restrict bytes = (BYTES1 *) text;
+	Glyph glyphs[MEASURE_BLOCK];
+	float advances[MEASURE_BLOCK];
+	float pen = 0.0f, caret = 0.0f;
+	unsigned long caretByte = 0;
+	Glyph prevGlyph = -1;
+	unsigned long pos = 0;
+	while (pos < length) {
+		unsigned long got, consumed;
+		SKR_Status s = skrGlyphsFromUTF8(font, text + pos, length - pos,
+			glyphs, advances, MEASURE_BLOCK, &got, &consumed);
+		if (s) return s;
+		if (got == 0) return SKR_FAILURE;
+
+		unsigned long byte = pos;
+		for (unsigned long i = 0; i < got; ++i) {
+			if (prevGlyph >= 0) {
+				float kerning;
+				s = skrGetKerning(font, prevGlyph, glyphs[i], &kerning);
+				if (s) return s;
+				pen += kerning * size;
+				if (x < (caret + pen) / 2.0f) {
+					*offset = caretByte;
+					return SKR_SUCCESS;
+				}
+				caret = pen;
+				caretByte = byte;
+			}
+			pen += advances[i] * size;
+			byte += SequenceLength(bytes[byte]);
+			prevGlyph = glyphs[i];
+		}
+		pos += consumed;
+	}
+	*offset = x < (caret + pen) / 2.0f ? caretByte : length;
+	return SKR_SUCCESS;
+}
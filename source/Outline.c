@@ -1,16 +1,17 @@
 #include "Internals.h"
 
+#include <float.h>
 #include <limits.h>
+#include <immintrin.h> // TODO MSVC
 
 void DrawLine(Workspace * restrict ws, Line line);
 void DrawCurve(Workspace * restrict ws, Curve initialCurve);
-uint32_t CalcRasterWidth(SKR_Dimensions dims);
 
 /*
 ======== glyph positioning ========
 */
 
-SKR_Status skrGetHorMetrics(SKR_Font const * restrict font,
+SKR_Status GetRawHorMetrics(SKR_Font const * restrict font,
 	Glyph glyph, SKR_HorMetrics * restrict metrics)
 {
 	if (!(glyph < font->numGlyphs)) return SKR_FAILURE;
@@ -28,6 +29,20 @@ SKR_Status skrGetHorMetrics(SKR_Font const * restrict font,
 	}
 }
 
+SKR_Status skrGetHorMetrics(SKR_Font const * restrict font,
+	Glyph glyph, SKR_HorMetrics * restrict metrics)
+{
+	if (!(glyph < font->numGlyphs)) return SKR_FAILURE;
+	if (font->instance != 0) {
+		return GetInstancedHorMetrics(font->instance, glyph, metrics);
+	}
+	if (font->cachedMetrics != 0) {
+		*metrics = font->cachedMetrics[glyph];
+		return SKR_SUCCESS;
+	}
+	return GetRawHorMetrics(font, glyph, metrics);
+}
+
 /*
 ======== character mapping ========
 */
@@ -35,40 +50,46 @@ SKR_Status skrGetHorMetrics(SKR_Font const * restrict font,
 static int FindSegment_Format4(int segCount,
 	BYTES2 * restrict startCodes, BYTES2 * restrict endCodes, int charCode)
 {
-	/*
-	TODO upgrade to binary search here.
-	Right now this is linear search because there's less stuff that can go wrong with it.
-	*/
-	SKR_assert(charCode <= USHRT_MAX);
-	for (int i = 0; i < segCount; ++i) {
-		int endCode = ru16(endCodes[i]);
-		if (endCode < charCode) continue;
-
-		int startCode = ru16(startCodes[i]);
-		if (startCode > charCode) return -1;
-
-		return i;
+	if (charCode < 0 || charCode > USHRT_MAX) return -1;
+	/* endCodes are sorted, so look for the first segment ending at or after charCode. */
+	int lower = 0, upper = segCount;
+	while (lower < upper) {
+		int mid = (lower + upper) / 2;
+		if (ru16(endCodes[mid]) < charCode) {
+			lower = mid + 1;
+		} else {
+			upper = mid;
+		}
 	}
-	return -1;
+	if (lower >= segCount) return -1;
+	if (ru16(startCodes[lower]) > charCode) return -1;
+	return lower;
 }
 
-static Glyph GlyphFromCode_Format4(SKR_Font const * restrict font, int charCode)
+typedef struct {
+	BYTES2 * startCodes;
+	BYTES2 * endCodes;
+	BYTES2 * idDeltas;
+	BYTES2 * idRangeOffsets;
+} Arrays_Format4;
+
+static Arrays_Format4 GetArrays_Format4(SKR_Font const * restrict font)
 {
 	SKR_cmap_format4 const * restrict mapping = &font->mapping.format4;
-	BYTES2 * startCodes = (BYTES2 *) ((BYTES1 *) font->data + mapping->startCodes);
-	BYTES2 * endCodes = (BYTES2 *) ((BYTES1 *) font->data + mapping->endCodes);
-	BYTES2 * idDeltas = (BYTES2 *) ((BYTES1 *) font->data + mapping->idDeltas);
-	BYTES2 * idRangeOffsets = (BYTES2 *) ((BYTES1 *) font->data + mapping->idRangeOffsets);
-
-	int segment = FindSegment_Format4(mapping->segCount, startCodes, endCodes, charCode);
-
-	if (segment < 0) {
-		return 0;
-	}
+	BYTES1 * base = (BYTES1 *) font->data;
+	return (Arrays_Format4) {
+		(BYTES2 *) (base + mapping->startCodes),
+		(BYTES2 *) (base + mapping->endCodes),
+		(BYTES2 *) (base + mapping->idDeltas),
+		(BYTES2 *) (base + mapping->idRangeOffsets) };
+}
 
-	int startCode = ru16(startCodes[segment]);
-	int idDelta = ru16(idDeltas[segment]);
-	int idRangeOffset = ru16(idRangeOffsets[segment]);
+static Glyph GlyphInSegment_Format4(Arrays_Format4 const * restrict arrays,
+	int segment, int charCode)
+{
+	int startCode = ru16(arrays->startCodes[segment]);
+	int idDelta = ru16(arrays->idDeltas[segment]);
+	int idRangeOffset = ru16(arrays->idRangeOffsets[segment]);
 
 	if (idRangeOffset == 0) {
 		return (uint16_t) (charCode + idDelta);
@@ -76,11 +97,53 @@ static Glyph GlyphFromCode_Format4(SKR_Font const * restrict font, int charCode)
 
 	SKR_assert(idRangeOffset % 2 == 0);
 
-	BYTES2 * glyphAddr = &idRangeOffsets[segment] + idRangeOffset / 2 + (charCode - startCode);
+	BYTES2 * glyphAddr = &arrays->idRangeOffsets[segment] + idRangeOffset / 2 + (charCode - startCode);
 	Glyph glyph = ru16(*glyphAddr);
 	return glyph > 0 ? (uint16_t) (glyph + idDelta) : 0;
 }
 
+static Glyph GlyphFromCode_Format4(SKR_Font const * restrict font, int charCode)
+{
+	Arrays_Format4 arrays = GetArrays_Format4(font);
+	int segment = FindSegment_Format4(font->mapping.format4.segCount,
+		arrays.startCodes, arrays.endCodes, charCode);
+	if (segment < 0) {
+		return 0;
+	}
+	return GlyphInSegment_Format4(&arrays, segment, charCode);
+}
+
+/*
+Text tends to stay within a few segments (say, lowercase latin letters),
+so when mapping many characters at once, the last segment is remembered
+and only searched for again when a character falls outside of it.
+*/
+static void GlyphsFromCodes_Format4(SKR_Font const * restrict font,
+	int32_t const * restrict codes, Glyph * restrict glyphs, unsigned long count)
+{
+	Arrays_Format4 arrays = GetArrays_Format4(font);
+	int segment = -1;
+	int startCode = 1, endCode = 0;
+	for (unsigned long i = 0; i < count; ++i) {
+		int32_t code = codes[i];
+		if ((unsigned long) code < font->numCachedCodes) {
+			glyphs[i] = font->cachedGlyphs[code];
+			continue;
+		}
+		if (!(startCode <= code && code <= endCode)) {
+			segment = FindSegment_Format4(font->mapping.format4.segCount,
+				arrays.startCodes, arrays.endCodes, code);
+			if (segment < 0) {
+				glyphs[i] = 0;
+				continue;
+			}
+			startCode = ru16(arrays.startCodes[segment]);
+			endCode = ru16(arrays.endCodes[segment]);
+		}
+		glyphs[i] = GlyphInSegment_Format4(&arrays, segment, code);
+	}
+}
+
 static Glyph GlyphFromCode_Format6(SKR_Font const * restrict font, unsigned int charCode)
 {
 	SKR_cmap_format6 const * restrict mapping = &font->mapping.format6;
@@ -92,7 +155,7 @@ static Glyph GlyphFromCode_Format6(SKR_Font const * restrict font, unsigned int
 	return ru16(glyphIndexArray[relCode]);
 }
 
-Glyph skrGlyphFromCode(SKR_Font const * restrict font, int charCode)
+Glyph GetRawGlyphFromCode(SKR_Font const * restrict font, int charCode)
 {
 	switch (font->mappingFormat) {
 	case 4:
@@ -105,6 +168,26 @@ Glyph skrGlyphFromCode(SKR_Font const * restrict font, int charCode)
 	}
 }
 
+Glyph skrGlyphFromCode(SKR_Font const * restrict font, int charCode)
+{
+	if ((unsigned long) charCode < font->numCachedCodes) {
+		return font->cachedGlyphs[charCode];
+	}
+	return GetRawGlyphFromCode(font, charCode);
+}
+
+void GlyphsFromCodes(SKR_Font const * restrict font,
+	int32_t const * restrict codes, Glyph * restrict glyphs, unsigned long count)
+{
+	if (font->mappingFormat == 4) {
+		GlyphsFromCodes_Format4(font, codes, glyphs, count);
+		return;
+	}
+	for (unsigned long i = 0; i < count; ++i) {
+		glyphs[i] = skrGlyphFromCode(font, codes[i]);
+	}
+}
+
 /*
 ======== outlines ========
 */
@@ -134,8 +217,10 @@ typedef struct {
 
 typedef struct {
 	unsigned int state;
+	int lineQueued;
 	Point queuedStart;
 	Point queuedPivot;
+	Point queuedEnd;
 	Point looseEnd;
 
 	RasterCell * raster;
@@ -154,17 +239,14 @@ typedef struct {
 	BYTES2 yMax;
 } ShHdr;
 
-typedef struct {
-	BYTES1 * lowerBound, * upperBound;
-} MemRange;
-
-static SKR_Status GetOutlineRange(SKR_Font const * restrict font,
+SKR_Status GetRawOutlineRange(SKR_Font const * restrict font,
 	Glyph glyph, MemRange * restrict range)
 {
 	void const * locaAddr = (BYTES1 *) font->data + font->loca.offset;
 	BYTES1 * glyfAddr = (BYTES1 *) font->data + font->glyf.offset;
 	int n = font->numGlyphs + 1;
 	if (!(glyph < n)) return SKR_FAILURE;
+	if (font->loca.length == 0) return SKR_FAILURE;
 	if (!font->indexToLocFormat) {
 		BYTES2 * loca = (BYTES2 *) locaAddr;
 		range->lowerBound = glyfAddr + 2 * (unsigned long) ru16(loca[glyph]);
@@ -174,32 +256,106 @@ static SKR_Status GetOutlineRange(SKR_Font const * restrict font,
 		range->lowerBound = glyfAddr + ru32(loca[glyph]);
 		range->upperBound = glyfAddr + ru32(loca[glyph + 1]);
 	}
+	range->dataEnd = (BYTES1 *) font->data + font->length;
 	return SKR_SUCCESS;
 }
 
-SKR_Status skrGetOutlineBounds(SKR_Font const * restrict font, Glyph glyph,
-	SKR_Transform transform, SKR_Bounds * restrict bounds)
+static SKR_Status GetOutlineRange(SKR_Font const * restrict font,
+	Glyph glyph, MemRange * restrict range)
+{
+	if (font->instance != 0) {
+		return GetInstancedOutlineRange(font->instance, glyph, range);
+	}
+	return GetRawOutlineRange(font, glyph, range);
+}
+
+SKR_Status LoadGlyphBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4])
 {
-	/* TODO return empty bounds in case glyf length is zero */
 	SKR_Status s;
+	if (font->cff.version != 0) return LoadCharstringBox(font, glyph, box);
 	MemRange range;
 	s = GetOutlineRange(font, glyph, &range);
 	if (s) return s;
 	if (range.upperBound == range.lowerBound) {
-		*bounds = (SKR_Bounds) { 0, 0, 0, 0 }; // TODO get rid of this
+		box[0] = box[1] = INT16_MAX;
+		box[2] = box[3] = INT16_MIN;
 		return SKR_SUCCESS;
 	}
 	if ((unsigned long) (range.upperBound - range.lowerBound) < sizeof(ShHdr)) return SKR_FAILURE;
 	ShHdr const * restrict sh = (ShHdr const *) range.lowerBound;
+	box[0] = ri16(sh->xMin);
+	box[1] = ri16(sh->yMin);
+	box[2] = ri16(sh->xMax);
+	box[3] = ri16(sh->yMax);
+	return SKR_SUCCESS;
+}
 
-	transform.xScale /= font->unitsPerEm;
-	transform.yScale /= font->unitsPerEm;
+SKR_Status GetGlyphBox(SKR_Font const * restrict font,
+	Glyph glyph, int16_t box[4])
+{
+	if (font->cachedBoxes != 0 && glyph < font->numGlyphs) {
+		int16_t const * restrict cached = &font->cachedBoxes[4 * glyph];
+		box[0] = cached[0], box[1] = cached[1];
+		box[2] = cached[2], box[3] = cached[3];
+		return SKR_SUCCESS;
+	}
+	return LoadGlyphBox(font, glyph, box);
+}
+
+static SKR_Affine AffineFromTransform(SKR_Transform transform)
+{
+	return (SKR_Affine) { transform.xScale, 0.0f, 0.0f, transform.yScale,
+		transform.xMove, transform.yMove };
+}
+
+SKR_Status skrGetOutlineBounds(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Transform transform, SKR_Bounds * restrict bounds)
+{
+	return skrGetOutlineBoundsAffine(font, glyph,
+		AffineFromTransform(transform), bounds);
+}
+
+/*
+The outline lies within the box of the glyph, so after transforming,
+it lies within the transformed box, and thus within the bounds of its
+four corners. This is exact for scaling, and for rotated glyphs it is
+as tight as it gets without looking at the outline.
+*/
+SKR_Status skrGetOutlineBoundsAffine(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, SKR_Bounds * restrict bounds)
+{
+	int16_t box[4];
+	SKR_Status s = GetGlyphBox(font, glyph, box);
+	if (s) return s;
+	if (box[0] > box[2]) {
+		*bounds = (SKR_Bounds) { 0, 0, 0, 0 }; // TODO get rid of this
+		return SKR_SUCCESS;
+	}
+
+	affine.xx /= font->unitsPerEm;
+	affine.xy /= font->unitsPerEm;
+	affine.yx /= font->unitsPerEm;
+	affine.yy /= font->unitsPerEm;
+
+	float const xs[2] = { box[0] - 1, box[2] + 1 };
+	float const ys[2] = { box[1] - 1, box[3] + 1 };
+	float xMin = xs[0] * affine.xx + ys[0] * affine.xy + affine.dx;
+	float yMin = xs[0] * affine.yx + ys[0] * affine.yy + affine.dy;
+	float xMax = xMin, yMax = yMin;
+	for (int c = 1; c < 4; ++c) {
+		float x = xs[c & 1], y = ys[c >> 1];
+		float tx = x * affine.xx + y * affine.xy + affine.dx;
+		float ty = x * affine.yx + y * affine.yy + affine.dy;
+		xMin = min(xMin, tx), xMax = max(xMax, tx);
+		yMin = min(yMin, ty), yMax = max(yMax, ty);
+	}
 
 	// TODO i guess the floor() is not neccessary here.
-	bounds->xMin = floorf((ri16(sh->xMin) - 1) * transform.xScale + transform.xMove);
-	bounds->yMin = floorf((ri16(sh->yMin) - 1) * transform.yScale + transform.yMove);
-	bounds->xMax = ceilf ((ri16(sh->xMax) + 1) * transform.xScale + transform.xMove);
-	bounds->yMax = ceilf ((ri16(sh->yMax) + 1) * transform.yScale + transform.yMove);
+	bounds->xMin = floorf(xMin);
+	bounds->yMin = floorf(yMin);
+	bounds->xMax = ceilf (xMax);
+	bounds->yMax = ceilf (yMax);
 
 	return SKR_SUCCESS;
 }
@@ -223,6 +379,13 @@ SKR_Status ScoutOutline(BYTES1 * outlineAddr, OutlineIntel * restrict intel)
 	BYTES2 * endPts = (BYTES2 *) glyfCursor;
 	intel->endPts = endPts;
 	glyfCursor += 2 * intel->numContours;
+	/*
+	Both drawing paths index the decoded points by contour, so the
+	last end point has to be the largest one, as it is in any sane font.
+	*/
+	for (int c = 1; c < intel->numContours; ++c) {
+		if (ru16(endPts[c]) < ru16(endPts[c - 1])) return SKR_FAILURE;
+	}
 
 	int instrLength = ri16(*(BYTES2 *) glyfCursor);
 	glyfCursor += 2 + instrLength;
@@ -263,6 +426,55 @@ complicated. ExtendContour() implements this using a simple finite state machine
 
 */
 
+static int IsShort(Point a, Point b, float length)
+{
+	return gabs(a.x - b.x) + gabs(a.y - b.y) < length;
+}
+
+/*
+A line that ends less than ws->mergeLength away from where it starts
+is held back as the queued line. If the next segment is a line too,
+the point in between gets dropped and the two are merged into one.
+Every dropped point lies within mergeLength of the start of the merged
+line, so that is as far as the outline can move.
+*/
+static void ExtendLine(ContourFSM * restrict fsm, Point newNode, Workspace * restrict ws)
+{
+	if (IsShort(fsm->queuedStart, newNode, ws->mergeLength)) {
+		fsm->queuedEnd = newNode;
+		fsm->lineQueued = 1;
+	} else {
+		Line line = { fsm->queuedStart, newNode };
+		DrawLine(ws, line);
+		fsm->queuedStart = newNode;
+		fsm->lineQueued = 0;
+	}
+}
+
+static void FlushLine(ContourFSM * restrict fsm, Workspace * restrict ws)
+{
+	if (fsm->lineQueued) {
+		Line line = { fsm->queuedStart, fsm->queuedEnd };
+		DrawLine(ws, line);
+		fsm->queuedStart = fsm->queuedEnd;
+		fsm->lineQueued = 0;
+	}
+}
+
+/* Curves that are too small to have a shape of their own become lines. */
+static void ExtendCurve(ContourFSM * restrict fsm, Point pivot, Point newNode, Workspace * restrict ws)
+{
+	if (IsShort(fsm->queuedStart, pivot, ws->mergeLength) &&
+		IsShort(fsm->queuedStart, newNode, ws->mergeLength)) {
+		ExtendLine(fsm, newNode, ws);
+	} else {
+		FlushLine(fsm, ws);
+		Curve curve = { fsm->queuedStart, newNode, pivot };
+		DrawCurve(ws, curve);
+		fsm->queuedStart = newNode;
+	}
+}
+
 static void ExtendContour(ContourFSM * restrict fsm, Point newNode, int onCurve, Workspace * restrict ws)
 {
 	switch (fsm->state) {
@@ -270,13 +482,12 @@ static void ExtendContour(ContourFSM * restrict fsm, Point newNode, int onCurve,
 		SKR_assert(onCurve);
 		fsm->queuedStart = newNode;
 		fsm->looseEnd = newNode;
+		fsm->lineQueued = 0;
 		fsm->state = 1;
 		break;
 	case 1:
 		if (onCurve) {
-			Line line = { fsm->queuedStart, newNode };
-			DrawLine(ws, line);
-			fsm->queuedStart = newNode;
+			ExtendLine(fsm, newNode, ws);
 			break;
 		} else {
 			fsm->queuedPivot = newNode;
@@ -285,16 +496,12 @@ static void ExtendContour(ContourFSM * restrict fsm, Point newNode, int onCurve,
 		}
 	case 2:
 		if (onCurve) {
-			Curve curve = { fsm->queuedStart, newNode, fsm->queuedPivot };
-			DrawCurve(ws, curve);
-			fsm->queuedStart = newNode;
+			ExtendCurve(fsm, fsm->queuedPivot, newNode, ws);
 			fsm->state = 1;
 			break;
 		} else {
 			Point implicit = Midpoint(fsm->queuedPivot, newNode);
-			Curve curve = { fsm->queuedStart, implicit, fsm->queuedPivot };
-			DrawCurve(ws, curve);
-			fsm->queuedStart = implicit;
+			ExtendCurve(fsm, fsm->queuedPivot, implicit, ws);
 			fsm->queuedPivot = newNode;
 			break;
 		}
@@ -302,6 +509,13 @@ static void ExtendContour(ContourFSM * restrict fsm, Point newNode, int onCurve,
 	}
 }
 
+/* Closes the loop - but doesn't update the relative origin point. */
+static void CloseContour(ContourFSM * restrict fsm, Workspace * restrict ws)
+{
+	ExtendContour(fsm, fsm->looseEnd, SGF_ON_CURVE_POINT, ws);
+	FlushLine(fsm, ws);
+}
+
 /*
 
 Pulls the next coordinate from the memory pointed to by ptr, and
@@ -329,11 +543,215 @@ static long GetCoordinateAndAdvance(BYTES1 flags, BYTES1 * restrict * restrict p
 	return co;
 }
 
-static void DrawOutlineWithIntel(OutlineIntel * restrict intel,
-	SKR_Transform transform, Workspace * restrict ws)
+/*
+
+Decoding points one by one means branching on every flag twice, and
+the flags of real outlines are next to impossible to predict. So points
+get decoded in chunks instead: first the flags are expanded into one
+per point, then the x and y streams each get turned into coordinates
+eight points at a time, without any branches on the flags at all.
+
+*/
+
+#define DECODE_CHUNK 64
+
+typedef struct {
+	BYTES1 * flagsPtr;
+	BYTES1 * xPtr;
+	BYTES1 * yPtr;
+	BYTES1 * dataEnd;
+	int pendingRepeats;
+	uint8_t pendingFlags;
+	int32_t prevX, prevY;
+} PointDecoder;
+
+typedef struct {
+	/* 16 more flags than points, as they get written 16 at a time */
+	uint8_t flags[DECODE_CHUNK + 16];
+	int32_t xs[DECODE_CHUNK];
+	int32_t ys[DECODE_CHUNK];
+} PointChunk;
+
+/*
+Whole vectors get loaded from the streams, which can reach past the
+end of the outline, but not past dataEnd, the end of the memory it lies in.
+*/
+static void BeginDecoding(PointDecoder * restrict dec,
+	OutlineIntel const * restrict intel, BYTES1 * dataEnd)
+{
+	dec->flagsPtr = intel->flagsPtr;
+	dec->xPtr = intel->xPtr;
+	dec->yPtr = intel->yPtr;
+	dec->dataEnd = dataEnd;
+	dec->pendingRepeats = 0;
+	dec->pendingFlags = 0;
+	dec->prevX = 0;
+	dec->prevY = 0;
+}
+
+/*
+Copies flags sixteen at a time, up to the next one that repeats,
+which then gets spread out over as many points as it stands for.
+A repeat can stand for more points than fit into the chunk;
+the rest of them go into the next one.
+*/
+static void ExpandFlags(PointDecoder * restrict dec, uint8_t * restrict flags, int count)
+{
+	int n = min(dec->pendingRepeats, count);
+	for (int i = 0; i < n; i += 16) {
+		_mm_storeu_si128((__m128i *) (flags + i), _mm_set1_epi8(dec->pendingFlags));
+	}
+	dec->pendingRepeats -= n;
+
+	while (n < count) {
+		if (dec->flagsPtr + 16 <= dec->dataEnd) {
+			__m128i values = _mm_loadu_si128((__m128i const *) dec->flagsPtr);
+			/* moves the repeat bit of each byte up to the top */
+			int repeats = _mm_movemask_epi8(_mm_slli_epi16(values, 4));
+			int plain = min(repeats ? __builtin_ctz(repeats) : 16, count - n);
+			_mm_storeu_si128((__m128i *) (flags + n), values);
+			n += plain;
+			dec->flagsPtr += plain;
+			if (n == count) break;
+			if (!(repeats & (1 << plain))) continue;
+		}
+		uint8_t f = *(dec->flagsPtr++);
+		int times = 1;
+		if (f & SGF_REPEAT_FLAG)
+			times += *(dec->flagsPtr++);
+		int fitting = min(times, count - n);
+		for (int i = 0; i < fitting; i += 16) {
+			_mm_storeu_si128((__m128i *) (flags + n + i), _mm_set1_epi8(f));
+		}
+		n += fitting;
+		dec->pendingRepeats = times - fitting;
+		dec->pendingFlags = f;
+	}
+}
+
+/*
+Turns the deltas of eight points into coordinates. Every point takes
+up two bytes of the stream, one, or none, depending on its flags.
+Summing those sizes up yields where in the stream each delta starts,
+and from that, a shuffle mask that moves each delta into its own lane.
+*/
+static __m128i SumDeltas_ssse3(__m128i flags, __m128i shortBit, __m128i sameBit,
+	BYTES1 * restrict * restrict ptr, __m128i * restrict prev, __m128i * restrict upper)
+{
+	__m128i isShort = _mm_cmpeq_epi8(_mm_and_si128(flags, shortBit), shortBit);
+	__m128i isSame = _mm_cmpeq_epi8(_mm_and_si128(flags, sameBit), sameBit);
+	__m128i size = _mm_andnot_si128(isSame, _mm_set1_epi8(2));
+	size = _mm_or_si128(_mm_andnot_si128(isShort, size), _mm_and_si128(isShort, _mm_set1_epi8(1)));
+
+	__m128i end = _mm_add_epi8(size, _mm_slli_si128(size, 1));
+	end = _mm_add_epi8(end, _mm_slli_si128(end, 2));
+	end = _mm_add_epi8(end, _mm_slli_si128(end, 4));
+	__m128i start = _mm_sub_epi8(end, size);
+
+	/* deltas are big-endian words, or single unsigned bytes */
+	__m128i shortLanes = _mm_unpacklo_epi8(isShort, isShort);
+	__m128i sameLanes = _mm_unpacklo_epi8(isSame, isSame);
+	__m128i startLanes = _mm_unpacklo_epi8(start, start);
+	__m128i wordMask = _mm_add_epi8(startLanes, _mm_set1_epi16(0x0001));
+	__m128i byteMask = _mm_or_si128(startLanes, _mm_set1_epi16((short) 0x8000));
+	__m128i mask = _mm_or_si128(_mm_and_si128(shortLanes, byteMask), _mm_andnot_si128(shortLanes, wordMask));
+	mask = _mm_or_si128(mask, _mm_andnot_si128(shortLanes, sameLanes));
+	__m128i delta = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) *ptr), mask);
+	__m128i negative = _mm_andnot_si128(sameLanes, shortLanes);
+	delta = _mm_sub_epi16(_mm_xor_si128(delta, negative), negative);
+	*ptr += _mm_extract_epi16(end, 3) >> 8;
+
+	__m128i lower = _mm_srai_epi32(_mm_unpacklo_epi16(delta, delta), 16);
+	__m128i higher = _mm_srai_epi32(_mm_unpackhi_epi16(delta, delta), 16);
+	lower = _mm_add_epi32(lower, _mm_slli_si128(lower, 4));
+	lower = _mm_add_epi32(lower, _mm_slli_si128(lower, 8));
+	higher = _mm_add_epi32(higher, _mm_slli_si128(higher, 4));
+	higher = _mm_add_epi32(higher, _mm_slli_si128(higher, 8));
+	lower = _mm_add_epi32(lower, *prev);
+	higher = _mm_add_epi32(higher, _mm_shuffle_epi32(lower, 0xFF));
+	*prev = _mm_shuffle_epi32(higher, 0xFF);
+	*upper = higher;
+	return lower;
+}
+
+/*
+Decodes one stream of coordinates; y coordinates get their flags shifted.
+The chunk has room for a whole last group of eight, even where the
+points run out before; the points past the end just get turned into
+ones that take up no bytes in the stream.
+*/
+static int32_t DecodeCoordinates(uint8_t const * restrict flags, int count, int shift,
+	BYTES1 * restrict * restrict ptr, BYTES1 * dataEnd, int32_t prev, int32_t * restrict coords)
+{
+	__m128i const shortBit = _mm_set1_epi8(SGF_SHORT_X_COORD << shift);
+	__m128i const sameBit = _mm_set1_epi8(SGF_REUSE_PREV_X << shift);
+	__m128i const lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i sum = _mm_set1_epi32(prev);
+	int i = 0;
+	/* eight points never take up more than sixteen bytes */
+	for (; i < count && *ptr + 16 <= dataEnd; i += 8) {
+		__m128i groupFlags = _mm_loadl_epi64((__m128i const *) (flags + i));
+		if (count - i < 8) {
+			__m128i valid = _mm_cmpgt_epi8(_mm_set1_epi8(count - i), lanes);
+			groupFlags = _mm_or_si128(_mm_and_si128(groupFlags, valid), _mm_andnot_si128(valid, sameBit));
+		}
+		__m128i upper;
+		__m128i lower = SumDeltas_ssse3(groupFlags, shortBit, sameBit, ptr, &sum, &upper);
+		_mm_storeu_si128((__m128i *) (coords + i), lower);
+		_mm_storeu_si128((__m128i *) (coords + i + 4), upper);
+	}
+	prev = _mm_cvtsi128_si32(sum);
+	for (; i < count; ++i) {
+		prev = GetCoordinateAndAdvance(flags[i] >> shift, ptr, prev);
+		coords[i] = prev;
+	}
+	return prev;
+}
+
+static void DecodePoints(PointDecoder * restrict dec, PointChunk * restrict chunk, int count)
+{
+	ExpandFlags(dec, chunk->flags, count);
+	dec->prevX = DecodeCoordinates(chunk->flags, count, 0,
+		&dec->xPtr, dec->dataEnd, dec->prevX, chunk->xs);
+	dec->prevY = DecodeCoordinates(chunk->flags, count, 1,
+		&dec->yPtr, dec->dataEnd, dec->prevY, chunk->ys);
+}
+
+SKR_Status DecodeOutline(MemRange range, int32_t * restrict xs,
+	int32_t * restrict ys, uint8_t * restrict onCurve)
+{
+	OutlineIntel intel = { 0 };
+	SKR_Status s = ScoutOutline(range.lowerBound, &intel);
+	if (s) return s;
+	if (intel.numContours <= 0) return SKR_SUCCESS;
+	int numPoints = ru16(intel.endPts[intel.numContours - 1]) + 1;
+
+	PointDecoder dec;
+	BeginDecoding(&dec, &intel, range.dataEnd);
+	PointChunk chunk;
+	for (int chunkStart = 0; chunkStart < numPoints; chunkStart += DECODE_CHUNK) {
+		int count = min(DECODE_CHUNK, numPoints - chunkStart);
+		DecodePoints(&dec, &chunk, count);
+		for (int i = 0; i < count; ++i) {
+			xs[chunkStart + i] = chunk.xs[i];
+			ys[chunkStart + i] = chunk.ys[i];
+			onCurve[chunkStart + i] = chunk.flags[i] & SGF_ON_CURVE_POINT;
+		}
+	}
+	return SKR_SUCCESS;
+}
+
+static void DrawOutlineWithIntel(OutlineIntel * restrict intel, BYTES1 * dataEnd,
+	SKR_Affine affine, Workspace * restrict ws)
 {
+	if (intel->numContours <= 0) return;
+	int numPoints = ru16(intel->endPts[intel->numContours - 1]) + 1;
+
+	PointDecoder dec;
+	BeginDecoding(&dec, intel, dataEnd);
+	PointChunk chunk;
+	int chunkStart = 0, chunkEnd = 0;
 	int pointIdx = 0;
-	long prevX = 0, prevY = 0;
 
 	ContourFSM fsm = { 0 };
 
@@ -342,35 +760,370 @@ static void DrawOutlineWithIntel(OutlineIntel * restrict intel,
 
 		fsm.state = 0;
 
-		while (pointIdx <= endPt) {
-			BYTES1 flags = *(intel->flagsPtr++);
+		for (; pointIdx <= endPt; ++pointIdx) {
+			if (pointIdx == chunkEnd) {
+				chunkStart = pointIdx;
+				chunkEnd = min(pointIdx + DECODE_CHUNK, numPoints);
+				DecodePoints(&dec, &chunk, chunkEnd - chunkStart);
+			}
+			int i = pointIdx - chunkStart;
+			float x = chunk.xs[i], y = chunk.ys[i];
+			Point point = {
+				x * affine.xx + y * affine.xy + affine.dx,
+				x * affine.yx + y * affine.yy + affine.dy };
+			ExtendContour(&fsm, point, chunk.flags[i] & SGF_ON_CURVE_POINT, ws);
+		}
 
-			unsigned int times = 1;
-			if (flags & SGF_REPEAT_FLAG)
-				times += *(intel->flagsPtr++);
-
-			do {
-				long x = GetCoordinateAndAdvance(flags, &intel->xPtr, prevX);
-				long y = GetCoordinateAndAdvance(flags >> 1, &intel->yPtr, prevY);
-				Point point = {
-					x * transform.xScale + transform.xMove,
-					y * transform.yScale + transform.yMove };
-				ExtendContour(&fsm, point, flags & SGF_ON_CURVE_POINT, ws);
-				prevX = x, prevY = y;
-				++pointIdx;
-				--times;
-			} while (times > 0);
+		CloseContour(&fsm, ws);
+	}
+}
+
+/*
+Where a glyph with the given box (xMin, yMin, xMax, yMax) goes, if its
+transformed box fits into a single tile. The quantization and the tile
+origin get folded into the transform of the placement.
+*/
+typedef struct {
+	long xOrigin, yOrigin;
+	SKR_Dimensions dims;
+	SKR_Affine affine;
+	int32_t xLimit, yLimit;
+} TilePlacement;
+
+static int PlaceSmallOutline(int16_t const box[4], SKR_Affine affine,
+	Workspace const * restrict ws, TilePlacement * restrict tp)
+{
+	float const xs[2] = { box[0], box[2] };
+	float const ys[2] = { box[1], box[3] };
+	float xMin = FLT_MAX, yMin = FLT_MAX, xMax = -FLT_MAX, yMax = -FLT_MAX;
+	for (int i = 0; i < 4; ++i) {
+		float x = xs[i & 1] * affine.xx + ys[i >> 1] * affine.xy + affine.dx;
+		float y = xs[i & 1] * affine.yx + ys[i >> 1] * affine.yy + affine.dy;
+		xMin = min(xMin, x), xMax = max(xMax, x);
+		yMin = min(yMin, y), yMax = max(yMax, y);
+	}
+	if (xMin < 0.0f || yMin < 0.0f) return 0;
+	long xOrigin = floorf(xMin), yOrigin = floorf(yMin);
+	long xEnd = ceilf(xMax);
+	/* lines right on the upper edge of the box go into the row above, if there is one */
+	long yEnd = min((long) ceilf(yMax) + 1, (long) ws->dims.height);
+	if (xEnd > (long) ws->dims.width || yEnd <= yOrigin) return 0;
+	if (xEnd - xOrigin > SMALL_TILE_SIZE || yEnd - yOrigin > SMALL_TILE_SIZE) return 0;
+
+	tp->xOrigin = xOrigin;
+	tp->yOrigin = yOrigin;
+	tp->dims = (SKR_Dimensions) { xEnd - xOrigin, yEnd - yOrigin };
+	tp->affine = (SKR_Affine) {
+		affine.xx * GRAIN, affine.xy * GRAIN, affine.yx * GRAIN, affine.yy * GRAIN,
+		(affine.dx - xOrigin) * GRAIN + 0.5f, (affine.dy - yOrigin) * GRAIN + 0.5f };
+	tp->xLimit = tp->dims.width * GRAIN;
+	tp->yLimit = tp->dims.height * GRAIN - 1;
+	return 1;
+}
+
+/* Points outside the glyph box would end up outside the tile, so they get clamped. */
+static inline FixedPoint PlacePoint(TilePlacement const * restrict tp, float x, float y)
+{
+	SKR_Affine const q = tp->affine;
+	int32_t qx = x * q.xx + y * q.xy + q.dx;
+	int32_t qy = x * q.yx + y * q.yy + q.dy;
+	return (FixedPoint) { min(max(qx, 0), tp->xLimit), min(max(qy, 0), tp->yLimit) };
+}
+
+/*
+Places pairs of x and y, four points at a time. Each lane works out the
+same sums as PlacePoint() does, in the same order, so the points come
+out exactly the same. Clamping before the conversion instead of after
+makes no difference either, since the limits are whole numbers.
+*/
+static void PlacePoints(TilePlacement const * restrict tp, int16_t const * restrict coords,
+	int count, FixedPoint * restrict points)
+{
+	SKR_Affine const q = tp->affine;
+	__m128 const straight = _mm_setr_ps(q.xx, q.yy, q.xx, q.yy);
+	__m128 const crossed = _mm_setr_ps(q.xy, q.yx, q.xy, q.yx);
+	__m128 const offset = _mm_setr_ps(q.dx, q.dy, q.dx, q.dy);
+	__m128 const limit = _mm_setr_ps(tp->xLimit, tp->yLimit, tp->xLimit, tp->yLimit);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i pairs = _mm_loadu_si128((__m128i const *) (coords + 2 * i));
+		__m128i halves[2] = {
+			_mm_srai_epi32(_mm_unpacklo_epi16(pairs, pairs), 16),
+			_mm_srai_epi32(_mm_unpackhi_epi16(pairs, pairs), 16) };
+		for (int h = 0; h < 2; ++h) {
+			__m128 xy = _mm_cvtepi32_ps(halves[h]);
+			__m128 yx = _mm_shuffle_ps(xy, xy, _MM_SHUFFLE(2, 3, 0, 1));
+			__m128 placed = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xy, straight),
+				_mm_mul_ps(yx, crossed)), offset);
+			placed = _mm_min_ps(_mm_max_ps(placed, _mm_setzero_ps()), limit);
+			_mm_storeu_si128((__m128i *) (points + i + 2 * h), _mm_cvttps_epi32(placed));
 		}
+	}
+	for (; i < count; ++i) {
+		points[i] = PlacePoint(tp, coords[2 * i], coords[2 * i + 1]);
+	}
+}
 
-		// Close the loop - but don't update relative origin point
-		ExtendContour(&fsm, fsm.looseEnd, SGF_ON_CURVE_POINT, ws);
+/*
+Decodes the whole outline up front and hands it to DrawSmallOutline(),
+if the transformed glyph box fits into a single tile.
+Returns 0 without drawing anything otherwise.
+*/
+static int DrawSmallOutlineWithIntel(MemRange range, OutlineIntel * restrict intel,
+	BYTES1 * dataEnd, SKR_Affine affine, Workspace * restrict ws)
+{
+	if (intel->numContours <= 0) return 0;
+	int numPoints = ru16(intel->endPts[intel->numContours - 1]) + 1;
+	if (numPoints > SMALL_MAX_POINTS) return 0;
+	/* lots of empty contours are left to the general path, which doesn't store them */
+	if (intel->numContours > numPoints) return 0;
+
+	ShHdr const * restrict sh = (ShHdr const *) range.lowerBound;
+	int16_t const box[4] = { ri16(sh->xMin), ri16(sh->yMin), ri16(sh->xMax), ri16(sh->yMax) };
+	TilePlacement tp;
+	if (!PlaceSmallOutline(box, affine, ws, &tp)) return 0;
+
+	uint16_t contourEnds[SMALL_MAX_POINTS];
+	for (int c = 0; c < intel->numContours; ++c) {
+		contourEnds[c] = ru16(intel->endPts[c]);
+	}
+	FixedPoint points[SMALL_MAX_POINTS];
+	uint8_t onCurve[SMALL_MAX_POINTS];
+	PointDecoder dec;
+	BeginDecoding(&dec, intel, dataEnd);
+	PointChunk chunk;
+	for (int chunkStart = 0; chunkStart < numPoints; chunkStart += DECODE_CHUNK) {
+		int count = min(DECODE_CHUNK, numPoints - chunkStart);
+		DecodePoints(&dec, &chunk, count);
+		for (int i = 0; i < count; ++i) {
+			points[chunkStart + i] = PlacePoint(&tp, chunk.xs[i], chunk.ys[i]);
+			onCurve[chunkStart + i] = chunk.flags[i] & SGF_ON_CURVE_POINT;
+		}
+	}
+
+	DrawSmallOutline(ws, tp.xOrigin, tp.yOrigin, tp.dims, points, onCurve,
+		contourEnds, intel->numContours);
+	return 1;
+}
+
+/*
+======== decoded outlines ========
+
+The font cache can hold the simple outlines of a glyf font already
+decoded into plain arrays, so drawing them skips scouting and decoding.
+The section starts with the offset of each glyph's record, from the
+start of the section, plus one more for the end of the last record.
+Glyphs with an empty record, like compound or blank ones, are still
+drawn straight from the glyf table.
+*/
+
+/*
+A record is followed by the end point of each contour, then x and y of
+each point, then whether each point is on the curve, padded to 2 bytes.
+*/
+typedef struct {
+	uint16_t numContours, numPoints;
+	int16_t box[4];
+} CachedOutline;
+
+static unsigned long CachedOutlineSize(unsigned long numContours, unsigned long numPoints)
+{
+	unsigned long size = sizeof(CachedOutline) + 2 * numContours + 5 * numPoints;
+	return (size + 1) & ~1ul;
+}
+
+/*
+Decodes a glyph into record, and returns the size of the record,
+or 0 if the glyph won't get one. Without a record, it only counts.
+*/
+static unsigned long DecodeCachedOutline(SKR_Font const * restrict font, Glyph glyph,
+	CachedOutline * restrict record)
+{
+	MemRange range;
+	if (GetRawOutlineRange(font, glyph, &range)) return 0;
+	if ((unsigned long) (range.upperBound - range.lowerBound) < sizeof(ShHdr)) return 0;
+	OutlineIntel intel = { 0 };
+	if (ScoutOutline(range.lowerBound, &intel)) return 0;
+	if (intel.numContours <= 0) return 0;
+	int numPoints = ru16(intel.endPts[intel.numContours - 1]) + 1;
+	if (intel.numContours > numPoints) return 0;
+
+	ShHdr const * restrict sh = (ShHdr const *) range.lowerBound;
+	uint16_t * restrict endPts = (uint16_t *) (record + 1);
+	int16_t * restrict coords = (int16_t *) (endPts + intel.numContours);
+	uint8_t * restrict onCurve = (uint8_t *) (coords + 2 * numPoints);
+	PointDecoder dec;
+	BeginDecoding(&dec, &intel, range.dataEnd);
+	PointChunk chunk;
+	for (int chunkStart = 0; chunkStart < numPoints; chunkStart += DECODE_CHUNK) {
+		int count = min(DECODE_CHUNK, numPoints - chunkStart);
+		DecodePoints(&dec, &chunk, count);
+		for (int i = 0; i < count; ++i) {
+			/* coordinates are sums of deltas, and those can leave the 16 bit range */
+			if (chunk.xs[i] < INT16_MIN || chunk.xs[i] > INT16_MAX) return 0;
+			if (chunk.ys[i] < INT16_MIN || chunk.ys[i] > INT16_MAX) return 0;
+			if (record == 0) continue;
+			coords[2 * (chunkStart + i) + 0] = chunk.xs[i];
+			coords[2 * (chunkStart + i) + 1] = chunk.ys[i];
+			onCurve[chunkStart + i] = chunk.flags[i] & SGF_ON_CURVE_POINT;
+		}
+	}
+
+	if (record != 0) {
+		record->numContours = intel.numContours;
+		record->numPoints = numPoints;
+		record->box[0] = ri16(sh->xMin);
+		record->box[1] = ri16(sh->yMin);
+		record->box[2] = ri16(sh->xMax);
+		record->box[3] = ri16(sh->yMax);
+		for (int c = 0; c < intel.numContours; ++c) {
+			endPts[c] = ru16(intel.endPts[c]);
+		}
+	}
+	return CachedOutlineSize(intel.numContours, numPoints);
+}
+
+unsigned long CalcCachedOutlinesSize(SKR_Font const * restrict font)
+{
+	if (font->cff.version != 0) return 0;
+	unsigned long size = AlignSize((font->numGlyphs + 1ul) * sizeof(uint32_t));
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		size += DecodeCachedOutline(font, glyph, 0);
+	}
+	return AlignSize(size);
+}
+
+void BuildCachedOutlines(SKR_Font const * restrict font, void * restrict memory)
+{
+	uint32_t * restrict offsets = (uint32_t *) memory;
+	uint32_t offset = AlignSize((font->numGlyphs + 1ul) * sizeof(uint32_t));
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		offsets[glyph] = offset;
+		offset += DecodeCachedOutline(font, glyph,
+			(CachedOutline *) ((BYTES1 *) memory + offset));
+	}
+	offsets[font->numGlyphs] = offset;
+}
+
+int CheckCachedOutlines(void const * restrict memory, unsigned long size,
+	unsigned long numGlyphs)
+{
+	if (!RangeFits(0, numGlyphs + 1, sizeof(uint32_t), size)) return 0;
+	uint32_t const * restrict offsets = (uint32_t const *) memory;
+	if (offsets[0] < (numGlyphs + 1) * sizeof(uint32_t)) return 0;
+	for (unsigned long glyph = 0; glyph < numGlyphs; ++glyph) {
+		if (offsets[glyph] % 2 != 0 || offsets[glyph + 1] < offsets[glyph]) return 0;
+	}
+	return offsets[numGlyphs] <= size;
+}
+
+/*
+The record of a glyph, if it has one that is intact.
+The section as a whole was checked when it got attached,
+the contents of each record get checked here on every use.
+*/
+static CachedOutline const * FindCachedOutline(SKR_Font const * restrict font, Glyph glyph)
+{
+	if (font->cachedOutlines == 0 || glyph >= font->numGlyphs) return 0;
+	uint32_t const * restrict offsets = (uint32_t const *) font->cachedOutlines;
+	unsigned long length = offsets[glyph + 1] - offsets[glyph];
+	if (length < sizeof(CachedOutline)) return 0;
+	CachedOutline const * restrict outline = (CachedOutline const *)
+		((BYTES1 *) font->cachedOutlines + offsets[glyph]);
+	if (outline->numContours == 0 || outline->numContours > outline->numPoints) return 0;
+	if (length != CachedOutlineSize(outline->numContours, outline->numPoints)) return 0;
+	uint16_t const * restrict endPts = (uint16_t const *) (outline + 1);
+	for (int c = 1; c < outline->numContours; ++c) {
+		if (endPts[c] < endPts[c - 1]) return 0;
+	}
+	if (endPts[outline->numContours - 1] != outline->numPoints - 1) return 0;
+	return outline;
+}
+
+/* Takes the same paths as a glyph from the glyf table, with the same results. */
+static void DrawCachedOutline(CachedOutline const * restrict outline,
+	SKR_Affine affine, Workspace * restrict ws)
+{
+	int numContours = outline->numContours, numPoints = outline->numPoints;
+	uint16_t const * restrict endPts = (uint16_t const *) (outline + 1);
+	int16_t const * restrict coords = (int16_t const *) (endPts + numContours);
+	uint8_t const * restrict onCurve = (uint8_t const *) (coords + 2 * numPoints);
+
+	TilePlacement tp;
+	if (numPoints <= SMALL_MAX_POINTS && PlaceSmallOutline(outline->box, affine, ws, &tp)) {
+		FixedPoint points[SMALL_MAX_POINTS];
+		PlacePoints(&tp, coords, numPoints, points);
+		DrawSmallOutline(ws, tp.xOrigin, tp.yOrigin, tp.dims, points, onCurve,
+			endPts, numContours);
+		return;
+	}
+
+	ContourFSM fsm = { 0 };
+	int pointIdx = 0;
+	for (int c = 0; c < numContours; ++c) {
+		fsm.state = 0;
+		for (; pointIdx <= endPts[c]; ++pointIdx) {
+			float x = coords[2 * pointIdx], y = coords[2 * pointIdx + 1];
+			Point point = {
+				x * affine.xx + y * affine.xy + affine.dx,
+				x * affine.yx + y * affine.yy + affine.dy };
+			ExtendContour(&fsm, point, onCurve[pointIdx], ws);
+		}
+		CloseContour(&fsm, ws);
 	}
 }
 
 SKR_Status skrDrawOutline(SKR_Font const * restrict font, Glyph glyph,
 	SKR_Transform transform, RasterCell * restrict raster, SKR_Dimensions dims)
 {
-	SKR_Status s;
+	return skrDrawOutlineAffine(font, glyph,
+		AffineFromTransform(transform), raster, dims);
+}
+
+SKR_Status skrDrawOutlineAffine(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, RasterCell * restrict raster, SKR_Dimensions dims)
+{
+	Workspace ws = PackedWorkspace(raster, dims);
+	return DrawOutlineInWorkspace(font, glyph, affine, &ws);
+}
+
+SKR_Status skrDrawOutlinePlanar(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, SKR_Raster const * restrict raster)
+{
+	Workspace ws = PlanarWorkspace(raster);
+	return DrawOutlineInWorkspace(font, glyph, affine, &ws);
+}
+
+/* flatness and mergeLength for each SKR_Quality */
+static float const qualityTolerances[][2] = {
+	[SKR_QUALITY_NORMAL] = { 0.5f,   1.0f / GRAIN },
+	[SKR_QUALITY_HIGH]   = { 0.125f, 0.0f },
+	[SKR_QUALITY_FAST]   = { 1.0f,   0.125f },
+};
+
+SKR_Status ApplyQuality(Workspace * restrict ws, SKR_Quality quality)
+{
+	if ((unsigned int) quality > SKR_QUALITY_FAST) return SKR_FAILURE;
+	ws->flatness = qualityTolerances[quality][0];
+	ws->mergeLength = qualityTolerances[quality][1];
+	return SKR_SUCCESS;
+}
+
+SKR_Status DrawOutlineInWorkspace(SKR_Font const * restrict font, Glyph glyph,
+	SKR_Affine affine, Workspace * restrict ws)
+{
+	SKR_Status s = ApplyQuality(ws, font->quality);
+	if (s) return s;
+	affine.xx /= font->unitsPerEm;
+	affine.xy /= font->unitsPerEm;
+	affine.yx /= font->unitsPerEm;
+	affine.yy /= font->unitsPerEm;
+	if (font->cff.version != 0) return DrawCharstring(font, glyph, affine, ws);
+	CachedOutline const * restrict cached = FindCachedOutline(font, glyph);
+	if (cached != 0) {
+		DrawCachedOutline(cached, affine, ws);
+		return SKR_SUCCESS;
+	}
 	MemRange range;
 	s = GetOutlineRange(font, glyph, &range);
 	if (s) return s;
@@ -378,9 +1131,8 @@ SKR_Status skrDrawOutline(SKR_Font const * restrict font, Glyph glyph,
 	OutlineIntel intel = { 0 };
 	s = ScoutOutline(range.lowerBound, &intel);
 	if (s) return s;
-	transform.xScale /= font->unitsPerEm;
-	transform.yScale /= font->unitsPerEm;
-	Workspace ws = { raster, dims, CalcRasterWidth(dims) };
-	DrawOutlineWithIntel(&intel, transform, &ws);
+	if (!DrawSmallOutlineWithIntel(range, &intel, range.dataEnd, affine, ws)) {
+		DrawOutlineWithIntel(&intel, range.dataEnd, affine, ws);
+	}
 	return SKR_SUCCESS;
 }
@@ -0,0 +1,289 @@
+#include "Internals.h"
+
+void DrawLine(Workspace * restrict ws, Line line);
+void DrawCurve(Workspace * restrict ws, Curve initialCurve);
+void DrawCubic(Workspace * restrict ws, Cubic initialCubic);
+int IsFlat(Curve curve, float flatness);
+void SplitCurve(Curve curve, Curve segments[2]);
+int IsCubicFlat(Cubic cubic, float flatness);
+void SplitCubic(Cubic cubic, Cubic segments[2]);
+
+/*
+======== clipping ========
+
+Glyphs always get a raster that is larger than they are, but paths may
+go anywhere, and the rasterizer must not be handed a single point
+outside of the raster. So every point of a path that lies outside gets
+moved to the nearest point on the edge of the raster instead.
+Since cells only add up the winding of what's above them in the same
+column, that changes nothing inside: what's left or right of the raster
+becomes a vertical line on its edge, which has no winding to add, and
+what's above becomes a line along the top, which adds the same winding
+to the columns below as the original did.
+What's below the raster would then go along the bottom edge, in the
+row just below it. Its winding doesn't matter there, but it does have
+to be there, as every column has to add up to nothing at the end, so
+the bottom edge gets pulled up to just inside the last row. That costs
+the last row at most one level of coverage where a path goes on below
+the raster, and likewise the right edge for the last column.
+*/
+
+static float ClipRight(SKR_Dimensions dims)
+{
+	return dims.width - 1.0f / GRAIN;
+}
+
+static float ClipBottom(SKR_Dimensions dims)
+{
+	return dims.height - 1.0f / GRAIN;
+}
+
+static Point ClampPoint(Point p, SKR_Dimensions dims)
+{
+	p.x = min(max(p.x, 0.0f), ClipRight(dims));
+	p.y = min(max(p.y, 0.0f), ClipBottom(dims));
+	return p;
+}
+
+static int IsInside(Point p, SKR_Dimensions dims)
+{
+	return p.x >= 0.0f && p.x <= ClipRight(dims) &&
+		p.y >= 0.0f && p.y <= ClipBottom(dims);
+}
+
+/*
+Whether all of the points lie beyond the same edge, so that they all get
+moved onto that edge, and nothing but where they start and end matters.
+*/
+static int IsBeyondEdge(Point const * restrict points, int count, SKR_Dimensions dims)
+{
+	int left = 1, right = 1, top = 1, bottom = 1;
+	for (int i = 0; i < count; ++i) {
+		left &= points[i].x <= 0.0f;
+		right &= points[i].x >= ClipRight(dims);
+		top &= points[i].y <= 0.0f;
+		bottom &= points[i].y >= ClipBottom(dims);
+	}
+	return left | right | top | bottom;
+}
+
+/* Notes down the t at which the line from a to b crosses value, if it does. */
+static void AddCrossing(float a, float b, float value, float * restrict ts, int * restrict count)
+{
+	if ((a < value) == (b < value)) return;
+	float t = (value - a) / (b - a);
+	if (t > 0.0f && t < 1.0f) ts[(*count)++] = t;
+}
+
+/*
+RasterizeLine() finds where a line crosses into the next cell by adding
+up steps, and the rounding errors of those add up as well. Over the
+length of a glyph they stay far below a quantization step, but paths
+can run across the whole raster, where they'd be enough to put crossings
+into the wrong column, so long lines get drawn in pieces.
+*/
+#define MAX_PIECE_LENGTH 64.0f
+
+static void DrawLongLine(Workspace * restrict ws, Line line)
+{
+	float dx = line.end.x - line.beg.x;
+	float dy = line.end.y - line.beg.y;
+	float length = max(gabs(dx), gabs(dy));
+	if (length <= MAX_PIECE_LENGTH) {
+		DrawLine(ws, line);
+		return;
+	}
+	int count = (int) ceilf(length / MAX_PIECE_LENGTH);
+	Point prev = line.beg;
+	for (int i = 1; i < count; ++i) {
+		float t = (float) i / count;
+		Point next = { line.beg.x + t * dx, line.beg.y + t * dy };
+		DrawLine(ws, (Line) { prev, next });
+		prev = next;
+	}
+	DrawLine(ws, (Line) { prev, line.end });
+}
+
+/*
+Between two edge crossings, a line stays on one side of each edge, so
+moving its points onto the edges keeps it straight there. The line gets
+split at the crossings, and each piece clamped on its own.
+*/
+static void DrawClippedLine(Workspace * restrict ws, Line line)
+{
+	SKR_Dimensions dims = ws->dims;
+	if (IsInside(line.beg, dims) && IsInside(line.end, dims)) {
+		DrawLongLine(ws, line);
+		return;
+	}
+
+	float ts[4];
+	int count = 0;
+	AddCrossing(line.beg.x, line.end.x, 0.0f, ts, &count);
+	AddCrossing(line.beg.x, line.end.x, ClipRight(dims), ts, &count);
+	AddCrossing(line.beg.y, line.end.y, 0.0f, ts, &count);
+	AddCrossing(line.beg.y, line.end.y, ClipBottom(dims), ts, &count);
+	for (int i = 1; i < count; ++i) {
+		float t = ts[i];
+		int j = i;
+		for (; j > 0 && ts[j - 1] > t; --j) {
+			ts[j] = ts[j - 1];
+		}
+		ts[j] = t;
+	}
+
+	float dx = line.end.x - line.beg.x;
+	float dy = line.end.y - line.beg.y;
+	Point prev = ClampPoint(line.beg, dims);
+	for (int i = 0; i < count; ++i) {
+		Point next = { line.beg.x + ts[i] * dx, line.beg.y + ts[i] * dy };
+		next = ClampPoint(next, dims);
+		DrawLongLine(ws, (Line) { prev, next });
+		prev = next;
+	}
+	DrawLongLine(ws, (Line) { prev, ClampPoint(line.end, dims) });
+}
+
+/*
+Curves are only split up as far as it takes for each part to either lie
+inside the raster and be no longer than a line piece, to be drawn as
+usual, or to be flat enough to be clipped as a line. Curves are
+contained in the hull of their control points, so that's what gets
+checked.
+*/
+static int IsDrawable(Point const * restrict points, int count, SKR_Dimensions dims)
+{
+	float xMin = points[0].x, xMax = points[0].x;
+	float yMin = points[0].y, yMax = points[0].y;
+	for (int i = 0; i < count; ++i) {
+		if (!IsInside(points[i], dims)) return 0;
+		xMin = min(xMin, points[i].x);
+		xMax = max(xMax, points[i].x);
+		yMin = min(yMin, points[i].y);
+		yMax = max(yMax, points[i].y);
+	}
+	return xMax - xMin <= MAX_PIECE_LENGTH && yMax - yMin <= MAX_PIECE_LENGTH;
+}
+
+static void DrawClippedCurve(Workspace * restrict ws, Curve initialCurve)
+{
+	Curve stack[1000];
+	stack[0] = initialCurve;
+	int top = 1;
+	while (top > 0) {
+		Curve curve = stack[--top];
+		Point const hull[3] = { curve.beg, curve.end, curve.ctrl };
+		if (IsDrawable(hull, 3, ws->dims)) {
+			DrawCurve(ws, curve);
+		} else if (IsBeyondEdge(hull, 3, ws->dims) || IsFlat(curve, ws->flatness)) {
+			DrawClippedLine(ws, (Line) { curve.beg, curve.end });
+		} else {
+			SKR_assert(top + 2 <= 1000);
+			SplitCurve(curve, &stack[top]);
+			top += 2;
+		}
+	}
+}
+
+static void DrawClippedCubic(Workspace * restrict ws, Cubic initialCubic)
+{
+	Cubic stack[1000];
+	stack[0] = initialCubic;
+	int top = 1;
+	while (top > 0) {
+		Cubic cubic = stack[--top];
+		Point const hull[4] = { cubic.beg, cubic.end, cubic.ctrl1, cubic.ctrl2 };
+		if (IsDrawable(hull, 4, ws->dims)) {
+			DrawCubic(ws, cubic);
+		} else if (IsBeyondEdge(hull, 4, ws->dims) || IsCubicFlat(cubic, ws->flatness)) {
+			DrawClippedLine(ws, (Line) { cubic.beg, cubic.end });
+		} else {
+			SKR_assert(top + 2 <= 1000);
+			SplitCubic(cubic, &stack[top]);
+			top += 2;
+		}
+	}
+}
+
+/*
+======== paths ========
+
+The pen is kept in pixels, after the affine has been applied, which
+works out the same for the control points of curves as for their
+points, since curves stay curves of the same kind under any affine.
+*/
+
+static Point TransformPoint(SKR_Affine affine, float x, float y)
+{
+	return (Point) {
+		x * affine.xx + y * affine.xy + affine.dx,
+		x * affine.yx + y * affine.yy + affine.dy };
+}
+
+static Workspace PathWorkspace(SKR_Path const * restrict path)
+{
+	Workspace ws = PackedWorkspace(path->raster, path->dims);
+	ApplyQuality(&ws, path->quality);
+	return ws;
+}
+
+SKR_Status skrBeginPath(SKR_Path * restrict path, SKR_Affine affine, SKR_Quality quality,
+	RasterCell * restrict raster, SKR_Dimensions dims)
+{
+	if ((unsigned int) quality > SKR_QUALITY_FAST) return SKR_FAILURE;
+	*path = (SKR_Path) { raster, dims, affine, quality, 0.0f, 0.0f, 0.0f, 0.0f };
+	return SKR_SUCCESS;
+}
+
+void skrMoveTo(SKR_Path * restrict path, float x, float y)
+{
+	skrClosePath(path);
+	Point p = TransformPoint(path->affine, x, y);
+	path->startX = path->x = p.x;
+	path->startY = path->y = p.y;
+}
+
+void skrLineTo(SKR_Path * restrict path, float x, float y)
+{
+	Workspace ws = PathWorkspace(path);
+	Point beg = { path->x, path->y };
+	Point end = TransformPoint(path->affine, x, y);
+	DrawClippedLine(&ws, (Line) { beg, end });
+	path->x = end.x;
+	path->y = end.y;
+}
+
+void skrQuadTo(SKR_Path * restrict path, float cx, float cy, float x, float y)
+{
+	Workspace ws = PathWorkspace(path);
+	Point beg = { path->x, path->y };
+	Point ctrl = TransformPoint(path->affine, cx, cy);
+	Point end = TransformPoint(path->affine, x, y);
+	DrawClippedCurve(&ws, (Curve) { beg, end, ctrl });
+	path->x = end.x;
+	path->y = end.y;
+}
+
+void skrCubicTo(SKR_Path * restrict path, float c1x, float c1y,
+	float c2x, float c2y, float x, float y)
+{
+	Workspace ws = PathWorkspace(path);
+	Point beg = { path->x, path->y };
+	Point ctrl1 = TransformPoint(path->affine, c1x, c1y);
+	Point ctrl2 = TransformPoint(path->affine, c2x, c2y);
+	Point end = TransformPoint(path->affine, x, y);
+	DrawClippedCubic(&ws, (Cubic) { beg, end, ctrl1, ctrl2 });
+	path->x = end.x;
+	path->y = end.y;
+}
+
+void skrClosePath(SKR_Path * restrict path)
+{
+	if (path->x == path->startX && path->y == path->startY) return;
+	Workspace ws = PathWorkspace(path);
+	Point beg = { path->x, path->y };
+	Point end = { path->startX, path->startY };
+	DrawClippedLine(&ws, (Line) { beg, end });
+	path->x = end.x;
+	path->y = end.y;
+}
@@ -22,48 +22,153 @@ typedef struct {
 	TTF_OffsetEntry entries[];
 } TFF_OffsetTable;
 
-static SKR_Status ScanForOffsetEntry(
-	TFF_OffsetTable const * restrict offt,
-	int * restrict cur,
-	char tag[4],
-	SKR_TTF_Table * restrict table)
+/*
+Multiplicative hashing works well enough here since tags are
+just four printable characters, and the index is almost never full.
+*/
+static unsigned int HashTag(uint32_t tag)
+{
+	return (tag * 2654435761u) >> 16 & (SKR_TABLE_SLOTS - 1);
+}
+
+static void InsertIntoIndex(SKR_Font * restrict font,
+	uint32_t tag, SKR_TTF_Table table)
+{
+	unsigned int slot = HashTag(tag);
+	while (font->tableIndex[slot].tag != 0) {
+		slot = (slot + 1) & (SKR_TABLE_SLOTS - 1);
+	}
+	font->tableIndex[slot] = (SKR_TableSlot) { tag, table };
+}
+
+static SKR_Status BuildTableIndex(SKR_Font * restrict font)
 {
-	int count = ru16(offt->numTables);
+	TFF_OffsetTable const * restrict offt = (TFF_OffsetTable const *)
+		((BYTES1 *) font->data + font->directory);
+	font->numTables = ru16(offt->numTables);
+	if (font->length != 0 && font->directory + sizeof(TFF_OffsetTable) +
+		font->numTables * sizeof(TTF_OffsetEntry) > font->length) return SKR_FAILURE;
+
+	for (int i = 0; i < SKR_TABLE_SLOTS; ++i) {
+		font->tableIndex[i] = (SKR_TableSlot) { 0, { 0, 0 } };
+	}
+
+	/* Keep the load factor low so that probe sequences stay short. */
+	int const maxIndexed = SKR_TABLE_SLOTS * 3 / 4;
+	font->indexOverflow = font->numTables > maxIndexed;
+
+	for (int i = 0; i < font->numTables; ++i) {
+		TTF_OffsetEntry const * restrict entry = &offt->entries[i];
+		uint32_t tag = TagFromString(entry->tag);
+		SKR_TTF_Table table = { ru32(entry->offset), ru32(entry->length) };
+		if (font->length != 0 && (table.offset > font->length ||
+			table.length > font->length - table.offset)) return SKR_FAILURE;
+		if (tag == 0) return SKR_FAILURE;
+		if (i < maxIndexed) InsertIntoIndex(font, tag, table);
+	}
+
+	return SKR_SUCCESS;
+}
+
+static SKR_Status SearchDirectory(SKR_Font const * restrict font,
+	uint32_t tag, SKR_TTF_Table * restrict table)
+{
+	TFF_OffsetTable const * restrict offt = (TFF_OffsetTable const *)
+		((BYTES1 *) font->data + font->directory);
+	int lower = 0, upper = font->numTables;
+	while (lower < upper) {
+		int mid = lower + (upper - lower) / 2;
+		TTF_OffsetEntry const * restrict entry = &offt->entries[mid];
+		uint32_t midTag = TagFromString(entry->tag);
+		if (midTag < tag) {
+			lower = mid + 1;
+		} else if (midTag > tag) {
+			upper = mid;
+		} else {
+			table->offset = ru32(entry->offset);
+			table->length = ru32(entry->length);
+			return SKR_SUCCESS;
+		}
+	}
+	return SKR_FAILURE;
+}
+
+SKR_Status FindTable(SKR_Font const * restrict font,
+	uint32_t tag, SKR_TTF_Table * restrict table)
+{
+	unsigned int slot = HashTag(tag);
 	for (;;) {
-		int cmp = CompareStrings(offt->entries[*cur].tag, tag, 4);
-		if (!cmp) {
-			table->offset = ru32(offt->entries[*cur].offset);
-			table->length = ru32(offt->entries[*cur].length);
+		SKR_TableSlot const * restrict entry = &font->tableIndex[slot];
+		if (entry->tag == tag) {
+			*table = entry->table;
 			return SKR_SUCCESS;
-		} else if (cmp > 0) {
-			return SKR_FAILURE;
-		} else if (!(*cur < count)) {
-			return SKR_FAILURE;
 		}
-		++*cur;
+		if (entry->tag == 0) break;
+		slot = (slot + 1) & (SKR_TABLE_SLOTS - 1);
+	}
+	return font->indexOverflow ? SearchDirectory(font, tag, table) : SKR_FAILURE;
+}
+
+SKR_Status skrFindTable(SKR_Font const * restrict font,
+	char const tag[4], SKR_TTF_Table * restrict table)
+{
+	return FindTable(font, TagFromString(tag), table);
+}
+
+/*
+FNV-1a over the raw directory entries, which already include a checksum
+for every table. The length of the file is mixed in as well,
+to catch truncated files.
+*/
+SKR_Status CalcDirectoryChecksum(SKR_Font const * restrict font,
+	unsigned long directory, uint32_t * restrict checksum)
+{
+	if (font->length != 0 && directory + sizeof(TFF_OffsetTable) > font->length)
+		return SKR_FAILURE;
+	TFF_OffsetTable const * restrict offt = (TFF_OffsetTable const *)
+		((BYTES1 *) font->data + directory);
+	unsigned long numTables = ru16(offt->numTables);
+	unsigned long size = sizeof(TFF_OffsetTable) + numTables * sizeof(TTF_OffsetEntry);
+	if (font->length != 0 && directory + size > font->length) return SKR_FAILURE;
+
+	uint32_t hash = 2166136261u;
+	BYTES1 * restrict bytes = (BYTES1 *) offt;
+	for (unsigned long i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 16777619u;
 	}
+	for (int i = 0; i < 4; ++i) {
+		hash = (hash ^ (uint8_t) (font->length >> 8 * i)) * 16777619u;
+	}
+	*checksum = hash;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrGetFontChecksum(SKR_Font const * restrict font,
+	uint32_t * restrict checksum)
+{
+	return CalcDirectoryChecksum(font, font->directory, checksum);
 }
 
 static SKR_Status ExtractOffsets(SKR_Font * restrict font)
 {
-	SKR_Status s = SKR_SUCCESS;
-	TFF_OffsetTable const * restrict offt =
-		(TFF_OffsetTable const *) font->data;
-	int cur = 0;
-	s = ScanForOffsetEntry(offt, &cur, "cmap", &font->cmap);
+	SKR_Status s = BuildTableIndex(font);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "glyf", &font->glyf);
+	s = FindTable(font, TagFromString("cmap"), &font->cmap);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "head", &font->head);
+	s = FindTable(font, TagFromString("head"), &font->head);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "hhea", &font->hhea);
+	s = FindTable(font, TagFromString("hhea"), &font->hhea);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "hmtx", &font->hmtx);
+	s = FindTable(font, TagFromString("hmtx"), &font->hmtx);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "loca", &font->loca);
+	s = FindTable(font, TagFromString("maxp"), &font->maxp);
 	if (s) return s;
-	s = ScanForOffsetEntry(offt, &cur, "maxp", &font->maxp);
-	return s;
+	/* Fonts with CFF outlines have neither (see Charstrings.c). */
+	if (FindTable(font, TagFromString("glyf"), &font->glyf) ||
+		FindTable(font, TagFromString("loca"), &font->loca)) {
+		font->glyf = font->loca = (SKR_TTF_Table) { 0, 0 };
+	}
+	return SKR_SUCCESS;
 }
 
 typedef struct {
@@ -117,6 +222,8 @@ static SKR_Status Parse_hhea(SKR_Font * restrict font)
 {
 	TTF_hhea const * restrict hhea = (TTF_hhea const *)
 		((BYTES1 *) font->data + font->hhea.offset);
+	font->ascender = ri16(hhea->ascender);
+	font->descender = ri16(hhea->descender);
 	font->lineGap = ri16(hhea->lineGap);
 	font->numberOfHMetrics = ru16(hhea->numberOfHMetrics);
 	return SKR_SUCCESS;
@@ -144,7 +251,8 @@ static SKR_Status Parse_maxp(SKR_Font * restrict font)
 {
 	TTF_maxp const * restrict maxp = (TTF_maxp const *)
 		((BYTES1 *) font->data + font->maxp.offset);
-	if (ru32(maxp->version) != 0x00010000)
+	/* version 0.5 only has numGlyphs, which is all there is for CFF outlines */
+	if (ru32(maxp->version) != 0x00010000 && ru32(maxp->version) != 0x00005000)
 		return SKR_FAILURE;
 	font->numGlyphs = ru16(maxp->numGlyphs);
 	return SKR_SUCCESS;
@@ -309,9 +417,68 @@ static SKR_Status Parse_cmap(SKR_Font * restrict font)
 	return s;
 }
 
-SKR_Status skrInitializeFont(SKR_Font * restrict font)
+typedef struct {
+	BYTES4 ttcTag;
+	BYTES2 majorVersion;
+	BYTES2 minorVersion;
+	BYTES4 numFonts;
+	BYTES4 offsetTables[];
+} TTF_CollectionHeader;
+
+static int IsCollection(SKR_Font const * restrict font)
+{
+	TTF_CollectionHeader const * restrict ttc =
+		(TTF_CollectionHeader const *) font->data;
+	return ru32(ttc->ttcTag) == TagFromString("ttcf");
+}
+
+SKR_Status skrCountFaces(SKR_Font const * restrict font, int * restrict count)
+{
+	if (!IsCollection(font)) {
+		*count = 1;
+		return SKR_SUCCESS;
+	}
+	TTF_CollectionHeader const * restrict ttc =
+		(TTF_CollectionHeader const *) font->data;
+	unsigned long numFonts = ru32(ttc->numFonts);
+	if (numFonts > INT_MAX) return SKR_FAILURE;
+	if (font->length != 0 && sizeof(TTF_CollectionHeader) +
+		numFonts * sizeof(BYTES4) > font->length) return SKR_FAILURE;
+	*count = numFonts;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status LocateFace(SKR_Font * restrict font, int faceIndex)
+{
+	int count;
+	SKR_Status s = skrCountFaces(font, &count);
+	if (s) return s;
+	if (faceIndex < 0 || faceIndex >= count) return SKR_FAILURE;
+	font->faceIndex = faceIndex;
+	if (!IsCollection(font)) {
+		font->directory = 0;
+		return SKR_SUCCESS;
+	}
+	TTF_CollectionHeader const * restrict ttc =
+		(TTF_CollectionHeader const *) font->data;
+	font->directory = ru32(ttc->offsetTables[faceIndex]);
+	if (font->length != 0 && font->directory > font->length) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrInitializeFace(SKR_Font * restrict font, int faceIndex)
 {
 	SKR_Status s;
+	font->cachedGlyphs = 0;
+	font->numCachedCodes = 0;
+	font->cachedMetrics = 0;
+	font->cachedBoxes = 0;
+	font->cachedOutlines = 0;
+	font->cachedKerning = 0;
+	font->parsedTables = 0;
+	font->instance = 0;
+	s = LocateFace(font, faceIndex);
+	if (s) return s;
 	s = ExtractOffsets(font);
 	if (s) return s;
 	s = Parse_head(font);
@@ -320,7 +487,13 @@ SKR_Status skrInitializeFont(SKR_Font * restrict font)
 	if (s) return s;
 	s = Parse_maxp(font);
 	if (s) return s;
+	s = ParseCharstringTables(font);
+	if (s) return s;
 	s = Parse_cmap(font);
 	return s;
 }
 
+SKR_Status skrInitializeFont(SKR_Font * restrict font)
+{
+	return skrInitializeFace(font, 0);
+}
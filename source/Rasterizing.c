@@ -25,12 +25,26 @@ static void RasterizeDot(
 
 	uint32_t idx = ws->rasterWidth * (qly / GRAIN) + qlx / GRAIN;
 
-	uint32_t cell = ws->raster[idx];
-
 	int32_t windingAndCover = qbx - qex;
-	int32_t area = GRAIN - gabs(qby - qey) / 2 - (qly & (GRAIN - 1));
+	int32_t area = GRAIN - gabs((int32_t) (qby - qey)) / 2 - (qly & (GRAIN - 1));
 	int32_t edgeValue = windingAndCover * area / GRAIN;
 
+	if (ws->raster == 0) {
+		uint32_t tileX = qlx / GRAIN / RASTER_TILE_WIDTH;
+		uint32_t tileY = qly / GRAIN / RASTER_TILE_HEIGHT;
+		if (!ws->tiles[tileY * ws->tileColumns + tileX]) ClaimTile(ws, tileX, tileY);
+		if (ws->edges != 0) {
+			ws->edges[idx] += edgeValue;
+			ws->tails[idx] += windingAndCover;
+		} else {
+			ws->wideEdges[idx] += edgeValue;
+			ws->wideTails[idx] += windingAndCover;
+		}
+		return;
+	}
+
+	uint32_t cell = ws->raster[idx];
+
 	((int16_t * restrict) &cell)[0] += edgeValue;
 	((int16_t * restrict) &cell)[1] += windingAndCover;
 
@@ -86,10 +100,17 @@ static void RasterizeLine(Workspace * restrict ws, Line line)
 	RasterizeDot(ws, prev_qx, prev_qy, qx, qy);
 }
 
+/*
+Lines that start and end on the same quantized column add no winding
+to the cells below them, and next to no coverage to their own,
+so they can be dropped.
+Going by the unquantized distance instead would lose the steep, short
+lines that do cross a quantization step, and with them part of the
+winding, which mostly happens with rotated outlines.
+*/
 void DrawLine(Workspace * restrict ws, Line line)
 {
-	float diff = line.end.x - line.beg.x;
-	if (diff <= -1.0f / GRAIN || 1.0f / GRAIN <= diff) {
+	if (QUANTIZE(line.beg.x) != QUANTIZE(line.end.x)) {
 		RasterizeLine(ws, line);
 	}
 }
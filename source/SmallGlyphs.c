@@ -0,0 +1,356 @@
+#include "Internals.h"
+
+#include <immintrin.h> // TODO MSVC
+
+/*
+======== small glyphs ========
+
+Glyphs that cover only a few pixels are mostly fixed overhead in the
+general path: float line walking, curve subdivision on an explicit
+stack, and cells packed into the shared raster. Here instead, the whole
+glyph is drawn into a tile on the stack, with all coordinates as
+integers in GRAIN units. Edges and tails go into separate planes,
+and the finished tile gets added onto the raster in one go.
+The cells follow the same rules as in RasterizeDot(),
+so both paths can share a raster.
+*/
+
+typedef struct {
+	int16_t edge[SMALL_TILE_SIZE * SMALL_TILE_SIZE];
+	int16_t tail[SMALL_TILE_SIZE * SMALL_TILE_SIZE];
+} Tile;
+
+/* The same as RasterizeDot(), just relative to the tile. */
+static inline void TileDot(Tile * restrict tile,
+	int32_t bx, int32_t by, int32_t ex, int32_t ey)
+{
+	int32_t lx = min(bx, ex);
+	int32_t ly = min(by, ey);
+	int idx = (ly >> GRAIN_BITS) * SMALL_TILE_SIZE + (lx >> GRAIN_BITS);
+	int32_t windingAndCover = bx - ex;
+	int32_t area = GRAIN - gabs(by - ey) / 2 - (ly & (GRAIN - 1));
+	tile->edge[idx] += windingAndCover * area / GRAIN;
+	tile->tail[idx] += windingAndCover;
+}
+
+/* How many pixel edges lie strictly between a and b. */
+static inline int32_t CountEdges(int32_t a, int32_t b)
+{
+	int32_t lo = min(a, b), hi = max(a, b);
+	return max(((hi - 1) >> GRAIN_BITS) - (lo >> GRAIN_BITS), 0);
+}
+
+/*
+Walks a line through the tile cell by cell. Most lines of a small glyph
+only cross pixel edges along one axis, so those get a loop of their own.
+Otherwise, the crossings are ordered by cross-multiplying instead of
+dividing, so the only division per crossing is for the coordinate along
+the edge. Either way, the line gets split at the same points.
+*/
+static void TileLine(Tile * restrict tile,
+	int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	if (x0 == x1) return;
+	int32_t dx = x1 - x0, dy = y1 - y0;
+	int32_t xCrossings = CountEdges(x0, x1);
+	int32_t yCrossings = CountEdges(y0, y1);
+
+	int32_t xStep = dx > 0 ? GRAIN : -GRAIN;
+	int32_t yStep = dy > 0 ? GRAIN : -GRAIN;
+	/* the next pixel edges to be crossed */
+	int32_t xEdge = dx > 0 ? (x0 & ~(GRAIN - 1)) + GRAIN : ((x0 - 1) & ~(GRAIN - 1));
+	int32_t yEdge = dy > 0 ? (y0 & ~(GRAIN - 1)) + GRAIN : ((y0 - 1) & ~(GRAIN - 1));
+	/* all products stay well within 32 bits, since coordinates never leave the tile */
+	int32_t px = x0, py = y0;
+
+	if (xCrossings == 0) {
+		for (int32_t i = 0; i < yCrossings; ++i) {
+			int32_t nx = x0 + (yEdge - y0) * dx / dy;
+			TileDot(tile, px, py, nx, yEdge);
+			px = nx, py = yEdge;
+			yEdge += yStep;
+		}
+		TileDot(tile, px, py, x1, y1);
+		return;
+	}
+	if (yCrossings == 0) {
+		for (int32_t i = 0; i < xCrossings; ++i) {
+			int32_t ny = y0 + (xEdge - x0) * dy / dx;
+			TileDot(tile, px, py, xEdge, ny);
+			px = xEdge, py = ny;
+			xEdge += xStep;
+		}
+		TileDot(tile, px, py, x1, y1);
+		return;
+	}
+
+	int32_t adx = gabs(dx), ady = gabs(dy);
+	for (;;) {
+		/* distances to the next edges, along the respective axis */
+		int32_t xDist = gabs(xEdge - x0), yDist = gabs(yEdge - y0);
+		int xDone = xDist >= adx;
+		int yDone = yDist >= ady;
+		if (xDone && yDone) break;
+
+		int32_t nx, ny;
+		if (!xDone && (yDone || xDist * ady <= yDist * adx)) {
+			nx = xEdge;
+			ny = y0 + (xEdge - x0) * dy / dx;
+			if (xDist * ady == yDist * adx) yEdge += yStep;
+			xEdge += xStep;
+		} else {
+			ny = yEdge;
+			nx = x0 + (yEdge - y0) * dx / dy;
+			yEdge += yStep;
+		}
+		TileDot(tile, px, py, nx, ny);
+		px = nx, py = ny;
+	}
+	TileDot(tile, px, py, x1, y1);
+}
+
+/*
+The tolerances of the workspace, in GRAIN units. DrawCurve() measures
+flatness against half of the deviation that TileCurve() looks at.
+*/
+typedef struct {
+	int32_t deviation;
+	int32_t mergeLength;
+} Tolerances;
+
+/*
+Flattens a quadratic curve into as many lines as it takes to keep within
+the tolerance of DrawCurve(). Every halving of a curve quarters its
+deviation from the chord, so with n even pieces it is 1 / n^2 of the
+original.
+*/
+static void TileCurve(Tile * restrict tile, FixedPoint beg, FixedPoint ctrl, FixedPoint end,
+	Tolerances tol)
+{
+	int32_t ax = beg.x - 2 * ctrl.x + end.x;
+	int32_t ay = beg.y - 2 * ctrl.y + end.y;
+	int32_t deviation = gabs(ax) + gabs(ay);
+	int32_t n = 1;
+	while (n * n * tol.deviation < deviation) ++n;
+
+	int32_t bx = 2 * (ctrl.x - beg.x), by = 2 * (ctrl.y - beg.y);
+	int32_t nn = n * n;
+	FixedPoint prev = beg;
+	for (int32_t i = 1; i < n; ++i) {
+		/* B(t) = beg + b t + a t^2, at t = i / n */
+		FixedPoint next = {
+			beg.x + (bx * i * n + ax * i * i) / nn,
+			beg.y + (by * i * n + ay * i * i) / nn };
+		TileLine(tile, prev.x, prev.y, next.x, next.y);
+		prev = next;
+	}
+	TileLine(tile, prev.x, prev.y, end.x, end.y);
+}
+
+static FixedPoint FixedMidpoint(FixedPoint a, FixedPoint b)
+{
+	return (FixedPoint) { (a.x + b.x) / 2, (a.y + b.y) / 2 };
+}
+
+static int IsShortFixed(FixedPoint a, FixedPoint b, int32_t length)
+{
+	return gabs(a.x - b.x) + gabs(a.y - b.y) < length;
+}
+
+/*
+Mirrors ExtendContour(), with the state kept in locals.
+A contour may also begin with an off-curve point, in which case
+it starts at the last point, or at the implicit point in between.
+*/
+static void TileContour(Tile * restrict tile, FixedPoint const * restrict points,
+	uint8_t const * restrict onCurve, int first, int last, Tolerances tol)
+{
+	FixedPoint close;
+	if (onCurve[first]) {
+		close = points[first++];
+	} else if (onCurve[last]) {
+		close = points[last--];
+	} else {
+		close = FixedMidpoint(points[first], points[last]);
+	}
+
+	FixedPoint start = close, pivot = { 0, 0 }, lineEnd = { 0, 0 };
+	int pivotQueued = 0, lineQueued = 0;
+	for (int i = first; i <= last + 1; ++i) {
+		/* the starting point closes the loop */
+		FixedPoint node = i <= last ? points[i] : close;
+		int nodeOnCurve = i <= last ? onCurve[i] : 1;
+		if (!pivotQueued && !nodeOnCurve) {
+			pivot = node;
+			pivotQueued = 1;
+			continue;
+		}
+		/* a curve ends at the next on-curve point or the implicit point before it */
+		FixedPoint end = nodeOnCurve ? node : FixedMidpoint(pivot, node);
+		if (!pivotQueued || (IsShortFixed(start, pivot, tol.mergeLength) &&
+			IsShortFixed(start, end, tol.mergeLength))) {
+			if (IsShortFixed(start, end, tol.mergeLength)) {
+				lineEnd = end;
+				lineQueued = 1;
+			} else {
+				TileLine(tile, start.x, start.y, end.x, end.y);
+				start = end;
+				lineQueued = 0;
+			}
+		} else {
+			if (lineQueued) {
+				TileLine(tile, start.x, start.y, lineEnd.x, lineEnd.y);
+				start = lineEnd;
+				lineQueued = 0;
+			}
+			TileCurve(tile, start, pivot, end, tol);
+			start = end;
+		}
+		pivot = node;
+		pivotQueued = !nodeOnCurve;
+	}
+	if (lineQueued) {
+		TileLine(tile, start.x, start.y, lineEnd.x, lineEnd.y);
+	}
+}
+
+/*
+The tile is blank past dims.width, so whole vectors of it can run on
+into the padding at the end of the raster rows, as far as that goes.
+*/
+static long VectorWidth(Workspace const * restrict ws, long xOrigin, SKR_Dimensions dims)
+{
+	return min((long) (dims.width + 7) & ~7l, (long) ws->rasterWidth - xOrigin);
+}
+
+/* Planar rasters have the same layout as the tile, just wider. */
+static void MergeTilePlanar(Tile const * restrict tile, Workspace * restrict ws,
+	long xOrigin, long yOrigin, SKR_Dimensions dims)
+{
+	long width = dims.width, height = dims.height;
+	long vectorWidth = VectorWidth(ws, xOrigin, dims);
+	for (long row = 0; row < height; ++row) {
+		int16_t const * restrict edge = tile->edge + row * SMALL_TILE_SIZE;
+		int16_t const * restrict tail = tile->tail + row * SMALL_TILE_SIZE;
+		unsigned long start = (yOrigin + row) * ws->rasterWidth + xOrigin;
+		int16_t * restrict edges = ws->edges + start;
+		int16_t * restrict tails = ws->tails + start;
+		long col = 0;
+		for (; col + 8 <= vectorWidth; col += 8) {
+			__m128i * restrict e = (__m128i *) (edges + col);
+			__m128i * restrict t = (__m128i *) (tails + col);
+			_mm_storeu_si128(e, _mm_add_epi16(_mm_loadu_si128(e),
+				_mm_loadu_si128((__m128i const *) (edge + col))));
+			_mm_storeu_si128(t, _mm_add_epi16(_mm_loadu_si128(t),
+				_mm_loadu_si128((__m128i const *) (tail + col))));
+		}
+		for (; col < width; ++col) {
+			edges[col] += edge[col];
+			tails[col] += tail[col];
+		}
+	}
+}
+
+/* Wide planes get the tile widened to 32 bits, with the sign extended. */
+static void MergeTileWide(Tile const * restrict tile, Workspace * restrict ws,
+	long xOrigin, long yOrigin, SKR_Dimensions dims)
+{
+	long width = dims.width, height = dims.height;
+	long vectorWidth = VectorWidth(ws, xOrigin, dims);
+	for (long row = 0; row < height; ++row) {
+		int16_t const * restrict edge = tile->edge + row * SMALL_TILE_SIZE;
+		int16_t const * restrict tail = tile->tail + row * SMALL_TILE_SIZE;
+		unsigned long start = (yOrigin + row) * ws->rasterWidth + xOrigin;
+		int32_t * restrict edges = ws->wideEdges + start;
+		int32_t * restrict tails = ws->wideTails + start;
+		long col = 0;
+		for (; col + 8 <= vectorWidth; col += 8) {
+			__m128i e = _mm_loadu_si128((__m128i const *) (edge + col));
+			__m128i t = _mm_loadu_si128((__m128i const *) (tail + col));
+			__m128i * restrict ep = (__m128i *) (edges + col);
+			__m128i * restrict tp = (__m128i *) (tails + col);
+			_mm_storeu_si128(ep + 0, _mm_add_epi32(_mm_loadu_si128(ep + 0),
+				_mm_srai_epi32(_mm_unpacklo_epi16(e, e), 16)));
+			_mm_storeu_si128(ep + 1, _mm_add_epi32(_mm_loadu_si128(ep + 1),
+				_mm_srai_epi32(_mm_unpackhi_epi16(e, e), 16)));
+			_mm_storeu_si128(tp + 0, _mm_add_epi32(_mm_loadu_si128(tp + 0),
+				_mm_srai_epi32(_mm_unpacklo_epi16(t, t), 16)));
+			_mm_storeu_si128(tp + 1, _mm_add_epi32(_mm_loadu_si128(tp + 1),
+				_mm_srai_epi32(_mm_unpackhi_epi16(t, t), 16)));
+		}
+		for (; col < width; ++col) {
+			edges[col] += edge[col];
+			tails[col] += tail[col];
+		}
+	}
+}
+
+/*
+Adds the tile onto the raster, where cells pack the edge into their
+lower and the tail into their upper 16 bits. Interleaving the planes
+produces exactly that layout, so eight cells can be added at once.
+*/
+static void MergeTile(Tile const * restrict tile, Workspace * restrict ws,
+	long xOrigin, long yOrigin, SKR_Dimensions dims)
+{
+	if (ws->raster == 0) {
+		ClaimTiles(ws, xOrigin, yOrigin, xOrigin + dims.width, yOrigin + dims.height);
+		if (ws->edges != 0) {
+			MergeTilePlanar(tile, ws, xOrigin, yOrigin, dims);
+		} else {
+			MergeTileWide(tile, ws, xOrigin, yOrigin, dims);
+		}
+		return;
+	}
+	long width = dims.width, height = dims.height;
+	long vectorWidth = VectorWidth(ws, xOrigin, dims);
+	for (long row = 0; row < height; ++row) {
+		int16_t const * restrict edge = tile->edge + row * SMALL_TILE_SIZE;
+		int16_t const * restrict tail = tile->tail + row * SMALL_TILE_SIZE;
+		RasterCell * restrict cells = ws->raster + (yOrigin + row) * ws->rasterWidth + xOrigin;
+		long col = 0;
+		for (; col + 8 <= vectorWidth; col += 8) {
+			__m128i e = _mm_loadu_si128((__m128i const *) (edge + col));
+			__m128i t = _mm_loadu_si128((__m128i const *) (tail + col));
+			__m128i * restrict target = (__m128i *) (cells + col);
+			_mm_storeu_si128(target + 0, _mm_add_epi16(_mm_loadu_si128(target + 0),
+				_mm_unpacklo_epi16(e, t)));
+			_mm_storeu_si128(target + 1, _mm_add_epi16(_mm_loadu_si128(target + 1),
+				_mm_unpackhi_epi16(e, t)));
+		}
+		for (; col < width; ++col) {
+			RasterCell cell = cells[col];
+			uint16_t e = (uint16_t) (cell & 0xFFFF) + (uint16_t) edge[col];
+			uint16_t t = (uint16_t) (cell >> 16) + (uint16_t) tail[col];
+			cells[col] = (RasterCell) e | (RasterCell) t << 16;
+		}
+	}
+}
+
+/*
+The caller makes sure that the tile lies within the raster, and that
+all points lie within the tile, at most dims.width by dims.height pixels.
+*/
+void DrawSmallOutline(Workspace * restrict ws, long xOrigin, long yOrigin,
+	SKR_Dimensions dims, FixedPoint const * restrict points,
+	uint8_t const * restrict onCurve, uint16_t const * restrict contourEnds, int numContours)
+{
+	Tile tile;
+	unsigned long used = dims.height * SMALL_TILE_SIZE;
+	for (unsigned long i = 0; i < used; ++i) {
+		tile.edge[i] = 0;
+		tile.tail[i] = 0;
+	}
+
+	Tolerances tol = {
+		ws->flatness * 2 * GRAIN, ws->mergeLength * GRAIN };
+	int first = 0;
+	for (int c = 0; c < numContours; ++c) {
+		if (contourEnds[c] >= first) {
+			TileContour(&tile, points, onCurve, first, contourEnds[c], tol);
+		}
+		first = contourEnds[c] + 1;
+	}
+
+	MergeTile(&tile, ws, xOrigin, yOrigin, dims);
+}
@@ -0,0 +1,410 @@
+#include "Internals.h"
+
+/*
+======== embedded bitmaps ========
+
+EBLC locates the bitmaps of each strike, EBDT holds them. Color fonts
+use CBLC and CBDT instead, which work just the same, but mostly contain
+PNG images (formats 17 to 19). Those would need an inflate implementation,
+so glyphs stored that way, as well as composite bitmaps (formats 8 and 9),
+are treated as missing from the strike, and get drawn from their outlines.
+*/
+
+typedef struct {
+	BYTES4 version;
+	BYTES4 numSizes;
+} TTF_EBLC;
+
+typedef struct {
+	BYTES4 indexSubTableArrayOffset;
+	BYTES4 indexTablesSize;
+	BYTES4 numberOfIndexSubTables;
+	BYTES4 colorRef;
+	BYTES1 hori[12];
+	BYTES1 vert[12];
+	BYTES2 startGlyphIndex;
+	BYTES2 endGlyphIndex;
+	BYTES1 ppemX;
+	BYTES1 ppemY;
+	BYTES1 bitDepth;
+	BYTES1 flags;
+} TTF_BitmapSize;
+
+typedef struct {
+	BYTES2 firstGlyphIndex;
+	BYTES2 lastGlyphIndex;
+	BYTES4 additionalOffsetToIndexSubtable;
+} TTF_IndexSubTableArray;
+
+typedef struct {
+	BYTES2 indexFormat;
+	BYTES2 imageFormat;
+	BYTES4 imageDataOffset;
+} TTF_IndexSubHeader;
+
+typedef struct {
+	BYTES1 height;
+	BYTES1 width;
+	BYTES1 bearingX;
+	BYTES1 bearingY;
+	BYTES1 advance;
+} TTF_SmallGlyphMetrics;
+
+typedef struct {
+	BYTES1 height;
+	BYTES1 width;
+	BYTES1 horiBearingX;
+	BYTES1 horiBearingY;
+	BYTES1 horiAdvance;
+	BYTES1 vertBearingX;
+	BYTES1 vertBearingY;
+	BYTES1 vertAdvance;
+} TTF_BigGlyphMetrics;
+
+/* Placement of the bitmap relative to the glyph origin, y up. */
+static SKR_BitmapMetrics MetricsFromBearings(int width, int height,
+	int8_t bearingX, int8_t bearingY, int advance)
+{
+	return (SKR_BitmapMetrics) { bearingX, bearingY - height,
+		width, height, advance };
+}
+
+static SKR_BitmapMetrics ReadSmallMetrics(BYTES1 * addr)
+{
+	TTF_SmallGlyphMetrics const * restrict m = (TTF_SmallGlyphMetrics const *) addr;
+	return MetricsFromBearings(m->width, m->height,
+		(int8_t) m->bearingX, (int8_t) m->bearingY, m->advance);
+}
+
+static SKR_BitmapMetrics ReadBigMetrics(BYTES1 * addr)
+{
+	TTF_BigGlyphMetrics const * restrict m = (TTF_BigGlyphMetrics const *) addr;
+	return MetricsFromBearings(m->width, m->height,
+		(int8_t) m->horiBearingX, (int8_t) m->horiBearingY, m->horiAdvance);
+}
+
+static int LocateTablePair(SKR_Font const * restrict font,
+	char const * locationTag, char const * dataTag, SKR_Strikes * restrict strikes)
+{
+	if (FindTable(font, TagFromString(locationTag), &strikes->location)) return 0;
+	if (FindTable(font, TagFromString(dataTag), &strikes->data)) return 0;
+	if (strikes->location.length < sizeof(TTF_EBLC)) return 0;
+	TTF_EBLC const * restrict eblc = (TTF_EBLC const *)
+		((BYTES1 *) font->data + strikes->location.offset);
+	unsigned long numSizes = ru32(eblc->numSizes);
+	if (numSizes > (strikes->location.length - sizeof(TTF_EBLC)) / sizeof(TTF_BitmapSize))
+		return 0;
+	strikes->numSizes = numSizes;
+	return 1;
+}
+
+void LocateStrikes(SKR_Font const * restrict font, SKR_Strikes * restrict strikes)
+{
+	if (LocateTablePair(font, "EBLC", "EBDT", strikes)) return;
+	if (LocateTablePair(font, "CBLC", "CBDT", strikes)) return;
+	*strikes = (SKR_Strikes) { { 0, 0 }, { 0, 0 }, 0 };
+}
+
+void GetStrikes(SKR_Font const * restrict font, SKR_Strikes * restrict strikes)
+{
+	if (ParsedTables(font) & PARSED_STRIKES) {
+		*strikes = font->strikes;
+	} else {
+		LocateStrikes(font, strikes);
+	}
+}
+
+/*
+Only strikes of exactly the requested size are of any use, since the
+whole point of them is that they have been tuned by hand for that size.
+If there are several, the one with the most gray levels wins.
+*/
+SKR_Status FindStrike(SKR_Font const * restrict font,
+	SKR_Strikes const * restrict strikes, float size, SKR_Strike * restrict strike)
+{
+	SKR_Status s = SKR_FAILURE;
+	TTF_BitmapSize const * restrict sizes = (TTF_BitmapSize const *)
+		((BYTES1 *) font->data + strikes->location.offset + sizeof(TTF_EBLC));
+	for (unsigned long i = 0; i < strikes->numSizes; ++i) {
+		TTF_BitmapSize const * restrict record = &sizes[i];
+		int bitDepth = record->bitDepth;
+		if (size != (float) record->ppemY) continue;
+		if (bitDepth != 1 && bitDepth != 2 && bitDepth != 4 && bitDepth != 8) continue;
+		if (s == SKR_SUCCESS && bitDepth <= strike->bitDepth) continue;
+		*strike = (SKR_Strike) { strikes->location, strikes->data,
+			(BYTES1 *) record - (BYTES1 *) font->data, record->ppemY, bitDepth };
+		s = SKR_SUCCESS;
+	}
+	return s;
+}
+
+/*
+Finds the subtable that covers the glyph, and from it the offset
+of the glyph data in EBDT and its length. A length of 0 means
+the glyph is missing from the strike.
+*/
+static SKR_Status LocateGlyphData(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph,
+	TTF_IndexSubHeader const * restrict * restrict header,
+	unsigned long * restrict offset, unsigned long * restrict length)
+{
+	BYTES1 * base = (BYTES1 *) font->data;
+	TTF_BitmapSize const * restrict record = (TTF_BitmapSize const *) (base + strike->sizeRecord);
+	if (glyph < ru16(record->startGlyphIndex) || glyph > ru16(record->endGlyphIndex))
+		return SKR_FAILURE;
+
+	unsigned long arrayOffset = strike->location.offset + ru32(record->indexSubTableArrayOffset);
+	unsigned long numSubTables = ru32(record->numberOfIndexSubTables);
+	if (numSubTables > strike->location.length / sizeof(TTF_IndexSubTableArray)) return SKR_FAILURE;
+	if (!InsideTable(strike->location, arrayOffset, numSubTables * sizeof(TTF_IndexSubTableArray)))
+		return SKR_FAILURE;
+	TTF_IndexSubTableArray const * restrict array =
+		(TTF_IndexSubTableArray const *) (base + arrayOffset);
+
+	/* the subtables are sorted by glyph */
+	unsigned long lower = 0, upper = numSubTables;
+	TTF_IndexSubTableArray const * restrict entry = 0;
+	while (lower < upper) {
+		unsigned long mid = (lower + upper) / 2;
+		if (ru16(array[mid].lastGlyphIndex) < glyph) {
+			lower = mid + 1;
+		} else if (ru16(array[mid].firstGlyphIndex) > glyph) {
+			upper = mid;
+		} else {
+			entry = &array[mid];
+			break;
+		}
+	}
+	if (entry == 0) return SKR_FAILURE;
+
+	unsigned long first = ru16(entry->firstGlyphIndex);
+	unsigned long count = ru16(entry->lastGlyphIndex) - first + 1;
+	unsigned long index = glyph - first;
+	unsigned long subOffset = arrayOffset + ru32(entry->additionalOffsetToIndexSubtable);
+	if (!InsideTable(strike->location, subOffset, sizeof(TTF_IndexSubHeader)))
+		return SKR_FAILURE;
+	BYTES1 * sub = base + subOffset;
+	*header = (TTF_IndexSubHeader const *) sub;
+	BYTES1 * body = sub + sizeof(TTF_IndexSubHeader);
+	unsigned long bodyOffset = subOffset + sizeof(TTF_IndexSubHeader);
+
+	unsigned long begin, end;
+	switch (ru16((*header)->indexFormat)) {
+	case 1:
+		if (!InsideTable(strike->location, bodyOffset, 4 * (count + 1))) return SKR_FAILURE;
+		begin = ru32(((BYTES4 *) body)[index]);
+		end = ru32(((BYTES4 *) body)[index + 1]);
+		break;
+	case 2:
+		if (!InsideTable(strike->location, bodyOffset, 4 + sizeof(TTF_BigGlyphMetrics)))
+			return SKR_FAILURE;
+		begin = ru32(*(BYTES4 *) body) * index;
+		end = begin + ru32(*(BYTES4 *) body);
+		break;
+	case 3:
+		if (!InsideTable(strike->location, bodyOffset, 2 * (count + 1))) return SKR_FAILURE;
+		begin = ru16(((BYTES2 *) body)[index]);
+		end = ru16(((BYTES2 *) body)[index + 1]);
+		break;
+	case 4: {
+		if (!InsideTable(strike->location, bodyOffset, 4)) return SKR_FAILURE;
+		unsigned long numGlyphs = ru32(*(BYTES4 *) body);
+		if (numGlyphs > strike->location.length / 4) return SKR_FAILURE;
+		if (!InsideTable(strike->location, bodyOffset + 4, 4 * (numGlyphs + 1)))
+			return SKR_FAILURE;
+		BYTES2 * pairs = (BYTES2 *) (body + 4);
+		unsigned long lo = 0, hi = numGlyphs;
+		for (;;) {
+			if (lo >= hi) return SKR_FAILURE;
+			unsigned long mid = (lo + hi) / 2;
+			Glyph midGlyph = ru16(pairs[2 * mid]);
+			if (midGlyph < glyph) lo = mid + 1;
+			else if (midGlyph > glyph) hi = mid;
+			else {
+				begin = ru16(pairs[2 * mid + 1]);
+				end = ru16(pairs[2 * mid + 3]);
+				break;
+			}
+		}
+		break;
+	}
+	case 5: {
+		unsigned long fixed = 4 + sizeof(TTF_BigGlyphMetrics) + 4;
+		if (!InsideTable(strike->location, bodyOffset, fixed)) return SKR_FAILURE;
+		unsigned long numGlyphs = ru32(*(BYTES4 *) (body + fixed - 4));
+		if (numGlyphs > strike->location.length / 2) return SKR_FAILURE;
+		if (!InsideTable(strike->location, bodyOffset + fixed, 2 * numGlyphs))
+			return SKR_FAILURE;
+		BYTES2 * glyphs = (BYTES2 *) (body + fixed);
+		unsigned long lo = 0, hi = numGlyphs;
+		for (;;) {
+			if (lo >= hi) return SKR_FAILURE;
+			unsigned long mid = (lo + hi) / 2;
+			Glyph midGlyph = ru16(glyphs[mid]);
+			if (midGlyph < glyph) lo = mid + 1;
+			else if (midGlyph > glyph) hi = mid;
+			else {
+				begin = ru32(*(BYTES4 *) body) * mid;
+				end = begin + ru32(*(BYTES4 *) body);
+				break;
+			}
+		}
+		break;
+	}
+	default:
+		return SKR_FAILURE;
+	}
+
+	if (end < begin) return SKR_FAILURE;
+	*offset = strike->data.offset + ru32((*header)->imageDataOffset) + begin;
+	*length = end - begin;
+	if (!InsideTable(strike->data, *offset, *length)) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+SKR_Status FindStrikeGlyph(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph, StrikeGlyph * restrict sg)
+{
+	TTF_IndexSubHeader const * restrict header;
+	unsigned long offset, length;
+	SKR_Status s = LocateGlyphData(font, strike, glyph, &header, &offset, &length);
+	if (s) return s;
+	if (length == 0) return SKR_FAILURE;
+
+	BYTES1 * data = (BYTES1 *) font->data + offset;
+	unsigned long metricsSize;
+	switch (ru16(header->imageFormat)) {
+	case 1:
+	case 2:
+		metricsSize = sizeof(TTF_SmallGlyphMetrics);
+		if (length < metricsSize) return SKR_FAILURE;
+		sg->metrics = ReadSmallMetrics(data);
+		break;
+	case 5: {
+		/* the metrics are shared by all glyphs of the subtable */
+		int indexFormat = ru16(header->indexFormat);
+		if (indexFormat != 2 && indexFormat != 5) return SKR_FAILURE;
+		metricsSize = 0;
+		sg->metrics = ReadBigMetrics((BYTES1 *) header + sizeof(TTF_IndexSubHeader) + 4);
+		break;
+	}
+	case 6:
+	case 7:
+		metricsSize = sizeof(TTF_BigGlyphMetrics);
+		if (length < metricsSize) return SKR_FAILURE;
+		sg->metrics = ReadBigMetrics(data);
+		break;
+	default:
+		return SKR_FAILURE;
+	}
+
+	int format = ru16(header->imageFormat);
+	unsigned long rowBits = sg->metrics.width * strike->bitDepth;
+	sg->bitAligned = format == 2 || format == 5 || format == 7;
+	sg->rowBits = sg->bitAligned ? rowBits : (rowBits + 7) & ~7ul;
+	sg->image = data + metricsSize;
+	sg->bitDepth = strike->bitDepth;
+	if ((sg->rowBits * sg->metrics.height + 7) / 8 > length - metricsSize) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+/*
+Expands row (counted from the top, as stored) into 8-bit coverage.
+Pixels are packed most significant bits first.
+*/
+void ReadStrikeRow(StrikeGlyph const * restrict sg, uint32_t row, uint8_t * restrict coverage)
+{
+	int const bitDepth = sg->bitDepth;
+	int const scale = 255 / ((1 << bitDepth) - 1);
+	unsigned long bit = row * sg->rowBits;
+	for (uint32_t col = 0; col < sg->metrics.width; ++col, bit += bitDepth) {
+		int byte = sg->image[bit / 8];
+		int value = byte >> (8 - bitDepth - bit % 8) & ((1 << bitDepth) - 1);
+		coverage[col] = value * scale;
+	}
+}
+
+/*
+A cell with an edge value of c and no tail exports as coverage c,
+so bitmaps go into a raster as they are, and add up with outlines.
+Whatever would fall outside of the raster gets cut off.
+*/
+void DrawStrikeGlyph(StrikeGlyph const * restrict sg, long x, long y,
+	Workspace * restrict ws)
+{
+	uint8_t coverage[256];
+	long const left = x + sg->metrics.xMin;
+	long const top = y + sg->metrics.yMin + (long) sg->metrics.height - 1;
+	long const colBeg = max(0, -left);
+	long const colEnd = min((long) sg->metrics.width, (long) ws->dims.width - left);
+	for (uint32_t row = 0; row < sg->metrics.height; ++row) {
+		long target = top - (long) row;
+		if (target < 0 || target >= (long) ws->dims.height) continue;
+		ReadStrikeRow(sg, row, coverage);
+		long start = target * (long) ws->rasterWidth + left;
+		if (ws->raster == 0) {
+			ClaimTiles(ws, left + colBeg, target, left + colEnd, target + 1);
+		}
+		if (ws->edges != 0) {
+			int16_t * restrict edges = ws->edges + start;
+			for (long col = colBeg; col < colEnd; ++col) {
+				edges[col] += coverage[col];
+			}
+			continue;
+		}
+		if (ws->wideEdges != 0) {
+			int32_t * restrict edges = ws->wideEdges + start;
+			for (long col = colBeg; col < colEnd; ++col) {
+				edges[col] += coverage[col];
+			}
+			continue;
+		}
+		RasterCell * restrict cells = ws->raster + start;
+		for (long col = colBeg; col < colEnd; ++col) {
+			RasterCell cell = cells[col];
+			uint16_t edge = (uint16_t) (cell & 0xFFFF) + coverage[col];
+			cells[col] = (cell & 0xFFFF0000) | edge;
+		}
+	}
+}
+
+/*
+======== public interface ========
+*/
+
+static void RequireStrikes(SKR_Font * restrict font)
+{
+	if (!ClaimTable(font, PARSED_STRIKES)) return;
+	LocateStrikes(font, &font->strikes);
+	PublishTable(font, PARSED_STRIKES);
+}
+
+SKR_Status skrFindStrike(SKR_Font * restrict font,
+	float size, SKR_Strike * restrict strike)
+{
+	RequireStrikes(font);
+	return FindStrike(font, &font->strikes, size, strike);
+}
+
+SKR_Status skrGetStrikeMetrics(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph,
+	SKR_BitmapMetrics * restrict metrics)
+{
+	StrikeGlyph sg;
+	SKR_Status s = FindStrikeGlyph(font, strike, glyph, &sg);
+	if (s) return s;
+	*metrics = sg.metrics;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrDrawStrikeGlyph(SKR_Font const * restrict font,
+	SKR_Strike const * restrict strike, Glyph glyph, long x, long y,
+	RasterCell * restrict raster, SKR_Dimensions dims)
+{
+	StrikeGlyph sg;
+	SKR_Status s = FindStrikeGlyph(font, strike, glyph, &sg);
+	if (s) return s;
+	Workspace ws = PackedWorkspace(raster, dims);
+	DrawStrikeGlyph(&sg, x, y, &ws);
+	return SKR_SUCCESS;
+}
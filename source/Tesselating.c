@@ -7,14 +7,14 @@ static float ManhattanDistance(Point a, Point b)
 	return gabs(a.x - b.x) + gabs(a.y - b.y);
 }
 
-static int IsFlat(Curve curve, float flatness)
+int IsFlat(Curve curve, float flatness)
 {
 	Point mid = Midpoint(curve.beg, curve.end);
 	float dist = ManhattanDistance(curve.ctrl, mid);
 	return dist <= flatness;
 }
 
-static void SplitCurve(Curve curve, Curve segments[2])
+void SplitCurve(Curve curve, Curve segments[2])
 {
 	Point ctrl0 = Midpoint(curve.beg, curve.ctrl);
 	Point ctrl1 = Midpoint(curve.ctrl, curve.end);
@@ -35,7 +35,7 @@ void DrawCurve(Workspace * restrict ws, Curve initialCurve)
 	int top = 1;
 	while (top > 0) {
 		Curve curve = stack[--top];
-		if (IsFlat(curve, 0.5f)) {
+		if (IsFlat(curve, ws->flatness)) {
 			DrawLine(ws, *(Line *) &curve);
 		} else {
 			SKR_assert(top + 2 <= 1000);
@@ -44,3 +44,49 @@ void DrawCurve(Workspace * restrict ws, Curve initialCurve)
 		}
 	}
 }
+
+/*
+The second differences of the control points bound how far a cubic
+strays from its chord: by at most three quarters of the largest one.
+For a quadratic, IsFlat() lets it stray by half the flatness, so cubics
+are held to the same distance.
+*/
+int IsCubicFlat(Cubic cubic, float flatness)
+{
+	Point d1 = { cubic.beg.x - 2.0f * cubic.ctrl1.x + cubic.ctrl2.x,
+		cubic.beg.y - 2.0f * cubic.ctrl1.y + cubic.ctrl2.y };
+	Point d2 = { cubic.ctrl1.x - 2.0f * cubic.ctrl2.x + cubic.end.x,
+		cubic.ctrl1.y - 2.0f * cubic.ctrl2.y + cubic.end.y };
+	float dist = max(gabs(d1.x) + gabs(d1.y), gabs(d2.x) + gabs(d2.y));
+	return dist <= flatness * (2.0f / 3.0f);
+}
+
+void SplitCubic(Cubic cubic, Cubic segments[2])
+{
+	Point a = Midpoint(cubic.beg, cubic.ctrl1);
+	Point b = Midpoint(cubic.ctrl1, cubic.ctrl2);
+	Point c = Midpoint(cubic.ctrl2, cubic.end);
+	Point ab = Midpoint(a, b);
+	Point bc = Midpoint(b, c);
+	Point pivot = Midpoint(ab, bc);
+	segments[0] = (Cubic) { cubic.beg, pivot, a, ab };
+	segments[1] = (Cubic) { pivot, cubic.end, bc, c };
+}
+
+void DrawCubic(Workspace * restrict ws, Cubic initialCubic)
+{
+	/* Same as in DrawCurve(), every split only grows the stack by one. */
+	Cubic stack[1000];
+	stack[0] = initialCubic;
+	int top = 1;
+	while (top > 0) {
+		Cubic cubic = stack[--top];
+		if (IsCubicFlat(cubic, ws->flatness)) {
+			DrawLine(ws, (Line) { cubic.beg, cubic.end });
+		} else {
+			SKR_assert(top + 2 <= 1000);
+			SplitCubic(cubic, &stack[top]);
+			top += 2;
+		}
+	}
+}
@@ -0,0 +1,1025 @@
+#include "Internals.h"
+
+/*
+======== variations ========
+
+A variable font has a single set of outlines, for the default instance,
+and gvar holds deltas that move their points as the values on the axes
+in fvar change. Each set of deltas applies within a region of the design
+space, scaled by how close the instance is to the peak of the region.
+Advance widths get deltas of their own in HVAR, which are stored more
+compactly, in an item variation store.
+
+Applying all that takes much longer than drawing a glyph. So an instance
+does it only once per glyph, the first time the glyph is needed, and
+keeps the result in its memory as a plain glyf outline, which the rest
+of Skribist then draws like any other.
+*/
+
+typedef struct {
+	BYTES2 majorVersion;
+	BYTES2 minorVersion;
+	BYTES2 axesArrayOffset;
+	BYTES2 reserved;
+	BYTES2 axisCount;
+	BYTES2 axisSize;
+	BYTES2 instanceCount;
+	BYTES2 instanceSize;
+} TTF_fvar;
+
+typedef struct {
+	BYTES4 axisTag;
+	BYTES4 minValue;
+	BYTES4 defaultValue;
+	BYTES4 maxValue;
+	BYTES2 flags;
+	BYTES2 axisNameID;
+} TTF_VariationAxisRecord;
+
+typedef struct {
+	BYTES2 majorVersion;
+	BYTES2 minorVersion;
+	BYTES2 axisCount;
+	BYTES2 sharedTupleCount;
+	BYTES4 sharedTuplesOffset;
+	BYTES2 glyphCount;
+	BYTES2 flags;
+	BYTES4 glyphVariationDataArrayOffset;
+} TTF_gvar;
+
+typedef struct {
+	BYTES2 majorVersion;
+	BYTES2 minorVersion;
+	BYTES4 itemVariationStoreOffset;
+	BYTES4 advanceWidthMappingOffset;
+	BYTES4 lsbMappingOffset;
+	BYTES4 rsbMappingOffset;
+} TTF_HVAR;
+
+// gvar flags
+#define GVAR_LONG_OFFSETS 0x0001
+
+// tuple variation count bits
+#define SHARED_POINT_NUMBERS 0x8000
+#define TUPLE_COUNT_MASK     0x0FFF
+
+// tuple index bits
+#define EMBEDDED_PEAK_TUPLE    0x8000
+#define INTERMEDIATE_REGION    0x4000
+#define PRIVATE_POINT_NUMBERS  0x2000
+#define TUPLE_INDEX_MASK       0x0FFF
+
+// packed point number and delta runs
+#define POINTS_ARE_WORDS     0x80
+#define POINT_RUN_COUNT_MASK 0x7F
+#define DELTAS_ARE_ZERO      0x80
+#define DELTAS_ARE_WORDS     0x40
+#define DELTA_RUN_COUNT_MASK 0x3F
+
+// item variation data
+#define LONG_WORDS       0x8000
+#define WORD_DELTA_COUNT_MASK 0x7FFF
+
+// delta set index map entry format
+#define INNER_INDEX_BIT_COUNT_MASK 0x0F
+#define MAP_ENTRY_SIZE_MASK        0x30
+
+/* The phantom points come after the points of the outline. */
+#define PHANTOM_POINTS 4
+
+/*
+======== axes ========
+*/
+
+static SKR_Status Locate_fvar(SKR_Font const * restrict font,
+	TTF_fvar const * restrict * restrict fvar)
+{
+	SKR_TTF_Table table;
+	SKR_Status s = FindTable(font, TagFromString("fvar"), &table);
+	if (s) return s;
+	if (!InsideTable(table, table.offset, sizeof(TTF_fvar))) return SKR_FAILURE;
+	*fvar = (TTF_fvar const *) ((BYTES1 *) font->data + table.offset);
+	if (ru16((*fvar)->majorVersion) != 1) return SKR_FAILURE;
+	unsigned long axes = table.offset + ru16((*fvar)->axesArrayOffset);
+	unsigned long axisSize = ru16((*fvar)->axisSize);
+	if (axisSize < sizeof(TTF_VariationAxisRecord)) return SKR_FAILURE;
+	if (!InsideTable(table, axes, ru16((*fvar)->axisCount) * axisSize)) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+SKR_Status skrCountAxes(SKR_Font const * restrict font, int * restrict count)
+{
+	TTF_fvar const * fvar;
+	*count = 0;
+	if (Locate_fvar(font, &fvar)) return SKR_SUCCESS;
+	*count = ru16(fvar->axisCount);
+	return SKR_SUCCESS;
+}
+
+static float FloatFromFixed(BYTES4 raw)
+{
+	return (int32_t) ru32(raw) / 65536.0f;
+}
+
+SKR_Status skrGetAxis(SKR_Font const * restrict font,
+	int index, SKR_Axis * restrict axis)
+{
+	TTF_fvar const * fvar;
+	SKR_Status s = Locate_fvar(font, &fvar);
+	if (s) return s;
+	if (index < 0 || index >= ru16(fvar->axisCount)) return SKR_FAILURE;
+	TTF_VariationAxisRecord const * restrict record = (TTF_VariationAxisRecord const *)
+		((BYTES1 *) fvar + ru16(fvar->axesArrayOffset) + index * ru16(fvar->axisSize));
+	axis->tag = ru32(record->axisTag);
+	axis->minValue = FloatFromFixed(record->minValue);
+	axis->defaultValue = FloatFromFixed(record->defaultValue);
+	axis->maxValue = FloatFromFixed(record->maxValue);
+	return SKR_SUCCESS;
+}
+
+/*
+Maps a value in user units to -1 .. 1, with the default at 0, and then
+through the segment map of the axis in avar, if there is one. Only the
+result gets rounded to F2Dot14, so both steps work in units of 1/16384.
+*/
+static double NormalizeValue(SKR_Axis axis, float value)
+{
+	value = min(max(value, axis.minValue), axis.maxValue);
+	double normalized = 0.0;
+	if (value < axis.defaultValue) {
+		normalized = ((double) value - axis.defaultValue) / (axis.defaultValue - axis.minValue);
+	} else if (value > axis.defaultValue) {
+		normalized = ((double) value - axis.defaultValue) / (axis.maxValue - axis.defaultValue);
+	}
+	return normalized * 16384.0;
+}
+
+static double MapThroughSegments(BYTES1 * restrict pairs, int count, double coord)
+{
+	if (count == 0) return coord;
+	int from0 = AtI16(pairs), to0 = AtI16(pairs + 2);
+	if (coord <= from0) return to0 + (coord - from0);
+	for (int i = 1; i < count; ++i) {
+		int from1 = AtI16(pairs + 4 * i), to1 = AtI16(pairs + 4 * i + 2);
+		if (coord <= from1) {
+			if (from1 == from0) return to1;
+			return to0 + (to1 - to0) * (coord - from0) / (from1 - from0);
+		}
+		from0 = from1, to0 = to1;
+	}
+	return to0 + (coord - from0);
+}
+
+static void ApplyAxisMaps(SKR_Font const * restrict font,
+	double * restrict coords, int numAxes)
+{
+	SKR_TTF_Table table;
+	if (FindTable(font, TagFromString("avar"), &table)) return;
+	if (!InsideTable(table, table.offset, 8)) return;
+	BYTES1 * avar = (BYTES1 *) font->data + table.offset;
+	if (At16(avar) != 1 && At16(avar) != 2) return;
+	if (At16(avar + 6) != numAxes) return;
+	unsigned long cursor = table.offset + 8;
+	for (int a = 0; a < numAxes; ++a) {
+		if (!InsideTable(table, cursor, 2)) return;
+		int count = At16((BYTES1 *) font->data + cursor);
+		if (!InsideTable(table, cursor + 2, 4ul * count)) return;
+		coords[a] = MapThroughSegments((BYTES1 *) font->data + cursor + 2, count, coords[a]);
+		cursor += 2 + 4ul * count;
+	}
+}
+
+/*
+How much of the deltas of a region apply at the given coordinates.
+Regions without an explicit start and end reach from 0 to their peak.
+Axes with a peak of 0, or with invalid bounds, don't restrict a region.
+*/
+static double RegionScalar(int16_t const * restrict coords, int numAxes,
+	BYTES1 * restrict peaks, BYTES1 * restrict starts, BYTES1 * restrict ends, int stride)
+{
+	double scalar = 1.0;
+	for (int a = 0; a < numAxes; ++a) {
+		int peak = AtI16(peaks + a * stride);
+		if (peak == 0) continue;
+		int start = starts ? AtI16(starts + a * stride) : min(peak, 0);
+		int end = ends ? AtI16(ends + a * stride) : max(peak, 0);
+		if (start > peak || peak > end) continue;
+		if (start < 0 && end > 0) continue;
+		int coord = coords[a];
+		if (coord == peak) continue;
+		if (coord <= start || coord >= end) return 0.0;
+		if (coord < peak) {
+			scalar *= (double) (coord - start) / (peak - start);
+		} else {
+			scalar *= (double) (end - coord) / (end - peak);
+		}
+	}
+	return scalar;
+}
+
+/*
+======== glyph variations ========
+
+The deltas of a glyph come in tuples, one per region. Each tuple either
+moves all points of the glyph (including the four phantom points, which
+stand for its metrics) or only some of them. In the latter case,
+the points in between get their deltas interpolated from the nearest
+points before and after them on the same contour that have them (IUP).
+*/
+
+typedef struct {
+	int32_t * xs, * ys;
+	double * dxs, * dys;
+	double * txs, * tys;
+	uint8_t * onCurve;
+	uint8_t * touched;
+	uint16_t * points;
+	uint16_t * endPts;
+} Scratch;
+
+/* coordinates, deltas, point numbers, and the onCurve and touched flags */
+#define SCRATCH_PER_POINT \
+	(2 * sizeof(int32_t) + 4 * sizeof(double) + sizeof(uint16_t) + 2)
+
+static unsigned long CalcScratchSize(unsigned long maxPoints, unsigned long maxContours)
+{
+	unsigned long n = maxPoints + PHANTOM_POINTS;
+	return AlignSize(n * SCRATCH_PER_POINT) + AlignSize(maxContours * 2);
+}
+
+static Scratch CarveScratch(void * memory, unsigned long maxPoints)
+{
+	unsigned long n = maxPoints + PHANTOM_POINTS;
+	Scratch sc;
+	sc.xs = (int32_t *) memory;
+	sc.ys = sc.xs + n;
+	sc.dxs = (double *) (sc.ys + n);
+	sc.dys = sc.dxs + n;
+	sc.txs = sc.dys + n;
+	sc.tys = sc.txs + n;
+	sc.points = (uint16_t *) (sc.tys + n);
+	sc.onCurve = (uint8_t *) (sc.points + n);
+	sc.touched = sc.onCurve + n;
+	sc.endPts = (uint16_t *) ((uint8_t *) memory + AlignSize(n * SCRATCH_PER_POINT));
+	return sc;
+}
+
+/*
+Reads packed point numbers into points. A count of 0 stands for all
+points of the glyph, for which *count is set to -1 instead.
+*/
+static BYTES1 * ReadPointNumbers(BYTES1 * restrict ptr, BYTES1 * restrict end,
+	int numPoints, uint16_t * restrict points, int * restrict count)
+{
+	if (ptr >= end) return 0;
+	int total = *ptr++;
+	if (total & POINTS_ARE_WORDS) {
+		if (ptr >= end) return 0;
+		total = (total & POINT_RUN_COUNT_MASK) << 8 | *ptr++;
+	}
+	if (total == 0) {
+		*count = -1;
+		return ptr;
+	}
+	if (total > numPoints) return 0;
+	int n = 0, point = 0;
+	while (n < total) {
+		if (ptr >= end) return 0;
+		int control = *ptr++;
+		int run = (control & POINT_RUN_COUNT_MASK) + 1;
+		int words = control & POINTS_ARE_WORDS;
+		if (n + run > total || ptr + run * (words ? 2 : 1) > end) return 0;
+		for (int i = 0; i < run; ++i) {
+			point += words ? At16(ptr) : *ptr;
+			ptr += words ? 2 : 1;
+			points[n++] = point;
+		}
+	}
+	*count = total;
+	return ptr;
+}
+
+/* Reads count packed deltas, scaled by scalar, into deltas[points[i]]. */
+static BYTES1 * ReadDeltas(BYTES1 * restrict ptr, BYTES1 * restrict end,
+	int count, uint16_t const * restrict points, double scalar,
+	int numPoints, double * restrict deltas)
+{
+	int n = 0;
+	while (n < count) {
+		if (ptr >= end) return 0;
+		int control = *ptr++;
+		int run = (control & DELTA_RUN_COUNT_MASK) + 1;
+		int size = control & DELTAS_ARE_ZERO ? (control & DELTAS_ARE_WORDS ? 4 : 0) :
+			(control & DELTAS_ARE_WORDS ? 2 : 1);
+		if (n + run > count || ptr + run * size > end) return 0;
+		for (int i = 0; i < run; ++i, ++n) {
+			int32_t delta = 0;
+			if (size == 1) delta = (int8_t) *ptr;
+			else if (size == 2) delta = AtI16(ptr);
+			else if (size == 4) delta = (int32_t) At32(ptr);
+			ptr += size;
+			int point = points ? points[n] : n;
+			if (point < numPoints) deltas[point] = scalar * delta;
+		}
+	}
+	return ptr;
+}
+
+/* Interpolates the deltas of the untouched points from a to b, exclusive. */
+static void InterpolateRange(int32_t const * restrict coords, double * restrict deltas,
+	int first, int last, int a, int b, int from, int to)
+{
+	int32_t c1 = coords[a], c2 = coords[b];
+	double d1 = deltas[a], d2 = deltas[b];
+	if (c1 > c2) {
+		int32_t c = c1; c1 = c2; c2 = c;
+		double d = d1; d1 = d2; d2 = d;
+	}
+	for (int i = from; i != to; i = i == last ? first : i + 1) {
+		if (c1 == c2) {
+			deltas[i] = d1 == d2 ? d1 : 0.0;
+		} else if (coords[i] <= c1) {
+			deltas[i] = d1;
+		} else if (coords[i] >= c2) {
+			deltas[i] = d2;
+		} else {
+			deltas[i] = d1 + (coords[i] - c1) * (d2 - d1) / (c2 - c1);
+		}
+	}
+}
+
+static void InterpolateUntouched(Scratch const * restrict sc,
+	int numContours, uint16_t const * restrict endPts)
+{
+	int first = 0;
+	for (int c = 0; c < numContours; ++c) {
+		int last = endPts[c];
+		int start = -1;
+		for (int i = first; i <= last; ++i) {
+			if (sc->touched[i]) {
+				start = i;
+				break;
+			}
+		}
+		if (start >= 0) {
+			int a = start;
+			do {
+				int b = a == last ? first : a + 1;
+				while (!sc->touched[b]) b = b == last ? first : b + 1;
+				int from = a == last ? first : a + 1;
+				if (from != b || a == b) {
+					InterpolateRange(sc->xs, sc->txs, first, last, a, b, from, b);
+					InterpolateRange(sc->ys, sc->tys, first, last, a, b, from, b);
+				}
+				a = b;
+			} while (a != start);
+		}
+		first = last + 1;
+	}
+}
+
+/*
+Adds the deltas of every tuple that applies at the instance's coordinates
+onto dxs and dys. A glyph with no variation data just stays where it is.
+*/
+static SKR_Status AddGlyphDeltas(SKR_Instance const * restrict instance, Glyph glyph,
+	Scratch const * restrict sc, int numPoints, int numContours)
+{
+	SKR_Font const * restrict font = &instance->font;
+	SKR_TTF_Table table = instance->gvar;
+	BYTES1 * base = (BYTES1 *) font->data;
+	TTF_gvar const * restrict gvar = (TTF_gvar const *) (base + table.offset);
+	if (glyph >= ru16(gvar->glyphCount)) return SKR_SUCCESS;
+
+	BYTES1 * offsets = (BYTES1 *) gvar + sizeof(TTF_gvar);
+	unsigned long begin, end;
+	if (ru16(gvar->flags) & GVAR_LONG_OFFSETS) {
+		begin = At32(offsets + 4 * glyph), end = At32(offsets + 4 * glyph + 4);
+	} else {
+		begin = 2ul * At16(offsets + 2 * glyph), end = 2ul * At16(offsets + 2 * glyph + 2);
+	}
+	if (begin >= end) return SKR_SUCCESS;
+	unsigned long dataArray = table.offset + ru32(gvar->glyphVariationDataArrayOffset);
+	if (!InsideTable(table, dataArray + begin, end - begin) || end - begin < 4) return SKR_FAILURE;
+	BYTES1 * data = base + dataArray + begin;
+	BYTES1 * dataEnd = base + dataArray + end;
+
+	int numAxes = instance->numAxes;
+	BYTES1 * sharedTuples = base + table.offset + ru32(gvar->sharedTuplesOffset);
+	int sharedTupleCount = ru16(gvar->sharedTupleCount);
+	if (!InsideTable(table, sharedTuples - base, 2ul * numAxes * sharedTupleCount)) return SKR_FAILURE;
+
+	int tupleCount = At16(data);
+	BYTES1 * serialized = data + At16(data + 2);
+	BYTES1 * header = data + 4;
+	BYTES1 * sharedPoints = 0;
+	if (tupleCount & SHARED_POINT_NUMBERS) {
+		int count;
+		sharedPoints = serialized;
+		serialized = ReadPointNumbers(serialized, dataEnd, numPoints, sc->points, &count);
+		if (!serialized) return SKR_FAILURE;
+	}
+
+	for (int t = 0; t < (tupleCount & TUPLE_COUNT_MASK); ++t) {
+		if (header + 4 > dataEnd) return SKR_FAILURE;
+		unsigned long dataSize = At16(header);
+		int tupleIndex = At16(header + 2);
+		header += 4;
+		BYTES1 * peaks;
+		if (tupleIndex & EMBEDDED_PEAK_TUPLE) {
+			peaks = header;
+			header += 2 * numAxes;
+		} else {
+			if ((tupleIndex & TUPLE_INDEX_MASK) >= sharedTupleCount) return SKR_FAILURE;
+			peaks = sharedTuples + 2 * numAxes * (tupleIndex & TUPLE_INDEX_MASK);
+		}
+		BYTES1 * starts = 0, * ends = 0;
+		if (tupleIndex & INTERMEDIATE_REGION) {
+			starts = header;
+			ends = header + 2 * numAxes;
+			header += 4 * numAxes;
+		}
+		if (header > dataEnd) return SKR_FAILURE;
+
+		BYTES1 * tupleData = serialized;
+		serialized += dataSize;
+		if (serialized > dataEnd) return SKR_FAILURE;
+		double scalar = RegionScalar(instance->coords, numAxes, peaks, starts, ends, 2);
+		if (scalar == 0.0) continue;
+
+		int count;
+		BYTES1 * ptr = (tupleIndex & PRIVATE_POINT_NUMBERS) ?
+			ReadPointNumbers(tupleData, serialized, numPoints, sc->points, &count) :
+			ReadPointNumbers(sharedPoints, dataEnd, numPoints, sc->points, &count);
+		if (!ptr) return SKR_FAILURE;
+		if (!(tupleIndex & PRIVATE_POINT_NUMBERS)) ptr = tupleData;
+
+		if (count < 0) {
+			ptr = ReadDeltas(ptr, serialized, numPoints, 0, scalar, numPoints, sc->txs);
+			if (!ptr) return SKR_FAILURE;
+			ptr = ReadDeltas(ptr, serialized, numPoints, 0, scalar, numPoints, sc->tys);
+			if (!ptr) return SKR_FAILURE;
+		} else {
+			for (int i = 0; i < numPoints; ++i) {
+				sc->txs[i] = 0.0;
+				sc->tys[i] = 0.0;
+				sc->touched[i] = 0;
+			}
+			ptr = ReadDeltas(ptr, serialized, count, sc->points, scalar, numPoints, sc->txs);
+			if (!ptr) return SKR_FAILURE;
+			ptr = ReadDeltas(ptr, serialized, count, sc->points, scalar, numPoints, sc->tys);
+			if (!ptr) return SKR_FAILURE;
+			for (int i = 0; i < count; ++i) {
+				if (sc->points[i] < numPoints) sc->touched[sc->points[i]] = 1;
+			}
+			InterpolateUntouched(sc, numContours, sc->endPts);
+		}
+		for (int i = 0; i < numPoints; ++i) {
+			sc->dxs[i] += sc->txs[i];
+			sc->dys[i] += sc->tys[i];
+		}
+	}
+	return SKR_SUCCESS;
+}
+
+/*
+======== metrics variations ========
+*/
+
+/* Where in the item variation store the deltas of a glyph are. */
+static SKR_Status MapDeltaSet(SKR_TTF_Table table, BYTES1 * base,
+	unsigned long mapOffset, Glyph glyph, unsigned long * restrict outer, unsigned long * restrict inner)
+{
+	if (mapOffset == 0) {
+		*outer = 0;
+		*inner = glyph;
+		return SKR_SUCCESS;
+	}
+	unsigned long cursor = table.offset + mapOffset;
+	if (!InsideTable(table, cursor, 2)) return SKR_FAILURE;
+	int format = base[cursor], entryFormat = base[cursor + 1];
+	unsigned long mapCount;
+	if (format == 0) {
+		if (!InsideTable(table, cursor + 2, 2)) return SKR_FAILURE;
+		mapCount = At16(base + cursor + 2);
+		cursor += 4;
+	} else if (format == 1) {
+		if (!InsideTable(table, cursor + 2, 4)) return SKR_FAILURE;
+		mapCount = At32(base + cursor + 2);
+		cursor += 6;
+	} else {
+		return SKR_FAILURE;
+	}
+	if (mapCount == 0) return SKR_FAILURE;
+	int entrySize = ((entryFormat & MAP_ENTRY_SIZE_MASK) >> 4) + 1;
+	int innerBits = (entryFormat & INNER_INDEX_BIT_COUNT_MASK) + 1;
+	unsigned long index = min((unsigned long) glyph, mapCount - 1);
+	if (!InsideTable(table, cursor + index * entrySize, entrySize)) return SKR_FAILURE;
+	uint32_t entry = 0;
+	for (int i = 0; i < entrySize; ++i) {
+		entry = entry << 8 | base[cursor + index * entrySize + i];
+	}
+	*outer = entry >> innerBits;
+	*inner = entry & ((1u << innerBits) - 1);
+	return SKR_SUCCESS;
+}
+
+static SKR_Status Locate_ItemVariationStore(SKR_TTF_Table table, BYTES1 * base,
+	unsigned long * restrict store, unsigned long * restrict regionList)
+{
+	TTF_HVAR const * restrict hvar = (TTF_HVAR const *) (base + table.offset);
+	*store = table.offset + ru32(hvar->itemVariationStoreOffset);
+	if (!InsideTable(table, *store, 8)) return SKR_FAILURE;
+	if (At16(base + *store) != 1) return SKR_FAILURE;
+	*regionList = *store + At32(base + *store + 2);
+	if (!InsideTable(table, *regionList, 4)) return SKR_FAILURE;
+	return SKR_SUCCESS;
+}
+
+/* Sums up the deltas of one item, each scaled by the scalar of its region. */
+static SKR_Status SumItemDeltas(SKR_Instance const * restrict instance,
+	unsigned long outer, unsigned long inner, double * restrict delta)
+{
+	SKR_TTF_Table table = instance->hvar;
+	BYTES1 * base = (BYTES1 *) instance->font.data;
+	unsigned long store, regionList;
+	SKR_Status s = Locate_ItemVariationStore(table, base, &store, &regionList);
+	if (s) return s;
+	if (outer >= At16(base + store + 6)) return SKR_FAILURE;
+	if (!InsideTable(table, store + 8 + 4 * outer, 4)) return SKR_FAILURE;
+	unsigned long itemData = store + At32(base + store + 8 + 4 * outer);
+	if (!InsideTable(table, itemData, 6)) return SKR_FAILURE;
+	unsigned long itemCount = At16(base + itemData);
+	int wordDeltaCount = At16(base + itemData + 2);
+	int regionCount = At16(base + itemData + 4);
+	int longWords = wordDeltaCount & LONG_WORDS;
+	int wordCount = wordDeltaCount & WORD_DELTA_COUNT_MASK;
+	if (inner >= itemCount || wordCount > regionCount) return SKR_FAILURE;
+	int wordSize = longWords ? 4 : 2, byteSize = longWords ? 2 : 1;
+	unsigned long rowSize = wordCount * wordSize + (regionCount - wordCount) * byteSize;
+	unsigned long regions = itemData + 6;
+	unsigned long row = regions + 2ul * regionCount + inner * rowSize;
+	if (!InsideTable(table, row, rowSize)) return SKR_FAILURE;
+
+	BYTES1 * ptr = base + row;
+	double sum = 0.0;
+	for (int r = 0; r < regionCount; ++r) {
+		int32_t value;
+		if (r < wordCount) {
+			value = longWords ? (int32_t) At32(ptr) : AtI16(ptr);
+			ptr += wordSize;
+		} else {
+			value = longWords ? AtI16(ptr) : (int8_t) *ptr;
+			ptr += byteSize;
+		}
+		unsigned long region = At16(base + regions + 2 * r);
+		if (region >= instance->numRegions) return SKR_FAILURE;
+		sum += instance->regionScalars[region] * value;
+	}
+	*delta = sum;
+	return SKR_SUCCESS;
+}
+
+static SKR_Status GetAdvanceDelta(SKR_Instance const * restrict instance,
+	Glyph glyph, double * restrict delta)
+{
+	BYTES1 * base = (BYTES1 *) instance->font.data;
+	TTF_HVAR const * restrict hvar = (TTF_HVAR const *) (base + instance->hvar.offset);
+	unsigned long outer, inner;
+	SKR_Status s = MapDeltaSet(instance->hvar, base,
+		ru32(hvar->advanceWidthMappingOffset), glyph, &outer, &inner);
+	if (s) return s;
+	return SumItemDeltas(instance, outer, inner, delta);
+}
+
+/* Returns 0 if the instance has no HVAR, or the font no regions in it. */
+static unsigned long CountRegions(SKR_Font const * restrict font, SKR_TTF_Table table)
+{
+	BYTES1 * base = (BYTES1 *) font->data;
+	if (!InsideTable(table, table.offset, sizeof(TTF_HVAR))) return 0;
+	unsigned long store, regionList;
+	if (Locate_ItemVariationStore(table, base, &store, &regionList)) return 0;
+	return At16(base + regionList + 2);
+}
+
+static SKR_Status CalcRegionScalars(SKR_Instance * restrict instance)
+{
+	SKR_TTF_Table table = instance->hvar;
+	BYTES1 * base = (BYTES1 *) instance->font.data;
+	unsigned long store, regionList;
+	SKR_Status s = Locate_ItemVariationStore(table, base, &store, &regionList);
+	if (s) return s;
+	int axisCount = At16(base + regionList);
+	if (axisCount != instance->numAxes) return SKR_FAILURE;
+	unsigned long regionSize = 6ul * axisCount;
+	if (!InsideTable(table, regionList + 4, instance->numRegions * regionSize)) return SKR_FAILURE;
+	for (unsigned long r = 0; r < instance->numRegions; ++r) {
+		BYTES1 * region = base + regionList + 4 + r * regionSize;
+		instance->regionScalars[r] = RegionScalar(instance->coords, axisCount,
+			region + 2, region, region + 4, 6);
+	}
+	return SKR_SUCCESS;
+}
+
+/*
+======== instances ========
+
+Every glyph has a record, which is ready once the glyph has been
+instanced. Instancing happens under the lock of the instance, which
+also guards the scratch memory and the arena the outlines go into.
+Records only ever get published with everything they point to already
+in place, so finding a ready one needs no lock.
+*/
+
+#define RAW_OUTLINE 0xFFFFFFFF
+
+/*
+Outlines get decoded with vector loads that may reach past their end, so
+each one is told that its memory ends with its slot in the arena. Reading
+into the slot of the next glyph could race with another thread writing it.
+*/
+typedef struct {
+	uint32_t ready;
+	uint32_t offset, length, slot;
+	SKR_HorMetrics metrics;
+} InstancedGlyph;
+
+/* Encoded outlines never take more than this, with flags and words for every point. */
+static unsigned long CalcOutlineSize(int numContours, int numPoints)
+{
+	return (10 + 2 * numContours + 2 + 5 * numPoints + 3) & ~3ul;
+}
+
+// compound glyph flags
+#define ARG_1_AND_2_ARE_WORDS    0x0001
+#define WE_HAVE_A_SCALE          0x0008
+#define MORE_COMPONENTS          0x0020
+#define WE_HAVE_AN_X_AND_Y_SCALE 0x0040
+#define WE_HAVE_A_TWO_BY_TWO     0x0080
+
+/* In gvar, every component of a compound glyph counts as one point. */
+static SKR_Status CountComponents(MemRange range, int * restrict numComponents)
+{
+	BYTES1 * ptr = range.lowerBound + 10;
+	int count = 0, flags;
+	do {
+		if (range.upperBound - ptr < 4) return SKR_FAILURE;
+		flags = At16(ptr);
+		ptr += 4 + (flags & ARG_1_AND_2_ARE_WORDS ? 4 : 2);
+		if (flags & WE_HAVE_A_SCALE) ptr += 2;
+		else if (flags & WE_HAVE_AN_X_AND_Y_SCALE) ptr += 4;
+		else if (flags & WE_HAVE_A_TWO_BY_TWO) ptr += 8;
+		if (ptr > range.upperBound) return SKR_FAILURE;
+		++count;
+	} while (flags & MORE_COMPONENTS);
+	*numComponents = count;
+	return SKR_SUCCESS;
+}
+
+/*
+Points of an outline. Compound glyphs have a negative number of contours
+and their components as points, and empty ones have neither.
+*/
+static SKR_Status CountPoints(SKR_Font const * restrict font, Glyph glyph,
+	int * restrict numContours, int * restrict numPoints)
+{
+	MemRange range;
+	SKR_Status s = GetRawOutlineRange(font, glyph, &range);
+	if (s) return s;
+	*numContours = 0, *numPoints = 0;
+	if (range.upperBound == range.lowerBound) return SKR_SUCCESS;
+	if (range.upperBound - range.lowerBound < 12) return SKR_FAILURE;
+	int contours = AtI16(range.lowerBound);
+	if (contours < 0) {
+		*numContours = -1;
+		return CountComponents(range, numPoints);
+	}
+	if (contours == 0) return SKR_SUCCESS;
+	if (range.upperBound - range.lowerBound < 10 + 2 * contours) return SKR_FAILURE;
+	*numContours = contours;
+	*numPoints = At16(range.lowerBound + 10 + 2 * (contours - 1)) + 1;
+	return SKR_SUCCESS;
+}
+
+typedef struct {
+	unsigned long glyphs, regions, scratch, arena;
+	unsigned long maxPoints, maxContours;
+} InstanceLayout;
+
+static SKR_Status LayOutInstance(SKR_Font const * restrict font,
+	SKR_TTF_Table hvar, InstanceLayout * restrict layout)
+{
+	layout->glyphs = AlignSize(font->numGlyphs * sizeof(InstancedGlyph));
+	layout->regions = AlignSize(CountRegions(font, hvar) * sizeof(double));
+	layout->maxPoints = 0;
+	layout->maxContours = 0;
+	layout->arena = 0;
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		int numContours, numPoints;
+		SKR_Status s = CountPoints(font, glyph, &numContours, &numPoints);
+		if (s) return s;
+		layout->maxPoints = max(layout->maxPoints, (unsigned long) numPoints);
+		if (numContours <= 0) continue;
+		layout->maxContours = max(layout->maxContours, (unsigned long) numContours);
+		layout->arena += CalcOutlineSize(numContours, numPoints);
+	}
+	layout->scratch = CalcScratchSize(layout->maxPoints, layout->maxContours);
+	return SKR_SUCCESS;
+}
+
+static SKR_Status LocateVariations(SKR_Font const * restrict font, int * restrict numAxes,
+	SKR_TTF_Table * restrict gvar, SKR_TTF_Table * restrict hvar)
+{
+	SKR_Status s = skrCountAxes(font, numAxes);
+	if (s) return s;
+	if (*numAxes == 0 || *numAxes > SKR_MAX_AXES) return SKR_FAILURE;
+	s = FindTable(font, TagFromString("gvar"), gvar);
+	if (s) return s;
+	if (!InsideTable(*gvar, gvar->offset, sizeof(TTF_gvar))) return SKR_FAILURE;
+	TTF_gvar const * restrict header = (TTF_gvar const *)
+		((BYTES1 *) font->data + gvar->offset);
+	if (ru16(header->majorVersion) != 1) return SKR_FAILURE;
+	if (ru16(header->axisCount) != *numAxes) return SKR_FAILURE;
+	unsigned long glyphCount = ru16(header->glyphCount);
+	int offsetSize = ru16(header->flags) & GVAR_LONG_OFFSETS ? 4 : 2;
+	if (!InsideTable(*gvar, gvar->offset + sizeof(TTF_gvar),
+		(glyphCount + 1) * offsetSize)) return SKR_FAILURE;
+	if (FindTable(font, TagFromString("HVAR"), hvar) || CountRegions(font, *hvar) == 0) {
+		*hvar = (SKR_TTF_Table) { 0, 0 };
+	}
+	return SKR_SUCCESS;
+}
+
+unsigned long skrCalcInstanceSize(SKR_Font const * restrict font)
+{
+	int numAxes;
+	SKR_TTF_Table gvar, hvar;
+	if (LocateVariations(font, &numAxes, &gvar, &hvar)) return 0;
+	InstanceLayout layout;
+	if (LayOutInstance(font, hvar, &layout)) return 0;
+	return layout.glyphs + layout.regions + layout.scratch + layout.arena;
+}
+
+SKR_Status skrInitInstance(SKR_Instance * restrict instance,
+	SKR_Font const * restrict font, float const * restrict values,
+	void * restrict memory, unsigned long size)
+{
+	SKR_Status s;
+	int numAxes;
+	SKR_TTF_Table gvar, hvar;
+	s = LocateVariations(font, &numAxes, &gvar, &hvar);
+	if (s) return s;
+	InstanceLayout layout;
+	s = LayOutInstance(font, hvar, &layout);
+	if (s) return s;
+	if (size < layout.glyphs + layout.regions + layout.scratch + layout.arena) return SKR_FAILURE;
+
+	instance->font = *font;
+	instance->font.cachedMetrics = 0;
+	instance->font.cachedBoxes = 0;
+	instance->font.cachedOutlines = 0;
+	instance->font.instance = instance;
+	/* tables that are still being parsed for the font get parsed again */
+	unsigned int parsed = ParsedTables(font) & ((1u << PARSING_SHIFT) - 1);
+	instance->font.parsedTables = parsed | parsed << PARSING_SHIFT;
+
+	instance->numAxes = numAxes;
+	double coords[SKR_MAX_AXES];
+	for (int a = 0; a < numAxes; ++a) {
+		SKR_Axis axis;
+		s = skrGetAxis(font, a, &axis);
+		if (s) return s;
+		coords[a] = NormalizeValue(axis, values ? values[a] : axis.defaultValue);
+	}
+	ApplyAxisMaps(font, coords, numAxes);
+	for (int a = 0; a < numAxes; ++a) {
+		instance->coords[a] = __builtin_floor(coords[a] + 0.5);
+	}
+
+	unsigned char * cursor = (unsigned char *) memory;
+	instance->glyphs = cursor;
+	cursor += layout.glyphs;
+	instance->regionScalars = (double *) cursor;
+	cursor += layout.regions;
+	instance->scratch = cursor;
+	cursor += layout.scratch;
+	instance->arena = cursor;
+	instance->arenaSize = layout.arena;
+	instance->arenaUsed = 0;
+	instance->maxPoints = layout.maxPoints;
+	instance->maxContours = layout.maxContours;
+	instance->gvar = gvar;
+	instance->hvar = hvar;
+	instance->numRegions = layout.regions / sizeof(double);
+	instance->lock = 0;
+
+	if (hvar.length != 0) {
+		instance->numRegions = CountRegions(font, hvar);
+		s = CalcRegionScalars(instance);
+		if (s) return s;
+	}
+
+	InstancedGlyph * restrict glyphs = (InstancedGlyph *) instance->glyphs;
+	for (Glyph glyph = 0; glyph < font->numGlyphs; ++glyph) {
+		glyphs[glyph].ready = 0;
+	}
+	return SKR_SUCCESS;
+}
+
+static int32_t RoundDelta(double delta)
+{
+	return __builtin_floor(delta + 0.5);
+}
+
+/*
+Writes the moved points out as a simple glyph. Coordinates get clamped
+so that the difference between any two of them still fits into 16 bits.
+*/
+static unsigned long EncodeOutline(Scratch const * restrict sc,
+	int numContours, int numPoints, int16_t const box[4], uint8_t * restrict out)
+{
+	uint8_t * restrict cursor = out;
+	int16_t const header[5] = { numContours, box[0], box[1], box[2], box[3] };
+	for (int i = 0; i < 5; ++i) {
+		*cursor++ = (uint16_t) header[i] >> 8;
+		*cursor++ = (uint16_t) header[i];
+	}
+	for (int c = 0; c < numContours; ++c) {
+		*cursor++ = sc->endPts[c] >> 8;
+		*cursor++ = sc->endPts[c];
+	}
+	*cursor++ = 0;
+	*cursor++ = 0;
+
+	uint8_t * restrict flags = cursor;
+	cursor += numPoints;
+	for (int i = 0; i < numPoints; ++i) {
+		flags[i] = sc->onCurve[i] ? 0x01 : 0x00;
+	}
+	for (int axis = 0; axis < 2; ++axis) {
+		int32_t const * restrict coords = axis ? sc->ys : sc->xs;
+		uint8_t shortBit = 0x02 << axis, sameBit = 0x10 << axis;
+		int32_t prev = 0;
+		for (int i = 0; i < numPoints; ++i) {
+			int32_t delta = coords[i] - prev;
+			prev = coords[i];
+			if (delta == 0) {
+				flags[i] |= sameBit;
+			} else if (delta >= -255 && delta <= 255) {
+				flags[i] |= shortBit | (delta > 0 ? sameBit : 0);
+				*cursor++ = gabs(delta);
+			} else {
+				*cursor++ = (uint16_t) delta >> 8;
+				*cursor++ = (uint16_t) delta;
+			}
+		}
+	}
+	return cursor - out;
+}
+
+static SKR_Status InstanceGlyph(SKR_Instance * restrict instance, Glyph glyph,
+	InstancedGlyph * restrict record)
+{
+	SKR_Font const * restrict font = &instance->font;
+	SKR_Status s;
+	MemRange range;
+	s = GetRawOutlineRange(font, glyph, &range);
+	if (s) return s;
+	int numContours, numPoints;
+	s = CountPoints(font, glyph, &numContours, &numPoints);
+	if (s) return s;
+	if ((unsigned long) numPoints > instance->maxPoints) return SKR_FAILURE;
+	int compound = numContours < 0;
+
+	SKR_HorMetrics metrics;
+	s = GetRawHorMetrics(font, glyph, &metrics);
+	if (s) return s;
+	int32_t advance = floorf(metrics.advanceWidth * font->unitsPerEm + 0.5f);
+	int32_t lsb = floorf(metrics.leftSideBearing * font->unitsPerEm + 0.5f);
+
+	Scratch sc = CarveScratch(instance->scratch, instance->maxPoints);
+	int32_t xMin = 0;
+	if (compound) {
+		xMin = AtI16(range.lowerBound + 2);
+		for (int i = 0; i < numPoints; ++i) {
+			sc.xs[i] = 0, sc.ys[i] = 0;
+		}
+	} else if (numPoints > 0) {
+		xMin = AtI16(range.lowerBound + 2);
+		for (int c = 0; c < numContours; ++c) {
+			sc.endPts[c] = At16(range.lowerBound + 10 + 2 * c);
+			if (sc.endPts[c] >= numPoints || (c > 0 && sc.endPts[c] < sc.endPts[c - 1]))
+				return SKR_FAILURE;
+		}
+		s = DecodeOutline(range, sc.xs, sc.ys, sc.onCurve);
+		if (s) return s;
+	}
+	int total = numPoints + PHANTOM_POINTS;
+	for (int i = numPoints; i < total; ++i) {
+		sc.xs[i] = 0, sc.ys[i] = 0;
+	}
+	sc.xs[numPoints] = xMin - lsb;
+	sc.xs[numPoints + 1] = xMin - lsb + advance;
+	for (int i = 0; i < total; ++i) {
+		sc.dxs[i] = 0.0, sc.dys[i] = 0.0;
+	}
+	/* components don't get interpolated, and only the phantom points of compounds matter */
+	s = AddGlyphDeltas(instance, glyph, &sc, total, compound ? 0 : numContours);
+	if (s) return s;
+	double left = sc.xs[numPoints] + sc.dxs[numPoints];
+	double right = sc.xs[numPoints + 1] + sc.dxs[numPoints + 1];
+	for (int i = 0; i < total; ++i) {
+		sc.xs[i] += RoundDelta(sc.dxs[i]);
+		sc.ys[i] += RoundDelta(sc.dys[i]);
+		sc.xs[i] = min(max(sc.xs[i], -16384), 16383);
+		sc.ys[i] = min(max(sc.ys[i], -16384), 16383);
+	}
+
+	int16_t box[4] = { 0, 0, 0, 0 };
+	if (!compound && numPoints > 0) {
+		box[0] = box[2] = sc.xs[0];
+		box[1] = box[3] = sc.ys[0];
+		for (int i = 1; i < numPoints; ++i) {
+			box[0] = min(box[0], sc.xs[i]), box[2] = max(box[2], sc.xs[i]);
+			box[1] = min(box[1], sc.ys[i]), box[3] = max(box[3], sc.ys[i]);
+		}
+	}
+
+	/*
+	HVAR takes precedence over the phantom points, where there is one.
+	The metrics get rounded as a whole, rather than each phantom point.
+	*/
+	if (instance->hvar.length != 0) {
+		double delta;
+		s = GetAdvanceDelta(instance, glyph, &delta);
+		if (s) return s;
+		advance += RoundDelta(delta);
+	} else {
+		advance = max(RoundDelta(right - left), 0);
+	}
+	if (!compound) lsb = RoundDelta(box[0] - left);
+	record->metrics.advanceWidth = (float) advance / font->unitsPerEm;
+	record->metrics.leftSideBearing = (float) lsb / font->unitsPerEm;
+
+	if (compound) {
+		record->offset = RAW_OUTLINE;
+		record->length = 0;
+		record->slot = 0;
+	} else if (numPoints == 0) {
+		record->offset = 0;
+		record->length = 0;
+		record->slot = 0;
+	} else {
+		unsigned long size = CalcOutlineSize(numContours, numPoints);
+		if (instance->arenaUsed + size > instance->arenaSize) return SKR_FAILURE;
+		record->offset = instance->arenaUsed;
+		record->length = EncodeOutline(&sc, numContours, numPoints, box,
+			instance->arena + instance->arenaUsed);
+		record->slot = size;
+		instance->arenaUsed += size;
+	}
+	return SKR_SUCCESS;
+}
+
+static SKR_Status GetInstancedGlyph(SKR_Instance * restrict instance, Glyph glyph,
+	InstancedGlyph const * restrict * restrict record)
+{
+	if (glyph < 0 || glyph >= instance->font.numGlyphs) return SKR_FAILURE;
+	InstancedGlyph * restrict entry = (InstancedGlyph *) instance->glyphs + glyph;
+	*record = entry;
+	if (__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) return SKR_SUCCESS;
+
+	AcquireLock(&instance->lock);
+	SKR_Status s = SKR_SUCCESS;
+	if (!__atomic_load_n(&entry->ready, __ATOMIC_RELAXED)) {
+		s = InstanceGlyph(instance, glyph, entry);
+		if (!s) __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+	}
+	ReleaseLock(&instance->lock);
+	return s;
+}
+
+SKR_Status GetInstancedOutlineRange(SKR_Instance * restrict instance,
+	Glyph glyph, MemRange * restrict range)
+{
+	InstancedGlyph const * record;
+	SKR_Status s = GetInstancedGlyph(instance, glyph, &record);
+	if (s) return s;
+	if (record->offset == RAW_OUTLINE) {
+		return GetRawOutlineRange(&instance->font, glyph, range);
+	}
+	range->lowerBound = instance->arena + record->offset;
+	range->upperBound = range->lowerBound + record->length;
+	range->dataEnd = range->lowerBound + record->slot;
+	return SKR_SUCCESS;
+}
+
+SKR_Status GetInstancedHorMetrics(SKR_Instance * restrict instance,
+	Glyph glyph, SKR_HorMetrics * restrict metrics)
+{
+	InstancedGlyph const * record;
+	SKR_Status s = GetInstancedGlyph(instance, glyph, &record);
+	if (s) return s;
+	*metrics = record->metrics;
+	return SKR_SUCCESS;
+}
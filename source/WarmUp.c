@@ -0,0 +1,135 @@
+#include "Internals.h"
+
+/*
+======== warm-up ========
+
+A warm-up job renders every code point of a set at every size into a
+shared glyph cache. Skribist has no threads of its own, so the job is
+run by the threads of the caller, each with its own worker index.
+
+Every worker starts out with an even share of the items, packed into one
+64-bit word as begin << 32 | end. Workers take items off the front of
+their own share, and when it runs dry they steal the back half of
+somebody else's. Both happen through compare-and-swap on that word,
+so the owner and a thief can never both get the same item.
+Progress is counted per worker as well, next to its share, and only
+summed up when somebody asks for it.
+*/
+
+#define PACK_RANGE(begin, end) ((uint64_t) (begin) << 32 | (uint64_t) (end))
+#define RANGE_BEGIN(range) ((uint32_t) ((range) >> 32))
+#define RANGE_END(range) ((uint32_t) (range))
+
+SKR_Status skrBeginWarmUp(SKR_WarmUp * restrict job, SKR_Font const * restrict font,
+	SKR_SharedGlyphCache * restrict cache, SKR_CodeRange const * restrict ranges,
+	int numRanges, float const * restrict sizes, int numSizes, int numWorkers)
+{
+	if (numWorkers < 1 || numWorkers > SKR_MAX_WORKERS) return SKR_FAILURE;
+	unsigned long numCodes = 0;
+	for (int i = 0; i < numRanges; ++i) {
+		if (ranges[i].last < ranges[i].first) return SKR_FAILURE;
+		numCodes += ranges[i].last - ranges[i].first + 1;
+	}
+	if (numSizes > 0 && numCodes > 0xFFFFFFFFul / numSizes) return SKR_FAILURE;
+
+	job->font = font;
+	job->cache = cache;
+	job->ranges = ranges;
+	job->numRanges = numRanges;
+	job->sizes = sizes;
+	job->numSizes = numSizes;
+	job->numWorkers = numWorkers;
+	job->numItems = numCodes * numSizes;
+	for (int w = 0; w < numWorkers; ++w) {
+		unsigned long begin = job->numItems * w / numWorkers;
+		unsigned long end = job->numItems * (w + 1) / numWorkers;
+		job->shares[w].range = PACK_RANGE(begin, end);
+		job->shares[w].done = 0;
+		job->shares[w].failed = 0;
+	}
+	return SKR_SUCCESS;
+}
+
+/* Items go through all sizes of a code point before the next one. */
+static SKR_Status WarmItem(SKR_WarmUp * restrict job, unsigned long item)
+{
+	unsigned long code = item / job->numSizes;
+	float size = job->sizes[item % job->numSizes];
+	int r = 0;
+	while (code > (unsigned long) (job->ranges[r].last - job->ranges[r].first)) {
+		code -= job->ranges[r].last - job->ranges[r].first + 1;
+		++r;
+	}
+	Glyph glyph = skrGlyphFromCode(job->font, job->ranges[r].first + code);
+	return WarmGlyph(job->cache, job->font, glyph, size);
+}
+
+static int TakeOwnItem(uint64_t * restrict share, unsigned long * restrict item)
+{
+	uint64_t range = __atomic_load_n(share, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint32_t begin = RANGE_BEGIN(range), end = RANGE_END(range);
+		if (begin >= end) return 0;
+		if (__atomic_compare_exchange_n(share, &range, PACK_RANGE(begin + 1, end),
+			1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*item = begin;
+			return 1;
+		}
+	}
+}
+
+/* Steals the back half of the first share that isn't empty yet. */
+static int StealItems(SKR_WarmUp * restrict job, int worker)
+{
+	for (int i = 1; i < job->numWorkers; ++i) {
+		uint64_t * restrict victim = &job->shares[(worker + i) % job->numWorkers].range;
+		uint64_t range = __atomic_load_n(victim, __ATOMIC_ACQUIRE);
+		for (;;) {
+			uint32_t begin = RANGE_BEGIN(range), end = RANGE_END(range);
+			if (begin >= end) break;
+			uint32_t middle = begin + (end - begin) / 2;
+			if (__atomic_compare_exchange_n(victim, &range, PACK_RANGE(begin, middle),
+				1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&job->shares[worker].range, PACK_RANGE(middle, end),
+					__ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+Returns once there is nothing left to take or steal. Items that fail,
+like glyphs too large for their shard, are counted, and the job goes on.
+*/
+void skrRunWarmUp(SKR_WarmUp * restrict job, int worker)
+{
+	SKR_WarmUpShare * restrict share = &job->shares[worker];
+	unsigned long item;
+	/* only this worker writes its counters, so they need no read-modify-write */
+	unsigned long done = share->done, failed = share->failed;
+	for (;;) {
+		if (!TakeOwnItem(&share->range, &item)) {
+			if (!StealItems(job, worker)) return;
+			continue;
+		}
+		if (WarmItem(job, item)) {
+			__atomic_store_n(&share->failed, ++failed, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&share->done, ++done, __ATOMIC_RELAXED);
+	}
+}
+
+void skrGetWarmUpProgress(SKR_WarmUp const * restrict job,
+	unsigned long * restrict done, unsigned long * restrict failed,
+	unsigned long * restrict total)
+{
+	*done = 0;
+	*failed = 0;
+	for (int w = 0; w < job->numWorkers; ++w) {
+		*done += __atomic_load_n(&job->shares[w].done, __ATOMIC_RELAXED);
+		*failed += __atomic_load_n(&job->shares[w].failed, __ATOMIC_RELAXED);
+	}
+	*total = job->numItems;
+}
@@ -4,9 +4,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 // TODO platform-independent "deterministic" prng
 
 char const * WordList[] = {
@@ -21,7 +27,22 @@ static double time_in_seconds(struct timespec * ts)
     return (double) ts->tv_sec + (double) ts->tv_nsec / 1000000000.0;
 }
 
-static int read_file(char const *filename, void **addr)
+/*
+Every thread draws random words with the one shared font,
+and counts how many it got done in the given time.
+In shared mode, each one draws through a render context of its own,
+all of them backed by one shared glyph cache.
+*/
+typedef struct {
+	SKR_Font * font;
+	SKR_RenderContext * context;
+	double seconds;
+	unsigned int seed;
+	unsigned long long iterations;
+	double elapsedTime;
+} Worker;
+
+static int read_file(char const *filename, void **addr, unsigned long *size)
 {
 	FILE *file = fopen(filename, "rw");
 	if (file == NULL) {
@@ -43,16 +64,61 @@ static int read_file(char const *filename, void **addr)
 	}
 	fclose(file);
 	*addr = data;
+	*size = length;
 	return 0;
 }
 
+/*
+Short-lived processes can skip most of the font setup by mapping in a
+cache file from an earlier run. If there is none yet, or it is stale,
+initialize the font the normal way and write a fresh one.
+The cache memory has to stay around as long as the font is used.
+*/
+static SKR_Status load_font(SKR_Font * font, char const * cacheFilename)
+{
+	int fd = open(cacheFilename, O_RDONLY);
+	if (fd >= 0) {
+		off_t length = lseek(fd, 0, SEEK_END);
+		void * cache = length > 0 ?
+			mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (cache != MAP_FAILED) {
+			if (skrLoadFontCache(font, cache, length) == SKR_SUCCESS)
+				return SKR_SUCCESS;
+			munmap(cache, length);
+		}
+	}
+
+	SKR_Status s = skrInitializeFont(font);
+	if (s) return s;
+
+	unsigned long size = skrCalcFontCacheSize(font);
+	void * cache = malloc(size);
+	if (cache == NULL) return SKR_SUCCESS;
+	if (skrBuildFontCache(font, cache, size) != SKR_SUCCESS) {
+		free(cache);
+		return SKR_SUCCESS;
+	}
+	skrAttachFontCache(font, cache, size);
+
+	FILE * file = fopen(cacheFilename, "wb");
+	if (file != NULL) {
+		fwrite(cache, 1, size, file);
+		fclose(file);
+	}
+	return SKR_SUCCESS;
+}
+
 static SKR_Status draw_word(SKR_Font * font, float size, char const * word)
 {
 	SKR_Status s;
 
 	int count;
 	SKR_Assembly assembly[100];
-	s = skrAssembleStringUTF8(font, word, size, assembly, &count);
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	s = skrAssembleUTF8(font, word, strlen(word), size, &state, assembly, 100, &count);
+	if (s) return s;
 
 	SKR_Bounds bounds;
 	s = skrGetAssemblyBounds(font, assembly, count, &bounds);
@@ -77,10 +143,65 @@ static SKR_Status draw_word(SKR_Font * font, float size, char const * word)
 	return SKR_SUCCESS;
 }
 
+static SKR_Status draw_word_in_context(SKR_RenderContext * context,
+	SKR_Font * font, float size, char const * word)
+{
+	SKR_Status s;
+
+	int count;
+	SKR_Assembly assembly[100];
+	SKR_AssemblyState state;
+	skrBeginAssembly(&state);
+	s = skrAssembleUTF8(font, word, strlen(word), size, &state, assembly, 100, &count);
+	if (s) return s;
+
+	SKR_Bounds bounds;
+	s = skrGetAssemblyBounds(font, assembly, count, &bounds);
+	if (s) return s;
+
+	/* glyphs get added onto the image, so it has to start out blank */
+	unsigned long width = bounds.xMax - bounds.xMin;
+	unsigned long height = bounds.yMax - bounds.yMin;
+	unsigned char * image = calloc(4 * width * height, 1);
+
+	s = skrDrawAssemblyInContext(context, font, assembly, count, image, bounds);
+
+	free(image);
+
+	return s;
+}
+
+static void * run_worker(void * arg)
+{
+	Worker * worker = arg;
+
+	struct timespec startTime, nowTime;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &startTime); // TODO error handling
+	double elapsedTime; // in seconds
+	unsigned long long iterations = 0;
+
+	do {
+		int size = 10 + (rand_r(&worker->seed) % 50);
+		char const * word = WordList[rand_r(&worker->seed) % WordCount];
+
+		SKR_Status s = worker->context != NULL ?
+			draw_word_in_context(worker->context, worker->font, size, word) :
+			draw_word(worker->font, size, word);
+		if (!s) ++iterations;
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &nowTime); // TODO error handling
+		elapsedTime = time_in_seconds(&nowTime) - time_in_seconds(&startTime);
+	} while (elapsedTime < worker->seconds);
+
+	worker->iterations = iterations;
+	worker->elapsedTime = elapsedTime;
+	return NULL;
+}
+
 int main(int argc, char const *argv[])
 {
-	if (argc != 2) {
-		fprintf(stderr, "usage: stress <seconds>\n");
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: stress <seconds> [threads] [shared]\n");
 		return EXIT_FAILURE;
 	}
 
@@ -90,12 +211,25 @@ int main(int argc, char const *argv[])
 		return EXIT_FAILURE;
 	}
 
+	int threadCount = argc >= 3 ? atoi(argv[2]) : 1;
+	if (threadCount < 1 || threadCount > 256) {
+		fprintf(stderr, "[threads] should be between 1 and 256.\n");
+		return EXIT_FAILURE;
+	}
+
+	int shared = argc == 4;
+	if (shared && strcmp(argv[3], "shared") != 0) {
+		fprintf(stderr, "The only mode is \"shared\".\n");
+		return EXIT_FAILURE;
+	}
+
 	int ret;
 	SKR_Status s = SKR_SUCCESS;
 
 	unsigned char *rawData;
+	unsigned long rawLength;
 	// TODO better location for example font file
-	ret = read_file("../Ubuntu-C.ttf", (void **) &rawData);
+	ret = read_file("../Ubuntu-C.ttf", (void **) &rawData, &rawLength);
 	if (ret != 0) {
 		fprintf(stderr, "Unable to open TTF font file.\n");
 		return EXIT_FAILURE;
@@ -103,33 +237,67 @@ int main(int argc, char const *argv[])
 
 	SKR_Font font = {
 		.data = rawData,
-		.length = 0 }; // FIXME
-	s = skrInitializeFont(&font);
+		.length = rawLength };
+	s = load_font(&font, "../Ubuntu-C.ttf.skrcache");
 	if (s != SKR_SUCCESS) {
 		fprintf(stderr, "Unable to read TTF font file.\n");
 		return EXIT_FAILURE;
 	}
 
-	struct timespec startTime, nowTime;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &startTime); // TODO error handling
-	double elapsedTime; // in seconds
-	unsigned long long iterations = 0;
-
-	do {
-		int size = 10 + (rand() % 50);
-		char const * word = WordList[rand() % WordCount];
+	/*
+	Fifty sizes at four subpixel offsets make a few thousand distinct glyphs,
+	which take up a few megabytes as coverage; enough room for all of them
+	keeps the run about drawing, not about evicting.
+	*/
+	static SKR_SharedGlyphCache sharedCache;
+	static SKR_RenderContext contexts[256];
+	unsigned long const sharedSize = 16ul << 20, contextSize = 4ul << 20;
+	void * sharedMemory = NULL;
+	void * contextMemory = NULL;
+	if (shared) {
+		sharedMemory = malloc(sharedSize);
+		contextMemory = malloc(threadCount * contextSize);
+		if (sharedMemory == NULL || contextMemory == NULL) {
+			fprintf(stderr, "Unable to allocate the glyph caches.\n");
+			return EXIT_FAILURE;
+		}
+		skrInitSharedGlyphCache(&sharedCache, sharedMemory, sharedSize);
+		for (int i = 0; i < threadCount; ++i) {
+			skrInitRenderContext(&contexts[i], &sharedCache,
+				(char *) contextMemory + i * contextSize, contextSize);
+		}
+	}
 
-		s = draw_word(&font, size, word);
-		if (!s) ++iterations;
+	Worker workers[256];
+	pthread_t threads[256];
+	for (int i = 0; i < threadCount; ++i) {
+		workers[i] = (Worker) { &font, shared ? &contexts[i] : NULL, seconds, 1 + i, 0, 0.0 };
+	}
+	/* the first worker runs on the main thread */
+	for (int i = 1; i < threadCount; ++i) {
+		if (pthread_create(&threads[i], NULL, run_worker, &workers[i]) != 0) {
+			fprintf(stderr, "Unable to start thread %d.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	run_worker(&workers[0]);
 
-		clock_gettime(CLOCK_MONOTONIC_RAW, &nowTime); // TODO error handling
-		elapsedTime = time_in_seconds(&nowTime) - time_in_seconds(&startTime);
-	} while (elapsedTime < seconds);
+	unsigned long long iterations = workers[0].iterations;
+	double elapsedTime = workers[0].elapsedTime;
+	for (int i = 1; i < threadCount; ++i) {
+		pthread_join(threads[i], NULL);
+		iterations += workers[i].iterations;
+		if (workers[i].elapsedTime > elapsedTime) elapsedTime = workers[i].elapsedTime;
+	}
 
 	printf("SUMMARY:\n");
-	printf("Ran %lld iterations in %f seconds,\n", iterations, elapsedTime);
-	printf("Resulting in an average speed of %f kHz.\n", iterations / (elapsedTime * 1000.0));
+	printf("Ran %lld iterations on %d threads%s in %f seconds,\n", iterations, threadCount,
+		shared ? " with a shared glyph cache" : "", elapsedTime);
+	printf("Resulting in an average speed of %f kHz", iterations / (elapsedTime * 1000.0));
+	printf(" (%f kHz per thread).\n", iterations / (elapsedTime * 1000.0 * threadCount));
 
+	free(contextMemory);
+	free(sharedMemory);
 	free(rawData);
 
 	return EXIT_SUCCESS;